@@ -0,0 +1,137 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Small helpers shared by the benchmarks.
+ */
+
+#ifndef CMONITOR_BENCH_H
+#define CMONITOR_BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <time.h>
+#  include <pthread.h>
+#endif /* _WIN32 */
+
+/* Monotonic time in nanoseconds. */
+static inline uint64_t bench_now_ns(void)
+{
+#if defined(_WIN32)
+	LARGE_INTEGER freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif /* _WIN32 */
+}
+
+/* xorshift64*, good enough to shuffle benchmark inputs. */
+static inline uint64_t bench_rand(uint64_t* state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* A sink for the per-operation log so we time the tracking, not the disk. */
+static inline FILE* bench_null_output(void)
+{
+#if defined(_WIN32)
+	return fopen("NUL", "w");
+#else
+	return fopen("/dev/null", "w");
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	threads
+------------------------------------------------------------------------------*/
+
+typedef void (*bench_thread_fn)(void* arg);
+
+typedef struct bench_thread {
+	bench_thread_fn fn;
+	void* arg;
+#if defined(_WIN32)
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif /* _WIN32 */
+} bench_thread;
+
+#if defined(_WIN32)
+static inline DWORD WINAPI bench_thread_main(LPVOID p)
+{
+	bench_thread* t = p;
+
+	t->fn(t->arg);
+	return 0;
+}
+#else
+static inline void* bench_thread_main(void* p)
+{
+	bench_thread* t = p;
+
+	t->fn(t->arg);
+	return NULL;
+}
+#endif /* _WIN32 */
+
+static inline int bench_thread_start(bench_thread* t, bench_thread_fn fn, void* arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+#if defined(_WIN32)
+	t->handle = CreateThread(NULL, 0, bench_thread_main, t, 0, NULL);
+	return t->handle != NULL;
+#else
+	return pthread_create(&t->handle, NULL, bench_thread_main, t) == 0;
+#endif /* _WIN32 */
+}
+
+static inline void bench_thread_join(bench_thread* t)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+#else
+	pthread_join(t->handle, NULL);
+#endif /* _WIN32 */
+}
+
+#endif /* CMONITOR_BENCH_H */
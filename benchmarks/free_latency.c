@@ -0,0 +1,95 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Measures cm_free_ and cm_realloc_ latency as the number of live blocks
+ * grows. With the hashed index both should stay flat from 1K to 10M.
+ *
+ * usage: free_latency [max_live_blocks]
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+#define SAMPLES 1000
+
+int main(int argc, char* argv[])
+{
+	size_t max_live = 10000000, live, i, j;
+	void** blocks;
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	uint64_t t0, free_ns, realloc_ns;
+	FILE* out;
+
+	if (argc > 1)
+		max_live = (size_t)strtoull(argv[1], NULL, 10);
+	out = bench_null_output();
+	if (!out || !cm_init(out, NULL, 0))
+		return EXIT_FAILURE;
+	blocks = malloc(sizeof(void*) * max_live);
+	if (!blocks)
+		return EXIT_FAILURE;
+
+	printf("live_blocks,free_ns,realloc_ns\n");
+	live = 0;
+	for (i = 1000; i <= max_live; i *= 10) {
+		/* grow the live set */
+		for (; live < i; ++live)
+			blocks[live] = cm_malloc(16);
+		/* realloc random live blocks */
+		t0 = bench_now_ns();
+		for (j = 0; j < SAMPLES; ++j) {
+			size_t k = (size_t)(bench_rand(&rng) % live);
+			blocks[k] = cm_realloc(blocks[k], 16 + (j & 15));
+		}
+		realloc_ns = (bench_now_ns() - t0) / SAMPLES;
+		/* free random live blocks, then put them back */
+		t0 = bench_now_ns();
+		for (j = 0; j < SAMPLES; ++j) {
+			size_t k = (size_t)(bench_rand(&rng) % live);
+			cm_free(blocks[k]);
+			blocks[k] = blocks[--live];
+		}
+		free_ns = (bench_now_ns() - t0) / SAMPLES;
+		for (; live < i; ++live)
+			blocks[live] = cm_malloc(16);
+		printf("%zu,%llu,%llu\n", live,
+			   (unsigned long long)free_ns, (unsigned long long)realloc_ns);
+	}
+
+	for (j = 0; j < live; ++j)
+		cm_free(blocks[j]);
+	free(blocks);
+	fclose(out);
+	return 0;
+}
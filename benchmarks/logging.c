@@ -0,0 +1,85 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Cost of a tracked malloc/free pair with synchronous logging and with
+ * CM_LOG_ASYNC under each full-buffer policy. The output is a real file
+ * since that is where the synchronous writes hurt.
+ *
+ * usage: logging [pairs] [output_file]
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+static const struct {
+	const char* name;
+	uint32_t flags;
+} modes[] = {
+	{ "sync",       0 },
+	{ "async-block", CM_LOG_ASYNC },
+	{ "async-drop", CM_LOG_ASYNC | CM_LOG_FULL_DROP },
+	{ "async-grow", CM_LOG_ASYNC | CM_LOG_FULL_GROW },
+};
+
+int main(int argc, char* argv[])
+{
+	size_t pairs = 1000000, i, m;
+	const char* path = "cm_bench_log.txt";
+	uint64_t t0, ns;
+	cm_stats stats;
+	FILE* out;
+
+	if (argc > 1)
+		pairs = (size_t)strtoull(argv[1], NULL, 10);
+	if (argc > 2)
+		path = argv[2];
+
+	printf("mode,pairs,ns_per_pair,dropped\n");
+	for (m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+		out = fopen(path, "w");
+		if (!out || !cm_init(out, NULL, modes[m].flags))
+			return EXIT_FAILURE;
+		t0 = bench_now_ns();
+		for (i = 0; i < pairs; ++i)
+			cm_free(cm_malloc(32));
+		ns = bench_now_ns() - t0;
+		cm_get_stats(&stats);
+		cm_shutdown();
+		fclose(out);
+		printf("%s,%zu,%.1f,%u\n", modes[m].name, pairs,
+			   (double)ns / (double)pairs, stats.dropped_events);
+	}
+	remove(path);
+	return 0;
+}
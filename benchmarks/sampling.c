@@ -0,0 +1,151 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Overhead of CM_TRACK_SAMPLED on an allocation heavy loop compared to the
+ * plain C allocator and to full tracking. Also prints how far the
+ * estimated leaked bytes are from the real ones.
+ *
+ * usage: sampling [ops] [interval_bytes]
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+#define WORKING_SET 4096
+#define LEAKED      1024
+#define REPEAT      5
+
+static size_t ops = 10000000;
+
+/* Same sequence of sizes and frees for every run. */
+static uint64_t run(int tracked, size_t* leaked)
+{
+	void* blocks[WORKING_SET] = { 0 };
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	uint64_t t0;
+	size_t i, k, size;
+
+	*leaked = 0;
+	t0 = bench_now_ns();
+	for (i = 0; i < ops; ++i) {
+		k = (size_t)(bench_rand(&rng) % WORKING_SET);
+		if (blocks[k]) {
+			if (tracked)
+				cm_free(blocks[k]);
+			else
+				free(blocks[k]);
+			blocks[k] = NULL;
+		} else {
+			size = 8 + (size_t)(bench_rand(&rng) % 1024);
+			blocks[k] = tracked ? cm_malloc(size) : malloc(size);
+		}
+	}
+	/* leave the first LEAKED slots allocated */
+	for (k = 0; k < WORKING_SET; ++k) {
+		if (!blocks[k])
+			continue;
+		if (k < LEAKED) {
+			*leaked += 1;
+			continue;
+		}
+		if (tracked)
+			cm_free(blocks[k]);
+		else
+			free(blocks[k]);
+	}
+	return bench_now_ns() - t0;
+}
+
+static void report(const char* mode, uint64_t ns, uint64_t base_ns)
+{
+	printf("%s,%zu,%llu,%.2f\n", mode, ops, (unsigned long long)ns,
+		   base_ns ? ((double)ns / (double)base_ns - 1.0) * 100.0 : 0.0);
+}
+
+/*
+ * Best of REPEAT runs with the given cmonitor flags (-1: plain malloc).
+ * Sums the leaked bytes, real or estimated, of the last run.
+ */
+static uint64_t best_of(long flags, FILE* out, size_t* leaked_bytes)
+{
+	cm_leak_info** leaks;
+	uint64_t best = 0, ns;
+	size_t leaked, n, i;
+	int r;
+
+	*leaked_bytes = 0;
+	for (r = 0; r < REPEAT; ++r) {
+		if (flags >= 0 && !cm_init(out, NULL, (uint32_t)flags))
+			exit(EXIT_FAILURE);
+		ns = run(flags >= 0, &leaked);
+		if (r == 0 || ns < best)
+			best = ns;
+		if (flags < 0)
+			continue;
+		if (r == REPEAT - 1) {
+			cm_get_leaks(&leaks, &n);
+			for (i = 0; i < n; ++i)
+				*leaked_bytes += leaks[i]->estimated_bytes;
+			cm_free_leaks_info(leaks, n);
+		}
+		cm_shutdown();
+	}
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t interval = 512 * 1024, real, estimated;
+	uint64_t base_ns;
+	FILE* out;
+
+	if (argc > 1)
+		ops = (size_t)strtoull(argv[1], NULL, 10);
+	if (argc > 2)
+		interval = (size_t)strtoull(argv[2], NULL, 10);
+	out = bench_null_output();
+	if (!out)
+		return EXIT_FAILURE;
+	cm_set_sample_interval(interval);
+
+	printf("mode,ops,ns,overhead_pct\n");
+	base_ns = best_of(-1, out, &real);
+	report("malloc", base_ns, 0);
+	report("sampled", best_of(CM_TRACK_SAMPLED, out, &estimated), base_ns);
+	report("full", best_of(0, out, &real), base_ns);
+
+	fprintf(stderr, "leaked bytes: real %zu, estimated %zu\n", real, estimated);
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Cost of CM_TRACK_STACKS per captured depth. The malloc/free pairs run
+ * 80 calls deep so every depth can be filled; depth 0 is the cost without
+ * stack capture and capture_ns the extra cost of a pair at each depth.
+ * Best of REPEAT runs.
+ *
+ * Build with -fno-omit-frame-pointer or the stacks stop at main.
+ *
+ * usage: stacks [pairs]
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+#define NESTING 80
+#define REPEAT  3
+
+static size_t pairs = 1000000;
+
+static uint64_t pairs_at(int nesting)
+{
+	volatile int guard = nesting;
+	uint64_t t0, ns;
+	size_t i;
+
+	if (guard > 0) {
+		ns = pairs_at(nesting - 1);
+		guard = 0; /* not a tail call, keep the frame */
+		return ns;
+	}
+	t0 = bench_now_ns();
+	for (i = 0; i < pairs; ++i)
+		cm_free(cm_malloc(32));
+	ns = bench_now_ns() - t0;
+	return ns;
+}
+
+int main(int argc, char* argv[])
+{
+	static const int depths[] = { 0, 1, 2, 4, 8, 16, 32, 64 };
+	cm_stats stats;
+	uint64_t ns, best;
+	double base = 0.0, per_pair;
+	size_t i;
+	int r;
+	FILE* out;
+
+	if (argc > 1)
+		pairs = (size_t)strtoull(argv[1], NULL, 10);
+	out = bench_null_output();
+	if (!out)
+		return EXIT_FAILURE;
+
+	printf("depth,pairs,ns_per_pair,capture_ns,overhead_bytes\n");
+	for (i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i) {
+		cm_set_stack_depth(depths[i]);
+		best = 0;
+		for (r = 0; r < REPEAT; ++r) {
+			if (!cm_init(out, NULL, depths[i] ? CM_TRACK_STACKS : 0))
+				return EXIT_FAILURE;
+			ns = pairs_at(NESTING);
+			if (r == 0 || ns < best)
+				best = ns;
+			cm_get_stats(&stats);
+			cm_shutdown();
+		}
+		per_pair = (double)best / (double)pairs;
+		if (depths[i] == 0)
+			base = per_pair;
+		printf("%d,%zu,%.1f,%.1f,%u\n", depths[i], pairs, per_pair, per_pair - base,
+			   stats.overhead_bytes);
+	}
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,429 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Tracking overhead on the hot paths, each case run with the plain C
+ * allocator and with cmonitor:
+ *
+ *   latency   malloc+free pairs as the live set grows
+ *   realloc   growth patterns of a block (doubling, linear steps, shrinking)
+ *   order     freeing a batch of blocks in LIFO, FIFO and random order
+ *   threads   malloc/free throughput with CM_TRACK_THREAD_SAFE
+ *   leaks     cm_get_leaks and cm_foreach_live, per live block
+ *
+ * Prints one CSV row per case and allocator, the best of REPEAT runs, so
+ * the output of two builds can be diffed or fed to a script:
+ *
+ *   bench,case,param,impl,ops,ns_per_op
+ *
+ * usage: suite [scale]   (scale multiplies the operations, 0.1 for a quick run)
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+#define REPEAT      3
+#define MAX_LIVE    1000000
+#define MAX_THREADS 8
+#define BATCH       10000
+
+/* allocators compared by every case */
+enum { IMPL_MALLOC, IMPL_CM, IMPL_COUNT };
+
+static const char* impl_names[IMPL_COUNT] = { "malloc", "cm" };
+
+static double scale = 1.0;
+static FILE* out;
+
+static size_t scaled(size_t n)
+{
+	n = (size_t)((double)n * scale);
+	return n ? n : 1;
+}
+
+static void* bench_malloc(int impl, size_t size)
+{
+	return impl == IMPL_CM ? cm_malloc(size) : malloc(size);
+}
+
+static void bench_free(int impl, void* mem)
+{
+	if (impl == IMPL_CM)
+		cm_free(mem);
+	else
+		free(mem);
+}
+
+static void* bench_realloc(int impl, void* mem, size_t size)
+{
+	return impl == IMPL_CM ? cm_realloc(mem, size) : realloc(mem, size);
+}
+
+static void begin(int impl, uint32_t flags)
+{
+	if (impl == IMPL_CM && !cm_init(out, NULL, flags))
+		exit(EXIT_FAILURE);
+}
+
+static void end(int impl)
+{
+	if (impl == IMPL_CM)
+		cm_shutdown();
+}
+
+static void report(const char* bench, const char* name, size_t param, int impl,
+				   size_t ops, uint64_t ns)
+{
+	printf("%s,%s,%zu,%s,%zu,%.2f\n", bench, name, param, impl_names[impl], ops,
+		   (double)ns / (double)ops);
+	fflush(stdout);
+}
+
+/*------------------------------------------------------------------------------
+	latency
+------------------------------------------------------------------------------*/
+
+static uint64_t run_latency(int impl, void** blocks, size_t live, size_t ops)
+{
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	uint64_t t0, ns;
+	size_t i, k;
+
+	begin(impl, 0);
+	for (i = 0; i < live; ++i)
+		blocks[i] = bench_malloc(impl, 16 + (size_t)(bench_rand(&rng) % 240));
+	/* replace random live blocks, the live set keeps its size */
+	t0 = bench_now_ns();
+	for (i = 0; i < ops; ++i) {
+		k = (size_t)(bench_rand(&rng) % live);
+		bench_free(impl, blocks[k]);
+		blocks[k] = bench_malloc(impl, 16 + (size_t)(bench_rand(&rng) % 240));
+	}
+	ns = bench_now_ns() - t0;
+	for (i = 0; i < live; ++i)
+		bench_free(impl, blocks[i]);
+	end(impl);
+	return ns;
+}
+
+static void bench_latency(void** blocks)
+{
+	size_t ops = scaled(1000000), live;
+	uint64_t best, ns;
+	int impl, r;
+
+	for (live = 1000; live <= scaled(MAX_LIVE) && live <= MAX_LIVE; live *= 10) {
+		for (impl = 0; impl < IMPL_COUNT; ++impl) {
+			best = 0;
+			for (r = 0; r < REPEAT; ++r) {
+				ns = run_latency(impl, blocks, live, ops);
+				if (r == 0 || ns < best)
+					best = ns;
+			}
+			/* a malloc and a free per operation */
+			report("latency", "malloc_free", live, impl, ops, best);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------
+	realloc
+------------------------------------------------------------------------------*/
+
+enum { GROW_DOUBLE, GROW_LINEAR, SHRINK, PATTERN_COUNT };
+
+static const char* pattern_names[PATTERN_COUNT] = { "double", "linear", "shrink" };
+
+/* Next size of a block following pattern, 0 once the chain is over. */
+static size_t next_size(int pattern, size_t size)
+{
+	switch (pattern) {
+		case GROW_DOUBLE: return size < 1024 * 1024 ? size * 2 : 0;
+		case GROW_LINEAR: return size < 64 * 1024 ? size + 64 : 0;
+		default:          return size > 64 ? size - 64 : 0;
+	}
+}
+
+static uint64_t run_realloc(int impl, int pattern, size_t chains, size_t* ops)
+{
+	uint64_t t0;
+	size_t i, size;
+	void* mem;
+
+	begin(impl, 0);
+	*ops = 0;
+	t0 = bench_now_ns();
+	for (i = 0; i < chains; ++i) {
+		size = pattern == SHRINK ? 64 * 1024 : 16;
+		mem = bench_malloc(impl, size);
+		while ((size = next_size(pattern, size)) != 0) {
+			mem = bench_realloc(impl, mem, size);
+			++*ops;
+		}
+		bench_free(impl, mem);
+	}
+	t0 = bench_now_ns() - t0;
+	end(impl);
+	return t0;
+}
+
+static void bench_realloc_patterns(void)
+{
+	size_t chains, ops = 0;
+	uint64_t best, ns;
+	int pattern, impl, r;
+
+	for (pattern = 0; pattern < PATTERN_COUNT; ++pattern) {
+		/* the doubling chains are much shorter, give them more rounds */
+		chains = scaled(pattern == GROW_DOUBLE ? 20000 : 200);
+		for (impl = 0; impl < IMPL_COUNT; ++impl) {
+			best = 0;
+			for (r = 0; r < REPEAT; ++r) {
+				ns = run_realloc(impl, pattern, chains, &ops);
+				if (r == 0 || ns < best)
+					best = ns;
+			}
+			report("realloc", pattern_names[pattern], chains, impl, ops, best);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------
+	order
+------------------------------------------------------------------------------*/
+
+enum { FREE_LIFO, FREE_FIFO, FREE_RANDOM, ORDER_COUNT };
+
+static const char* order_names[ORDER_COUNT] = { "lifo", "fifo", "random" };
+
+static uint64_t run_order(int impl, int order, void** blocks, size_t rounds)
+{
+	uint64_t rng = 0x9e3779b97f4a7c15ULL;
+	uint64_t ns = 0, t0;
+	size_t round, i, k;
+	void* tmp;
+
+	begin(impl, 0);
+	for (round = 0; round < rounds; ++round) {
+		for (i = 0; i < BATCH; ++i)
+			blocks[i] = bench_malloc(impl, 16 + (size_t)(bench_rand(&rng) % 240));
+		if (order == FREE_RANDOM) {
+			for (i = BATCH - 1; i > 0; --i) {
+				k = (size_t)(bench_rand(&rng) % (i + 1));
+				tmp = blocks[i];
+				blocks[i] = blocks[k];
+				blocks[k] = tmp;
+			}
+		}
+		/* only the frees are timed */
+		t0 = bench_now_ns();
+		if (order == FREE_LIFO) {
+			for (i = BATCH; i > 0; --i)
+				bench_free(impl, blocks[i - 1]);
+		} else {
+			for (i = 0; i < BATCH; ++i)
+				bench_free(impl, blocks[i]);
+		}
+		ns += bench_now_ns() - t0;
+	}
+	end(impl);
+	return ns;
+}
+
+static void bench_order(void** blocks)
+{
+	size_t rounds = scaled(100);
+	uint64_t best, ns;
+	int order, impl, r;
+
+	for (order = 0; order < ORDER_COUNT; ++order) {
+		for (impl = 0; impl < IMPL_COUNT; ++impl) {
+			best = 0;
+			for (r = 0; r < REPEAT; ++r) {
+				ns = run_order(impl, order, blocks, rounds);
+				if (r == 0 || ns < best)
+					best = ns;
+			}
+			report("order", order_names[order], BATCH, impl, rounds * BATCH, best);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------
+	threads
+------------------------------------------------------------------------------*/
+
+#define WORKING_SET 256
+
+typedef struct worker_arg {
+	int impl;
+	size_t ops;
+	uint64_t seed;
+} worker_arg;
+
+static void worker(void* p)
+{
+	worker_arg* arg = p;
+	void* blocks[WORKING_SET] = { 0 };
+	uint64_t rng = arg->seed;
+	size_t i, k;
+
+	for (i = 0; i < arg->ops; ++i) {
+		k = (size_t)(bench_rand(&rng) % WORKING_SET);
+		if (blocks[k]) {
+			bench_free(arg->impl, blocks[k]);
+			blocks[k] = NULL;
+		} else {
+			blocks[k] = bench_malloc(arg->impl, 16 + (size_t)(bench_rand(&rng) % 240));
+		}
+	}
+	for (k = 0; k < WORKING_SET; ++k) {
+		if (blocks[k])
+			bench_free(arg->impl, blocks[k]);
+	}
+}
+
+static uint64_t run_threads(int impl, size_t n, size_t ops)
+{
+	bench_thread threads[MAX_THREADS];
+	worker_arg args[MAX_THREADS];
+	uint64_t t0;
+	size_t i;
+
+	begin(impl, CM_TRACK_THREAD_SAFE);
+	t0 = bench_now_ns();
+	for (i = 0; i < n; ++i) {
+		args[i].impl = impl;
+		args[i].ops = ops;
+		args[i].seed = (uint64_t)(i + 1) * 0x9e3779b97f4a7c15ULL;
+		if (!bench_thread_start(&threads[i], worker, &args[i]))
+			exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; ++i)
+		bench_thread_join(&threads[i]);
+	t0 = bench_now_ns() - t0;
+	end(impl);
+	return t0;
+}
+
+static void bench_threads(void)
+{
+	size_t ops = scaled(1000000), n;
+	uint64_t best, ns;
+	int impl, r;
+
+	for (n = 1; n <= MAX_THREADS; n *= 2) {
+		for (impl = 0; impl < IMPL_COUNT; ++impl) {
+			best = 0;
+			for (r = 0; r < REPEAT; ++r) {
+				ns = run_threads(impl, n, ops);
+				if (r == 0 || ns < best)
+					best = ns;
+			}
+			/* wall time per operation of all the threads together */
+			report("threads", "churn", n, impl, n * ops, best);
+		}
+	}
+}
+
+/*------------------------------------------------------------------------------
+	leaks
+------------------------------------------------------------------------------*/
+
+static int count_block(const cm_leak_info* block, void* ctx)
+{
+	(void)block;
+	++*(size_t*)ctx;
+	return 0;
+}
+
+static void bench_leaks(void** blocks)
+{
+	cm_leak_info** leaks;
+	uint64_t t0, best_get, best_walk;
+	size_t live, i, n, walked;
+	int r;
+
+	for (live = 1000; live <= scaled(MAX_LIVE) && live <= MAX_LIVE; live *= 10) {
+		begin(IMPL_CM, 0);
+		for (i = 0; i < live; ++i)
+			blocks[i] = cm_malloc(16);
+		best_get = best_walk = 0;
+		for (r = 0; r < REPEAT; ++r) {
+			t0 = bench_now_ns();
+			cm_get_leaks(&leaks, &n);
+			cm_free_leaks_info(leaks, n);
+			t0 = bench_now_ns() - t0;
+			if (r == 0 || t0 < best_get)
+				best_get = t0;
+			walked = 0;
+			t0 = bench_now_ns();
+			cm_foreach_live(count_block, &walked, 0);
+			t0 = bench_now_ns() - t0;
+			if (r == 0 || t0 < best_walk)
+				best_walk = t0;
+		}
+		report("leaks", "get_leaks", live, IMPL_CM, live, best_get);
+		report("leaks", "foreach_live", live, IMPL_CM, live, best_walk);
+		for (i = 0; i < live; ++i)
+			cm_free(blocks[i]);
+		end(IMPL_CM);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	void** blocks;
+
+	if (argc > 1)
+		scale = strtod(argv[1], NULL);
+	if (scale <= 0.0) {
+		fprintf(stderr, "usage: suite [scale]\n");
+		return EXIT_FAILURE;
+	}
+	out = bench_null_output();
+	blocks = malloc(sizeof(void*) * (MAX_LIVE > BATCH ? MAX_LIVE : BATCH));
+	if (!out || !blocks)
+		return EXIT_FAILURE;
+
+	printf("bench,case,param,impl,ops,ns_per_op\n");
+	bench_latency(blocks);
+	bench_realloc_patterns();
+	bench_order(blocks);
+	bench_threads();
+	bench_leaks(blocks);
+
+	free(blocks);
+	fclose(out);
+	return 0;
+}
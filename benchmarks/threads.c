@@ -0,0 +1,101 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * malloc/free throughput with CM_TRACK_THREAD_SAFE from 1 to 64 threads.
+ * Each thread churns through its own small working set, so ideally the
+ * throughput grows linearly with the number of threads (up to the number of
+ * cores).
+ *
+ * usage: threads [ops_per_thread]
+ */
+
+/* clock_gettime() */
+#ifndef _POSIX_C_SOURCE
+#  define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cmonitor/cm.h"
+
+#include "bench.h"
+
+#define MAX_THREADS  64
+#define WORKING_SET  256
+
+static size_t ops_per_thread = 1000000;
+
+static void worker(void* arg)
+{
+	void* blocks[WORKING_SET] = { 0 };
+	uint64_t rng = (uint64_t)(uintptr_t)arg * 0x9e3779b97f4a7c15ULL + 1;
+	size_t i, k;
+
+	for (i = 0; i < ops_per_thread; ++i) {
+		k = (size_t)(bench_rand(&rng) % WORKING_SET);
+		if (blocks[k]) {
+			cm_free(blocks[k]);
+			blocks[k] = NULL;
+		} else {
+			blocks[k] = cm_malloc(16 + (size_t)(bench_rand(&rng) % 240));
+		}
+	}
+	for (k = 0; k < WORKING_SET; ++k) {
+		if (blocks[k])
+			cm_free(blocks[k]);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	bench_thread threads[MAX_THREADS];
+	size_t n, i;
+	uint64_t t0, ns;
+	FILE* out;
+
+	if (argc > 1)
+		ops_per_thread = (size_t)strtoull(argv[1], NULL, 10);
+	out = bench_null_output();
+	if (!out)
+		return EXIT_FAILURE;
+
+	printf("threads,ops,ns,mops_per_sec\n");
+	for (n = 1; n <= MAX_THREADS; n *= 2) {
+		if (!cm_init(out, NULL, CM_TRACK_THREAD_SAFE))
+			return EXIT_FAILURE;
+		t0 = bench_now_ns();
+		for (i = 0; i < n; ++i)
+			bench_thread_start(&threads[i], worker, (void*)(uintptr_t)(i + 1));
+		for (i = 0; i < n; ++i)
+			bench_thread_join(&threads[i]);
+		ns = bench_now_ns() - t0;
+		printf("%zu,%zu,%llu,%.3f\n", n, n * ops_per_thread,
+			   (unsigned long long)ns, (double)(n * ops_per_thread) * 1e3 / (double)ns);
+		cm_shutdown();
+	}
+	fclose(out);
+	return 0;
+}
@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 /*------------------------------------------------------------------------------
 	Library types
@@ -47,6 +48,22 @@ typedef struct cm_leak_info {
 	int line;             /**< File's line where the memory allocation happened. */
 	size_t bytes;         /**< Allocated bytes. */
 	void* address;        /**< Allocated memory address. DO NOT free manually. */
+	size_t estimated_bytes; /**< Bytes this block stands for: equal to bytes
+	                             unless sampling (CM_TRACK_SAMPLED), where
+	                             the sum over all the leaks estimates the
+	                             real leaked bytes. */
+	void* const* stack;   /**< Return addresses of the allocation's call
+	                           stack, innermost first (CM_TRACK_STACKS).
+	                           Valid until cm_shutdown/cm_init. */
+	int stack_depth;      /**< Number of entries in stack, 0 if none. */
+	uint32_t epoch;       /**< Epoch the block was allocated in, see
+	                           cm_checkpoint. */
+	uint32_t reallocs;    /**< Times the block was reallocated since. */
+	uint32_t thread;      /**< Thread that allocated the block, see
+	                           cm_thread_id. */
+	const char* tag;      /**< Innermost tag when the block was allocated
+	                           (see cm_tag_push), NULL if none. Valid until
+	                           cm_shutdown/cm_init. */
 } cm_leak_info;
 
 /**
@@ -56,7 +73,8 @@ typedef struct cm_stats {
 	uint32_t total_allocated; /**< Total allocated bytes since the initialization 
 	                               of the library till the end of the program. */
 	uint32_t total_freed;     /**< Total freed bytes since the initialization 
-	                               of the library till the end of the program. */
+	                               of the library till the end of the program.
+	                               An estimate with CM_TRACK_SAMPLED. */
 	uint32_t malloc_count;    /**< Number of times the malloc function has been 
 	                               called since the initialization of the library 
 	                               till the end of the program. */
@@ -68,14 +86,230 @@ typedef struct cm_stats {
 	                               till the end of the program. */
 	uint32_t realloc_count;   /**< Number of times the realloc function has been
 	                               called since the initialization of the library 
-	                               till the end of the program. */
+	                               till the end of the program. With
+	                               CM_TRACK_SAMPLED each call adds the new size
+	                               to total_allocated and the (estimated) old
+	                               size to total_freed. */
+	uint32_t overhead_bytes;  /**< Bytes currently used by the library itself to
+	                               keep track of the allocations. */
+	uint32_t dropped_events;  /**< Number of events not logged because the
+	                               buffer was full (CM_LOG_FULL_DROP). */
+	uint32_t live_bytes;      /**< total_allocated - total_freed. */
+	uint32_t live_blocks;     /**< Blocks allocated and not freed yet. An
+	                               estimate with CM_TRACK_SAMPLED. */
+	uint32_t peak_bytes;      /**< Highest live_bytes reached. Threads publish
+	                               their allocations every CM_PEAK_SLACK bytes
+	                               (64 KiB by default) to keep the hot path
+	                               free of contention: off by at most that
+	                               much per thread. */
 } cm_stats;
 
+/**
+ * The allocation profile of a call site, a (filename, line) pair where
+ * memory is allocated. Blocks freed or reallocated elsewhere still count for
+ * the site that allocated them.
+ */
+typedef struct cm_site_stats {
+	const char* filename; /**< Filename of the call site. */
+	int line;             /**< File's line of the call site. */
+	uint32_t live_bytes;  /**< Bytes allocated here and not freed yet. */
+	uint32_t live_count;  /**< Blocks allocated here and not freed yet. */
+	uint32_t alloc_count; /**< Blocks allocated here since the initialization
+	                           of the library. */
+	uint32_t alloc_bytes; /**< Bytes of those blocks. */
+	uint32_t free_count;  /**< Blocks allocated here and freed since. */
+	uint32_t peak_bytes;  /**< Highest live_bytes reached. */
+	uint32_t remote_frees; /**< Of the freed blocks, the ones freed by
+	                            another thread than the one that allocated
+	                            them. */
+} cm_site_stats;
+
+/**
+ * Number of lifetime buckets of cm_site_lifetimes: bucket 0 holds the
+ * lifetimes under 256 ns, bucket i those from 2^(7+i) to 2^(8+i) ns and the
+ * last one everything from 2^38 ns (about 4.6 minutes) on.
+ */
+#define CM_LIFETIME_BUCKETS 32
+
+/**
+ * How long the blocks of a call site lived (see CM_TRACK_LIFETIMES).
+ */
+typedef struct cm_site_lifetimes {
+	const char* filename;  /**< Filename of the call site. */
+	int line;              /**< File's line of the call site. */
+	uint32_t freed;        /**< Blocks allocated here and freed since. */
+	uint32_t short_lived;  /**< Of those, the ones freed within 10 us
+	                            (CM_SHORT_LIVED_NS when building the
+	                            library). */
+	int arena_candidate;   /**< Non zero if most blocks were short lived:
+	                            the allocations could move to the stack or
+	                            to an arena. */
+	uint32_t buckets[CM_LIFETIME_BUCKETS]; /**< Freed blocks by lifetime. */
+} cm_site_lifetimes;
+
+/**
+ * The realloc chains resized by a call site (see cm_get_realloc_sites).
+ */
+typedef struct cm_realloc_site {
+	const char* filename;  /**< Filename of the realloc call. */
+	int line;              /**< File's line of the realloc call. */
+	uint32_t reallocs;     /**< Tracked blocks resized here. */
+	uint32_t moves;        /**< Of those, the ones moved to a new address,
+	                            the others were resized in place. */
+	uint32_t grows;        /**< Of those, the ones that grew. */
+	uint32_t slow_grows;   /**< Of those, the ones that grew less than 1.5
+	                            times: sub-geometric growth. */
+	double growth_factor;  /**< Bytes after the growths over bytes before
+	                            them, 0 if none. */
+	uint64_t copied_bytes; /**< Bytes copied by the moves. */
+	uint64_t wasted_bytes; /**< Estimate of the copied bytes a geometric
+	                            growth would have spared: how far the
+	                            copies of each chain went past the size of
+	                            its block. */
+	int churn;             /**< Non zero if most growths were sub-geometric
+	                            or most copies were wasted. */
+} cm_realloc_site;
+
+/**
+ * The blocks a thread allocated (see cm_get_thread_stats). Only blocks with
+ * a record count.
+ */
+typedef struct cm_thread_stats {
+	uint32_t thread;        /**< Id of the thread, see cm_thread_id. 0 stands
+	                             for all the threads from CM_THREAD_SLOTS on. */
+	uint32_t live_bytes;    /**< Bytes allocated by the thread and not freed
+	                             yet, whichever thread frees them. Reallocs
+	                             by other threads count for it too. An
+	                             estimate with CM_TRACK_SAMPLED. */
+	uint32_t remote_frees;  /**< Blocks of the thread freed by other ones. */
+	uint32_t foreign_frees; /**< Blocks of other threads freed by this one. */
+} cm_thread_stats;
+
+/**
+ * A node of the tag tree (see cm_get_tag_tree). The counters without the
+ * tree_ prefix are those of the blocks allocated with this tag innermost,
+ * the tree_ ones add the blocks of all the tags nested in it.
+ */
+typedef struct cm_tag_stats {
+	const char* name;         /**< Name of the tag, valid until
+	                               cm_shutdown/cm_init. */
+	uint32_t id;              /**< Id of the tag, 1-based. */
+	uint32_t parent;          /**< Id of the enclosing tag, 0 if none. */
+	int depth;                /**< Number of enclosing tags. */
+	uint32_t live_bytes;      /**< Bytes allocated and not freed yet. An
+	                               estimate with CM_TRACK_SAMPLED. */
+	uint32_t live_count;      /**< Blocks allocated and not freed yet. */
+	uint32_t alloc_count;     /**< Blocks allocated since the
+	                               initialization of the library. */
+	uint32_t alloc_bytes;     /**< Bytes of those blocks. */
+	uint32_t free_count;      /**< Blocks allocated and freed since. */
+	uint32_t peak_bytes;      /**< Highest live_bytes reached. */
+	uint32_t tree_live_bytes; /**< live_bytes of the whole subtree. */
+	uint32_t tree_live_count; /**< live_count of the whole subtree. */
+} cm_tag_stats;
+
+/**
+ * Blocks allocated by one thread and freed by another (see
+ * cm_get_thread_pairs).
+ */
+typedef struct cm_thread_pair {
+	uint32_t alloc_thread; /**< Id of the thread that allocated them. */
+	uint32_t free_thread;  /**< Id of the thread that freed them. */
+	uint32_t frees;        /**< Number of those blocks. An estimate with
+	                            CM_TRACK_SAMPLED. */
+} cm_thread_pair;
+
+/**
+ * The blocks a call site allocated between two checkpoints and that are
+ * still live (see cm_diff).
+ */
+typedef struct cm_site_growth {
+	const char* filename; /**< Filename of the call site. */
+	int line;             /**< File's line of the call site. */
+	size_t bytes;         /**< Bytes of those blocks. An estimate with
+	                           CM_TRACK_SAMPLED. */
+	uint32_t count;       /**< Number of those blocks. An estimate with
+	                           CM_TRACK_SAMPLED. */
+} cm_site_growth;
+
+/**
+ * The traffic of one size class of the allocation size histogram (see
+ * cm_get_size_histogram).
+ */
+typedef struct cm_size_bucket {
+	size_t min_size;   /**< Smallest size of the class. */
+	size_t max_size;   /**< Largest size of the class. */
+	uint32_t allocs;   /**< Blocks of this size allocated by malloc, calloc
+	                        and realloc of a NULL pointer. */
+	uint32_t frees;    /**< Blocks of this size freed. An estimate with
+	                        CM_TRACK_SAMPLED. */
+	uint32_t reallocs; /**< Reallocations that changed the size of a block
+	                        by this many bytes, either way. An estimate with
+	                        CM_TRACK_SAMPLED. */
+} cm_size_bucket;
+
+/**
+ * A point of the memory timeline (see cm_timeline_start).
+ */
+typedef struct cm_timeline_sample {
+	uint64_t time_ns;     /**< Nanoseconds since cm_timeline_start. */
+	uint32_t live_bytes;  /**< cm_stats::live_bytes at that time. */
+	uint32_t live_blocks; /**< cm_stats::live_blocks at that time. */
+	uint32_t alloc_rate;  /**< Bytes allocated per second since the previous
+	                           sample (a realloc counts for its growth). */
+	uint32_t op_rate;     /**< Calls to malloc, calloc, realloc and free per
+	                           second since the previous sample. */
+} cm_timeline_sample;
+
+/**
+ * The memory the process holds according to the OS, next to what cmonitor
+ * tracks (see cm_rss_start).
+ */
+typedef struct cm_rss_sample {
+	uint64_t time_ns;        /**< Nanoseconds since cm_init. */
+	uint64_t rss_bytes;      /**< Resident set of the process. */
+	uint64_t anon_bytes;     /**< Of those, the anonymous ones: the heap, the
+	                              thread stacks and other private mappings.
+	                              0 if the OS doesn't tell. */
+	uint32_t live_bytes;     /**< cm_stats::live_bytes at that time. */
+	uint32_t overhead_bytes; /**< cm_stats::overhead_bytes at that time. */
+	uint32_t epoch;          /**< Epoch the sample was taken in, see
+	                              cm_checkpoint. */
+	double fragmentation;    /**< anon_bytes (rss_bytes if unknown) over
+	                              live_bytes + overhead_bytes, 0 if both are
+	                              zero. Near 1 when the tracked memory
+	                              explains what the process holds; well
+	                              above 1 with a fragmented heap, memory
+	                              kept by the allocator or untracked
+	                              allocations. */
+} cm_rss_sample;
+
+/**
+ * A call site emitted by the cm_* macros (see CM_THIS_SITE). Filled at
+ * compile time and bound to the library's site table on first use, or by
+ * cm_init for the descriptors of the cm_sites linker section.
+ *
+ * @warning Internal, only create one through CM_THIS_SITE.
+ */
+typedef struct cm_site_desc {
+	const char* filename;
+	const char* basename;         /* NULL if not known at compile time */
+	void* volatile site;          /* internal */
+	int line;
+	volatile uint32_t generation; /* internal, cm_init the site is bound to */
+} cm_site_desc;
+
 /**
  * Callback function prototype for errors/warnings/infos.
  */
 typedef void(*cm_error_fn)(int cm_err, const char* msg);
 
+/**
+ * Callback function prototype for cm_foreach_live. Return non zero to stop
+ * the enumeration.
+ */
+typedef int(*cm_live_fn)(const cm_leak_info* block, void* ctx);
+
 /*------------------------------------------------------------------------------
 	Initialization flags
 ------------------------------------------------------------------------------*/
@@ -129,6 +363,140 @@ typedef void(*cm_error_fn)(int cm_err, const char* msg);
 		CM_SIGNAL_ON_REALLOC_SIZE_ZERO   \
 	)
 
+/*------------------------------------------------------------------------------
+	Tracking flags
+------------------------------------------------------------------------------*/
+
+/**
+ * If set, store each allocation's infos in a header right before the memory
+ * block returned to the user instead of in a separate node. Every allocation
+ * then needs a single underlying malloc() and cm_free finds its infos with
+ * pointer arithmetic and drops them in constant time, without a lookup.
+ *
+ * A pointer not allocated by cmonitor is detected through a cookie stored in
+ * the header. Detection reads the bytes before the pointer, so freeing a
+ * pointer at the very beginning of a foreign memory mapping may crash.
+ *
+ * @note All blocks must be released through cmonitor: the pointer returned
+ *       to the user is not the one returned by the C allocator.
+ */
+#define CM_TRACK_INLINE_HEADER 0x00010000
+
+/**
+ * If set, the library can be used from multiple threads at once. Live blocks
+ * are spread over independently locked shards and stats are kept per thread
+ * and summed up on read, so threads rarely contend.
+ *
+ * @note cm_init and cm_shutdown must still be called while no other thread
+ *       is using the library.
+ */
+#define CM_TRACK_THREAD_SAFE   0x00020000
+
+/**
+ * If set, only a sample of the allocations is tracked: on average one per
+ * sampling interval bytes (512 KiB by default, see cm_set_sample_interval),
+ * picked so that every allocated byte has the same chance of being sampled.
+ * The other allocations only pay for a per-thread countdown. Cheap enough
+ * to be left enabled in production.
+ *
+ * Counts and total_allocated stay exact, total_freed, cm_leak_info
+ * estimated_bytes and the cm_site_stats byte and block counts are unbiased
+ * estimates. Only sampled blocks are logged and returned by cm_get_leaks.
+ *
+ * @note Blocks not sampled are released with free() without any check, so
+ *       CM_SIGNAL_ON_FREEING_UNKNOWN and CM_SIGNAL_ON_REALLOC_UNKNOWN have
+ *       no effect. CM_TRACK_INLINE_HEADER is ignored.
+ */
+#define CM_TRACK_SAMPLED       0x00200000
+
+/**
+ * If set, capture the call stack of every tracked allocation, up to
+ * cm_set_stack_depth frames (16 by default). Each distinct stack is stored
+ * once and returned by cm_get_leaks in cm_leak_info::stack.
+ *
+ * Stacks are walked through the frame pointers on non Windows systems:
+ * build the program with -fno-omit-frame-pointer or the stacks stop at the
+ * first function built without.
+ */
+#define CM_TRACK_STACKS        0x00400000
+
+/**
+ * The most frames captured per stack with CM_TRACK_STACKS.
+ */
+#define CM_STACK_MAX_DEPTH     64
+
+/**
+ * If set, timestamp every tracked allocation and record per call site how
+ * long the blocks lived when they are freed (see cm_get_site_lifetimes and
+ * cm_set_clock). A reallocated block keeps its timestamp.
+ */
+#define CM_TRACK_LIFETIMES     0x00800000
+
+/*------------------------------------------------------------------------------
+	Logging flags
+------------------------------------------------------------------------------*/
+
+/**
+ * If set, allocation events are not written to the output by the thread
+ * doing the allocation. They are stored in a per-thread buffer and a
+ * background thread formats and writes them in big batches.
+ *
+ * Events of a single thread keep their order, events of different threads
+ * may be written out of order.
+ *
+ * @note Call cm_flush before reading the output and cm_shutdown before the
+ *       program ends or the latest events may be lost.
+ *
+ * @note The background thread stays in the parent of a fork(): the child
+ *       drops the events buffered at the time of the fork, which are the
+ *       parent's to write, and logs synchronously from then on.
+ */
+#define CM_LOG_ASYNC           0x00040000
+
+/**
+ * With CM_LOG_ASYNC, when a thread's buffer is full drop the event and count
+ * it in cm_stats::dropped_events. By default the thread waits for the
+ * background writer to make room.
+ */
+#define CM_LOG_FULL_DROP       0x00080000
+
+/**
+ * With CM_LOG_ASYNC, when a thread's buffer is full allocate a buffer twice
+ * as big instead of waiting for the background writer.
+ */
+#define CM_LOG_FULL_GROW       0x00100000
+
+/*------------------------------------------------------------------------------
+	Enumeration flags
+------------------------------------------------------------------------------*/
+
+/**
+ * Make cm_foreach_live copy the live blocks first, holding the lock of each
+ * index shard only while copying that shard, and call fn without any lock
+ * held. fn may then allocate and free through cmonitor.
+ *
+ * Every block is seen once with consistent infos. Blocks allocated, freed
+ * or reallocated while the copy is being made may be left out.
+ */
+#define CM_LIVE_SNAPSHOT 0x0001
+
+/*------------------------------------------------------------------------------
+	Timeline formats
+------------------------------------------------------------------------------*/
+
+/**
+ * One line per sample: time_ns,live_bytes,live_blocks,alloc_rate,op_rate
+ * after a header line with the column names.
+ */
+#define CM_TIMELINE_CSV    0
+
+/**
+ * The bytes "CMTL", then the little-endian uint32 version (1), record size
+ * (24) and record count, then the records: uint64 time_ns and uint32
+ * live_bytes, live_blocks, alloc_rate and op_rate, all little-endian.
+ */
+#define CM_TIMELINE_BINARY 1
+
 /*------------------------------------------------------------------------------
 	Error flags
 ------------------------------------------------------------------------------*/
@@ -154,6 +522,79 @@ typedef void(*cm_error_fn)(int cm_err, const char* msg);
  */
 #define CM_ERR_UB      3
 
+/*------------------------------------------------------------------------------
+	Site metrics
+------------------------------------------------------------------------------*/
+
+/**
+ * Sort sites by cm_site_stats::live_bytes.
+ */
+#define CM_SITE_LIVE_BYTES  0
+
+/**
+ * Sort sites by cm_site_stats::live_count.
+ */
+#define CM_SITE_LIVE_COUNT  1
+
+/**
+ * Sort sites by cm_site_stats::alloc_count.
+ */
+#define CM_SITE_ALLOC_COUNT 2
+
+/**
+ * Sort sites by cm_site_stats::free_count.
+ */
+#define CM_SITE_FREE_COUNT  3
+
+/**
+ * Sort sites by cm_site_stats::peak_bytes.
+ */
+#define CM_SITE_PEAK_BYTES  4
+
+/**
+ * Sort sites by cm_site_stats::remote_frees.
+ */
+#define CM_SITE_REMOTE_FREES 5
+
+/*------------------------------------------------------------------------------
+	Clocks
+------------------------------------------------------------------------------*/
+
+/**
+ * The CPU time stamp counter, calibrated against the monotonic clock.
+ * Precise enough for lifetimes of a few nanoseconds, but it must run at a
+ * constant rate on every core (any x86 CPU of the last decade does). The
+ * precise monotonic clock where there is none. The default.
+ */
+#define CM_CLOCK_TSC    0
+
+/**
+ * The coarse monotonic clock (CLOCK_MONOTONIC_COARSE, GetTickCount64 on
+ * Windows). Cheaper to read, but it moves by a tick of one to a few
+ * milliseconds: shorter lifetimes read as 0 and count as short lived.
+ */
+#define CM_CLOCK_COARSE 1
+
+/*------------------------------------------------------------------------------
+	Size classes
+------------------------------------------------------------------------------*/
+
+/**
+ * Number of classes of the size histogram: sizes under 4 have a class each,
+ * every power of two above is split in 4 classes of equal width.
+ */
+#define CM_SIZE_CLASSES 252
+
+/*------------------------------------------------------------------------------
+	Threads
+------------------------------------------------------------------------------*/
+
+/**
+ * Threads told apart by cm_get_thread_stats and cm_get_thread_pairs. Ids
+ * from CM_THREAD_SLOTS on all count as thread 0.
+ */
+#define CM_THREAD_SLOTS 64
+
 /*------------------------------------------------------------------------------
 	Library functions
 ------------------------------------------------------------------------------*/
@@ -178,6 +619,177 @@ extern "C" {
  */
 CMAPI int CMCALL cm_init(FILE* output, cm_error_fn on_error, uint32_t flags);
 
+/**
+ * Release every resource held by the library. Memory blocks still allocated
+ * are not freed and are no longer tracked.
+ *
+ * @note Call cm_init again before using the library after this.
+ */
+CMAPI void CMCALL cm_shutdown(void);
+
+/**
+ * Wait until every allocation event reported so far has been written to the
+ * output.
+ */
+CMAPI void CMCALL cm_flush(void);
+
+/**
+ * Start writing allocation events to a binary trace file instead of the text
+ * output. The file is memory mapped and used as a ring of fixed size: once
+ * full, the oldest events are overwritten.
+ *
+ * See cmonitor/trace.h for the format and tools/cm_trace_decode.c to turn a
+ * trace back into text.
+ *
+ * @param path        The trace file, created or truncated.
+ * @param ring_bytes  Space for the events, at least 128 KiB are used.
+ *
+ * @retval 0  On failure (the file couldn't be created or mapped).
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_trace_open(const char* path, size_t ring_bytes);
+
+/**
+ * Stop tracing and go back to the text output. Also done by cm_shutdown.
+ */
+CMAPI void CMCALL cm_trace_close(void);
+
+/**
+ * Set the mean number of bytes allocated between two samples with
+ * CM_TRACK_SAMPLED. Each thread picks up the new value at its next sample.
+ *
+ * @param bytes  The sampling interval, 0 for the default (512 KiB).
+ */
+CMAPI void CMCALL cm_set_sample_interval(size_t bytes);
+
+/**
+ * Set how many frames of the call stack are captured with CM_TRACK_STACKS.
+ * Only affects the allocations made after the call.
+ *
+ * @param depth  From 1 to CM_STACK_MAX_DEPTH, 0 for the default (16).
+ */
+CMAPI void CMCALL cm_set_stack_depth(int depth);
+
+/**
+ * Set the clock timestamping the allocations with CM_TRACK_LIFETIMES. Call
+ * it right after cm_init: the lifetimes of the blocks allocated before the
+ * switch are meaningless. Calibrating CM_CLOCK_TSC takes a couple of
+ * milliseconds.
+ *
+ * @param clock  CM_CLOCK_TSC or CM_CLOCK_COARSE.
+ */
+CMAPI void CMCALL cm_set_clock(int clock);
+
+/**
+ * Start a background thread recording the live memory and the allocation
+ * rate every interval_ms into a ring of max_samples samples: once full, the
+ * oldest samples are overwritten. Restarts the timeline if already running.
+ *
+ * @param interval_ms  Time between two samples, at least 1.
+ * @param max_samples  Size of the ring, at least 1.
+ *
+ * @retval 0  On failure (invalid parameters or out of resources).
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_timeline_start(uint32_t interval_ms, size_t max_samples);
+
+/**
+ * Stop the timeline thread. The samples are kept until the next
+ * cm_timeline_start or cm_shutdown.
+ */
+CMAPI void CMCALL cm_timeline_stop(void);
+
+/**
+ * Get the latest samples of the timeline, oldest first.
+ *
+ * @param out          Array of at least max_samples elements.
+ * @param max_samples  How many samples to return at most.
+ *
+ * @return The number of samples written to out.
+ */
+CMAPI size_t CMCALL cm_timeline_get(cm_timeline_sample* out, size_t max_samples);
+
+/**
+ * Start recording the resident memory of the process into a ring of
+ * max_samples samples: once full, the oldest samples are overwritten. A
+ * sample is taken at every cm_checkpoint and, if interval_ms is not zero,
+ * every interval_ms by a background thread. Restarts the recording if
+ * already running.
+ *
+ * @param interval_ms  Time between two samples of the thread, 0 for no
+ *                     thread.
+ * @param max_samples  Size of the ring, at least 1.
+ *
+ * @retval 0  On failure (invalid parameters, out of resources or an OS
+ *            without a way to read the resident memory).
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_rss_start(uint32_t interval_ms, size_t max_samples);
+
+/**
+ * Stop recording the resident memory. The samples are kept until the next
+ * cm_rss_start or cm_shutdown.
+ */
+CMAPI void CMCALL cm_rss_stop(void);
+
+/**
+ * Sample the resident memory now. The sample is also recorded if
+ * cm_rss_start is running.
+ *
+ * @param out  Where to put the sample, may be NULL.
+ *
+ * @retval 0  If the OS doesn't tell the resident memory.
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_rss_sample_now(cm_rss_sample* out);
+
+/**
+ * Get the latest recorded samples of the resident memory, oldest first.
+ *
+ * @param out          Array of at least max_samples elements.
+ * @param max_samples  How many samples to return at most.
+ *
+ * @return The number of samples written to out.
+ */
+CMAPI size_t CMCALL cm_rss_get(cm_rss_sample* out, size_t max_samples);
+
+/**
+ * Publish the counters, the top sites and the size histogram in a named
+ * shared memory segment (see cmonitor/shm.h), updated every interval_ms
+ * by a background thread. Other processes can map it and read the numbers
+ * at any rate (see tools/cm_top.c): they never block the updates and the
+ * monitored process never waits for them. Publishes under the new name if
+ * already publishing.
+ *
+ * On POSIX systems it needs -lrt with glibc before 2.34.
+ *
+ * @param name         Name of the segment, NULL for "/cmonitor.<pid>"
+ *                     ("Local\cmonitor.<pid>" on Windows).
+ * @param interval_ms  Time between two updates, at least 1.
+ *
+ * @retval 0  On failure (invalid parameters or out of resources).
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_shm_publish(const char* name, uint32_t interval_ms);
+
+/**
+ * Stop publishing and remove the segment. Readers still attached keep the
+ * last numbers. Called by cm_shutdown.
+ */
+CMAPI void CMCALL cm_shm_unpublish(void);
+
+/**
+ * Write all the samples of the timeline, oldest first.
+ *
+ * @param out     The file to write to, opened in binary mode for
+ *                CM_TIMELINE_BINARY.
+ * @param format  CM_TIMELINE_CSV or CM_TIMELINE_BINARY.
+ *
+ * @retval 0  On failure (write error or unknown format).
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_timeline_write(FILE* out, int format);
+
 /**
  * Print to the output (previously set during the library initialization) the
  * current stats.
@@ -191,6 +803,182 @@ CMAPI void CMCALL cm_print_stats(void);
  */
 CMAPI void CMCALL cm_get_stats(cm_stats* out);
 
+/**
+ * Get the call sites with the highest value of a metric, highest first. The
+ * cost depends on the number of sites, not on the number of live blocks.
+ * Sites that never allocated anything are left out.
+ *
+ * @param out        Array of at least max_sites elements.
+ * @param max_sites  How many sites to return at most.
+ * @param metric     One of the CM_SITE_* metrics.
+ *
+ * @return The number of sites written to out.
+ */
+CMAPI size_t CMCALL cm_get_site_stats(cm_site_stats* out, size_t max_sites, int metric);
+
+/**
+ * Get the lifetimes of the blocks of the call sites with CM_TRACK_LIFETIMES,
+ * the sites with the most short lived blocks first. Sites that never freed
+ * anything are left out.
+ *
+ * @param out        Array of at least max_sites elements.
+ * @param max_sites  How many sites to return at most.
+ *
+ * @return The number of sites written to out.
+ */
+CMAPI size_t CMCALL cm_get_site_lifetimes(cm_site_lifetimes* out, size_t max_sites);
+
+/**
+ * Get the call sites of realloc with the most wasted copies first, see
+ * cm_realloc_site. Only the reallocs of blocks with a record count. Sites
+ * that never reallocated anything are left out.
+ *
+ * @param out        Array of at least max_sites elements.
+ * @param max_sites  How many sites to return at most.
+ *
+ * @return The number of sites written to out.
+ */
+CMAPI size_t CMCALL cm_get_realloc_sites(cm_realloc_site* out, size_t max_sites);
+
+/**
+ * Get the id cmonitor gives to the calling thread, 1 for the first thread
+ * that allocated through it. The id of a thread that exited is given to the
+ * next new thread.
+ *
+ * @return The id, 0 if the library isn't initialized.
+ */
+CMAPI uint32_t CMCALL cm_thread_id(void);
+
+/**
+ * Get the live bytes and the cross-thread frees of every thread, the
+ * threads with the most live bytes first. Threads that never allocated or
+ * freed a block with a record are left out.
+ *
+ * @param out          Array of at least max_threads elements,
+ *                     CM_THREAD_SLOTS are always enough.
+ * @param max_threads  How many threads to return at most.
+ *
+ * @return The number of threads written to out.
+ */
+CMAPI size_t CMCALL cm_get_thread_stats(cm_thread_stats* out, size_t max_threads);
+
+/**
+ * Get the pairs of threads where one frees the blocks of the other, the
+ * pairs with the most frees first. See CM_SITE_REMOTE_FREES for the call
+ * sites of those blocks.
+ *
+ * @param out        Array of at least max_pairs elements.
+ * @param max_pairs  How many pairs to return at most.
+ *
+ * @return The number of pairs written to out.
+ */
+CMAPI size_t CMCALL cm_get_thread_pairs(cm_thread_pair* out, size_t max_pairs);
+
+/**
+ * Get the allocation size histogram, smallest sizes first. Classes with no
+ * traffic are left out.
+ *
+ * @param out          Array of at least max_buckets elements,
+ *                     CM_SIZE_CLASSES are always enough.
+ * @param max_buckets  How many classes to return at most.
+ *
+ * @return The number of classes written to out.
+ */
+CMAPI size_t CMCALL cm_get_size_histogram(cm_size_bucket* out, size_t max_buckets);
+
+/**
+ * Enter a tag scope on the calling thread: until the matching cm_tag_pop,
+ * every block it allocates is charged to the tag, whatever its call site.
+ * Scopes nest, each one a child of the enclosing one, making a tree: the
+ * same name pushed under two different tags is two different tags. Scopes
+ * deeper than CM_TAG_DEPTH (32) are charged to the one at that depth.
+ *
+ * A block stays charged to its tag when reallocated or freed elsewhere.
+ * Only blocks with a record are charged (CM_LEVEL_RECORDS and up).
+ *
+ * @param name  Name of the tag, copied.
+ *
+ * @retval 0  On failure (invalid name, out of resources or more than 65535
+ *            tags): the enclosing scope goes on, cm_tag_pop is still
+ *            needed.
+ * @retval 1  On success.
+ */
+CMAPI int CMCALL cm_tag_push(const char* name);
+
+/**
+ * Leave the innermost tag scope of the calling thread.
+ */
+CMAPI void CMCALL cm_tag_pop(void);
+
+/**
+ * Get the tag tree in depth-first order, a tag followed by its children
+ * with the most tree_live_bytes first. Lists the top of the tree if there
+ * are more than max_tags tags.
+ *
+ * @param out       Array of at least max_tags elements.
+ * @param max_tags  How many tags to return at most.
+ *
+ * @return The number of tags written to out.
+ */
+CMAPI size_t CMCALL cm_get_tag_tree(cm_tag_stats* out, size_t max_tags);
+
+/**
+ * Start a new epoch. Every block remembers the epoch it was allocated in
+ * (a reallocated block keeps its own), the first epoch after cm_init is 0.
+ *
+ * @return The id of the epoch just started.
+ */
+CMAPI uint32_t CMCALL cm_checkpoint(void);
+
+/**
+ * Get the call sites that allocated the most bytes still live in the epochs
+ * from epoch_a to epoch_b excluded, biggest first. With a = cm_checkpoint()
+ * and later b = cm_checkpoint(), that's what was allocated between the two
+ * checkpoints and has not been freed yet.
+ *
+ * The live blocks are walked in place, one index shard at a time, without
+ * copying them.
+ *
+ * @param epoch_a    First epoch included.
+ * @param epoch_b    First epoch excluded, UINT32_MAX for all the ones after
+ *                   epoch_a.
+ * @param out        Array of at least max_sites elements.
+ * @param max_sites  How many sites to return at most.
+ *
+ * @return The number of sites written to out.
+ */
+CMAPI size_t CMCALL cm_diff(uint32_t epoch_a, uint32_t epoch_b, cm_site_growth* out,
+							size_t max_sites);
+
+/**
+ * Call fn on every live (not deallocated yet) memory block without
+ * allocating anything.
+ *
+ * Without CM_LIVE_SNAPSHOT the blocks are walked in place, one index shard
+ * at a time: the allocations hitting the shard being walked wait for fn.
+ * fn must not allocate, free or reallocate through cmonitor.
+ *
+ * @param fn     Called once per block. The cm_leak_info is only valid during
+ *               the call.
+ * @param ctx    Passed to fn.
+ * @param flags  0 or CM_LIVE_SNAPSHOT.
+ *
+ * @return The number of blocks fn has been called on.
+ */
+CMAPI size_t CMCALL cm_foreach_live(cm_live_fn fn, void* ctx, uint32_t flags);
+
+/**
+ * Fill a caller provided array with the infos of the live (not deallocated
+ * yet) memory blocks, without allocating anything.
+ *
+ * @param out         Array of at least max_blocks elements.
+ * @param max_blocks  How many blocks to write at most.
+ *
+ * @return The number of live blocks, which may be more than max_blocks: only
+ *         the first max_blocks are written to out.
+ */
+CMAPI size_t CMCALL cm_get_live(cm_leak_info* out, size_t max_blocks);
+
 /**
  * Get a cm_leak_info heap-allocated array of size out_leaks_count with all the
  * (yet) non-deallocated memory blocks infos.
@@ -201,6 +989,8 @@ CMAPI void CMCALL cm_get_stats(cm_stats* out);
  *
  * @note Remember to call cm_free_leaks_info in order to properly free the
  *       array.
+ * @note Allocates one cm_leak_info per block, see cm_foreach_live and
+ *       cm_get_live to go through big heaps.
  */
 CMAPI void CMCALL cm_get_leaks(cm_leak_info*** out_array, size_t* out_leaks_count);
 
@@ -270,13 +1060,167 @@ CMAPI void* CMCALL cm_calloc_(size_t num, size_t size, const char* filename, int
  */
 CMAPI void* CMCALL cm_realloc_(void* mem, size_t size, const char* filename, int line);
 
+/**
+ * Same as cm_malloc_ with the call site given by a descriptor.
+ */
+CMAPI void* CMCALL cm_malloc_at_(size_t size, cm_site_desc* site);
+
+/**
+ * Same as cm_free_ with the call site given by a descriptor.
+ */
+CMAPI void CMCALL cm_free_at_(void* mem, cm_site_desc* site);
+
+/**
+ * Same as cm_calloc_ with the call site given by a descriptor.
+ */
+CMAPI void* CMCALL cm_calloc_at_(size_t num, size_t size, cm_site_desc* site);
+
+/**
+ * Same as cm_realloc_ with the call site given by a descriptor.
+ */
+CMAPI void* CMCALL cm_realloc_at_(void* mem, size_t size, cm_site_desc* site);
+
+/**
+ * The malloc of CM_LEVEL_COUNTERS: updates the counters of cm_stats only.
+ * Returns NULL when out of memory, as malloc. cm_malloc calls the inline
+ * cm_malloc_inline_ of counters.h instead, this is the same out of line.
+ */
+CMAPI void* CMCALL cm_malloc_count_(size_t size);
+
+/**
+ * The free of CM_LEVEL_COUNTERS and CM_LEVEL_SITES.
+ */
+CMAPI void CMCALL cm_free_count_(void* mem);
+
+/**
+ * The calloc of CM_LEVEL_COUNTERS.
+ */
+CMAPI void* CMCALL cm_calloc_count_(size_t num, size_t size);
+
+/**
+ * The realloc of CM_LEVEL_COUNTERS.
+ */
+CMAPI void* CMCALL cm_realloc_count_(void* mem, size_t size);
+
+/**
+ * The malloc of CM_LEVEL_SITES: cm_malloc_count_ plus the allocation
+ * counters of the call site, given either by a descriptor or by filename
+ * and line.
+ */
+CMAPI void* CMCALL cm_malloc_site_(size_t size, cm_site_desc* site,
+								   const char* filename, int line);
+
+/**
+ * The calloc of CM_LEVEL_SITES.
+ */
+CMAPI void* CMCALL cm_calloc_site_(size_t num, size_t size, cm_site_desc* site,
+								   const char* filename, int line);
+
+/**
+ * The realloc of CM_LEVEL_SITES.
+ */
+CMAPI void* CMCALL cm_realloc_site_(void* mem, size_t size, cm_site_desc* site,
+									const char* filename, int line);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
 
+#ifdef CM_HAS_SITE_DESC
+
+#ifdef CM_SITE_SECTION
+#  define CM_SITE_DESC_ATTR \
+	__attribute__((section("cm_sites"), used, aligned(sizeof(void*))))
+#else
+#  define CM_SITE_DESC_ATTR
+#endif
+
+/**
+ * A pointer to a static cm_site_desc of the current file and line. Once
+ * bound, the library gets the call site from it without any lookup.
+ *
+ * @note Uses a GNU statement expression: only valid inside a function.
+ */
+#define CM_THIS_SITE \
+	(__extension__ ({ \
+		static cm_site_desc cm_site_desc_ CM_SITE_DESC_ATTR = \
+			{ CM_THIS_FILE, CM_THIS_BASENAME, 0, CM_THIS_LINE, 0 }; \
+		&cm_site_desc_; \
+	}))
+
+/* the call site arguments of the CM_LEVEL_SITES entry points */
+#define CM_SITE_ARGS CM_THIS_SITE, NULL, 0
+
+#endif /* CM_HAS_SITE_DESC */
+
+#if CM_TRACK_LEVEL <= CM_LEVEL_OFF
+
+/*
+ * Functions rather than macros expanding to malloc: with the usual
+ * "#define malloc cm_malloc" the expansion would stop at malloc, leaving a
+ * call to an undefined cm_malloc. They bind to the C allocator here, before
+ * any such define.
+ */
+
+static inline void* cm_malloc_off_(size_t size)
+{
+	return malloc(size);
+}
+
+static inline void cm_free_off_(void* mem)
+{
+	free(mem);
+}
+
+static inline void* cm_calloc_off_(size_t num, size_t size)
+{
+	return calloc(num, size);
+}
+
+static inline void* cm_realloc_off_(void* mem, size_t size)
+{
+	return realloc(mem, size);
+}
+
+#define cm_malloc(size)       cm_malloc_off_ (size)
+#define cm_free(mem)          cm_free_off_   (mem)
+#define cm_calloc(num, size)  cm_calloc_off_ (num, size)
+#define cm_realloc(mem, size) cm_realloc_off_(mem, size)
+
+#elif CM_TRACK_LEVEL == CM_LEVEL_COUNTERS
+
+#include "cmonitor/counters.h"
+
+#define cm_malloc(size)       cm_malloc_inline_ (size)
+#define cm_free(mem)          cm_free_inline_   (mem)
+#define cm_calloc(num, size)  cm_calloc_inline_ (num, size)
+#define cm_realloc(mem, size) cm_realloc_inline_(mem, size)
+
+#elif CM_TRACK_LEVEL == CM_LEVEL_SITES
+
+#ifndef CM_SITE_ARGS
+#  define CM_SITE_ARGS NULL, CM_THIS_FILE, CM_THIS_LINE
+#endif
+
+#define cm_malloc(size)       cm_malloc_site_ (size, CM_SITE_ARGS)
+#define cm_free(mem)          cm_free_count_  (mem)
+#define cm_calloc(num, size)  cm_calloc_site_ (num, size, CM_SITE_ARGS)
+#define cm_realloc(mem, size) cm_realloc_site_(mem, size, CM_SITE_ARGS)
+
+#elif defined(CM_HAS_SITE_DESC)
+
+#define cm_malloc(size)       cm_malloc_at_ (size, CM_THIS_SITE)
+#define cm_free(mem)          cm_free_at_   (mem, CM_THIS_SITE)
+#define cm_calloc(num, size)  cm_calloc_at_ (num, size, CM_THIS_SITE)
+#define cm_realloc(mem, size) cm_realloc_at_(mem, size, CM_THIS_SITE)
+
+#else
+
 #define cm_malloc(size)       cm_malloc_ (size, CM_THIS_FILE, CM_THIS_LINE, 0)
 #define cm_free(mem)          cm_free_   (mem, CM_THIS_FILE, CM_THIS_LINE)
 #define cm_calloc(num, size)  cm_calloc_ (num, size, CM_THIS_FILE, CM_THIS_LINE)
 #define cm_realloc(mem, size) cm_realloc_(mem, size, CM_THIS_FILE, CM_THIS_LINE)
 
+#endif /* CM_TRACK_LEVEL */
+
 #endif /* CM_CM_H */
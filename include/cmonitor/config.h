@@ -63,6 +63,39 @@
 #  define CMAPI
 #endif
 
+/*------------------------------------------------------------------------------
+	Tracking levels
+------------------------------------------------------------------------------*/
+
+/** The cm_* macros call the C functions through inline wrappers: no cost at all. */
+#define CM_LEVEL_OFF      0
+/**
+ * Only the counters of cm_stats and the size histogram. Blocks have no
+ * record: their size is the usable size the C allocator reports.
+ */
+#define CM_LEVEL_COUNTERS 1
+/** Also the allocations of every call site (cm_site_stats::alloc_count). */
+#define CM_LEVEL_SITES    2
+/** A record per block: leaks, live blocks, lifetimes, stacks, ... */
+#define CM_LEVEL_RECORDS  3
+/** Also the event log and the binary traces. */
+#define CM_LEVEL_FULL     4
+
+/*
+ * How much the cm_* macros track, chosen at compile time. Where the macros
+ * are used it picks the entry points they call, so a counters-only build
+ * pays for a few per-thread counters and nothing else. When building the
+ * library it caps what any entry point does and turns the flags above the
+ * level into constants, so their code is left out.
+ *
+ * CM_LEVEL_RECORDS and CM_LEVEL_FULL only differ when building the library.
+ * Below CM_LEVEL_RECORDS blocks must be freed at the level they were
+ * allocated at.
+ */
+#ifndef CM_TRACK_LEVEL
+#  define CM_TRACK_LEVEL CM_LEVEL_FULL
+#endif
+
 /*------------------------------------------------------------------------------
 	Other settings
 ------------------------------------------------------------------------------*/
@@ -75,4 +108,29 @@
 #  define CM_THIS_LINE __LINE__
 #endif
 
+/*
+ * CM_THIS_FILE without its path, 0 to let the library compute it. Define it
+ * too when redefining CM_THIS_FILE.
+ */
+#ifndef CM_THIS_BASENAME
+#  ifdef __FILE_NAME__
+#    define CM_THIS_BASENAME __FILE_NAME__
+#  else
+#    define CM_THIS_BASENAME 0
+#  endif
+#endif
+
+/*
+ * Define CM_NO_SITE_DESC to make the cm_* macros pass the file and line of
+ * the call instead of a static call site descriptor (see CM_THIS_SITE).
+ */
+#if !defined(CM_NO_SITE_DESC) && !defined(CM_HAS_SITE_DESC) && defined(__GNUC__)
+#  define CM_HAS_SITE_DESC
+#endif
+
+/* enumerate the descriptors through the cm_sites linker section */
+#if defined(CM_HAS_SITE_DESC) && defined(__ELF__) && !defined(CM_SITE_SECTION)
+#  define CM_SITE_SECTION
+#endif
+
 #endif /* CM_CONFIG_H */
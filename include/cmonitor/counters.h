@@ -0,0 +1,291 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CM_COUNTERS_H
+#define CM_COUNTERS_H
+
+/**
+ * @file
+ *
+ * The cm_* functions of CM_LEVEL_COUNTERS, inline: cm.h includes this file
+ * at that level, and the library builds cm_malloc_count_ and friends on the
+ * same functions.
+ *
+ * The library keeps the counters of each thread in a cm_thread_counters
+ * that only the thread writes. Every translation unit caches a pointer to
+ * it per thread, good until cm_generation_ changes (cm_init frees the old
+ * counters), so counting a block is a few plain stores, plus the usable
+ * size of the block: it has no record.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#  include <malloc.h>
+#elif defined(__APPLE__)
+#  include <malloc/malloc.h>
+#elif defined(__linux__)
+#  include <malloc.h>
+#endif /* _WIN32 */
+
+#include "cmonitor/cm.h"
+
+/*------------------------------------------------------------------------------
+	Settings
+------------------------------------------------------------------------------*/
+
+/**
+ * Live bytes a thread counts before adding them to cm_stats::live_bytes,
+ * either way.
+ */
+#ifndef CM_PEAK_SLACK
+#  define CM_PEAK_SLACK (64 * 1024)
+#endif
+
+/** Classes per power of two of the size histogram, 1 << CM_SIZE_CLASS_BITS. */
+#define CM_SIZE_CLASS_BITS 2
+#define CM_SIZE_CLASS_SUB  (1 << CM_SIZE_CLASS_BITS)
+
+#if defined(_MSC_VER)
+#  define CM_THREAD_LOCAL_ __declspec(thread)
+#else
+#  define CM_THREAD_LOCAL_ __thread
+#endif /* _MSC_VER */
+
+/*------------------------------------------------------------------------------
+	Structs
+------------------------------------------------------------------------------*/
+
+/**
+ * The counters of a thread, summed up by cm_get_stats and
+ * cm_get_size_histogram.
+ *
+ * @warning Internal.
+ */
+typedef struct cm_thread_counters {
+	cm_stats stats;
+	volatile uint32_t allocs[CM_SIZE_CLASSES];   /* by size class */
+	volatile uint32_t frees[CM_SIZE_CLASSES];
+	volatile uint32_t reallocs[CM_SIZE_CLASSES]; /* of the size difference */
+	int32_t live_pending; /* live bytes not added to cm_stats::live_bytes yet */
+} cm_thread_counters;
+
+/*------------------------------------------------------------------------------
+	Functions
+------------------------------------------------------------------------------*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/**
+ * Bumped by every cm_init.
+ *
+ * @warning Internal.
+ */
+CMAPI extern volatile uint32_t cm_generation_;
+
+/**
+ * Get the counters of the calling thread.
+ *
+ * @warning Internal.
+ *
+ * @return The counters, NULL if the library doesn't count
+ *         (built with CM_LEVEL_OFF).
+ */
+CMAPI cm_thread_counters* CMCALL cm_thread_counters_(void);
+
+/**
+ * Add the live_pending bytes of the calling thread to the live bytes and
+ * raise the peak.
+ *
+ * @warning Internal.
+ */
+CMAPI void CMCALL cm_flush_live_(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+/* this thread's counters, as of cm_counters_generation_ */
+static CM_THREAD_LOCAL_ cm_thread_counters* cm_counters_;
+static CM_THREAD_LOCAL_ uint32_t cm_counters_generation_;
+
+static inline cm_thread_counters* cm_counters_get_(void)
+{
+	uint32_t generation = cm_generation_;
+
+	if (cm_counters_generation_ != generation) {
+		cm_counters_ = cm_thread_counters_();
+		cm_counters_generation_ = generation;
+	}
+	return cm_counters_;
+}
+
+/* Add to a counter only the calling thread writes, its readers never see it torn. */
+static inline void cm_counters_add_(volatile uint32_t* p, uint32_t v)
+{
+#if defined(__GNUC__)
+	__atomic_store_n(p, __atomic_load_n(p, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+#else
+	*p += v;
+#endif /* __GNUC__ */
+}
+
+static inline void cm_counters_live_(cm_thread_counters* c, uint32_t delta)
+{
+	c->live_pending += (int32_t)delta;
+	if (c->live_pending > CM_PEAK_SLACK || c->live_pending < -CM_PEAK_SLACK)
+		cm_flush_live_();
+}
+
+/* Bytes usable in a block of the C allocator, 0 if there is no way to know. */
+static inline size_t cm_usable_size_(void* mem)
+{
+#if defined(_WIN32)
+	return _msize(mem);
+#elif defined(__APPLE__)
+	return malloc_size(mem);
+#elif defined(__linux__)
+	return malloc_usable_size(mem);
+#else
+	(void)mem;
+	return 0;
+#endif /* _WIN32 */
+}
+
+/*
+ * Class of size in the size histogram: every power of two is split into
+ * CM_SIZE_CLASS_SUB classes of equal width.
+ */
+static inline size_t cm_size_class_(size_t size)
+{
+	unsigned e;
+
+	if (size < CM_SIZE_CLASS_SUB)
+		return size;
+#if defined(__GNUC__)
+	e = (unsigned)(sizeof(unsigned long long) * 8 - 1)
+		- (unsigned)__builtin_clzll((unsigned long long)size);
+#else
+	{
+		size_t s = size;
+
+		for (e = 0; s >>= 1; ++e)
+			;
+	}
+#endif /* __GNUC__ */
+	return (size_t)(e - CM_SIZE_CLASS_BITS + 1) * CM_SIZE_CLASS_SUB
+		+ ((size >> (e - CM_SIZE_CLASS_BITS)) & (CM_SIZE_CLASS_SUB - 1));
+}
+
+/* A new block of size bytes. */
+static inline void cm_counters_block_(cm_thread_counters* c, size_t size)
+{
+	cm_counters_add_(&c->stats.total_allocated, (uint32_t)size);
+	cm_counters_live_(c, (uint32_t)size);
+	cm_counters_add_(&c->stats.live_blocks, 1);
+	cm_counters_add_(&c->allocs[cm_size_class_(size)], 1);
+}
+
+/*
+ * Without a record the size of a block is the one the C allocator reports,
+ * so the byte counters include its rounding. They stay balanced as long as
+ * a block is freed at the level it was allocated at. As malloc, these
+ * return NULL when out of memory.
+ */
+
+static inline void* cm_malloc_inline_(size_t size)
+{
+	cm_thread_counters* c;
+	void* mem = malloc(size);
+
+	if (!mem || !(c = cm_counters_get_()))
+		return mem;
+	cm_counters_block_(c, cm_usable_size_(mem));
+	cm_counters_add_(&c->stats.malloc_count, 1);
+	return mem;
+}
+
+static inline void cm_free_inline_(void* mem)
+{
+	cm_thread_counters* c = cm_counters_get_();
+	size_t size;
+
+	if (c) {
+		cm_counters_add_(&c->stats.free_count, 1);
+		if (mem) {
+			size = cm_usable_size_(mem);
+			cm_counters_add_(&c->stats.total_freed, (uint32_t)size);
+			cm_counters_live_(c, (uint32_t)0 - (uint32_t)size);
+			cm_counters_add_(&c->stats.live_blocks, (uint32_t)0 - 1);
+			cm_counters_add_(&c->frees[cm_size_class_(size)], 1);
+		}
+	}
+	free(mem);
+}
+
+static inline void* cm_calloc_inline_(size_t num, size_t size)
+{
+	cm_thread_counters* c;
+	void* mem = calloc(num, size);
+
+	if (!mem || !(c = cm_counters_get_()))
+		return mem;
+	cm_counters_block_(c, cm_usable_size_(mem));
+	cm_counters_add_(&c->stats.calloc_count, 1);
+	return mem;
+}
+
+static inline void* cm_realloc_inline_(void* mem, size_t size)
+{
+	cm_thread_counters* c;
+	void* new_mem;
+	size_t old_size;
+
+	if (!mem)
+		return cm_malloc_inline_(size);
+	c = cm_counters_get_();
+	if (!c)
+		return realloc(mem, size);
+	old_size = cm_usable_size_(mem);
+	new_mem = realloc(mem, size);
+	/* size zero may have freed the block */
+	if (!new_mem && size != 0)
+		return NULL;
+	size = new_mem ? cm_usable_size_(new_mem) : 0;
+	cm_counters_add_(&c->stats.total_freed, (uint32_t)old_size);
+	cm_counters_add_(&c->stats.total_allocated, (uint32_t)size);
+	cm_counters_live_(c, (uint32_t)size - (uint32_t)old_size);
+	cm_counters_add_(&c->stats.realloc_count, 1);
+	if (!new_mem)
+		cm_counters_add_(&c->stats.live_blocks, (uint32_t)0 - 1);
+	size = size > old_size ? size - old_size : old_size - size;
+	cm_counters_add_(&c->reallocs[cm_size_class_(size)], 1);
+	return new_mem;
+}
+
+#endif /* CM_COUNTERS_H */
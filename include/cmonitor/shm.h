@@ -0,0 +1,124 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CM_SHM_H
+#define CM_SHM_H
+
+/**
+ * @file
+ *
+ * Layout of the live stats segment, see cm_shm_publish.
+ *
+ * The segment is a single cm_shm_segment in a named shared memory object:
+ * "/cmonitor.<pid>" by default on POSIX systems (shm_open),
+ * "Local\cmonitor.<pid>" on Windows (a named file mapping). The monitored
+ * process is the only writer; any number of readers may map it read-only.
+ *
+ * Updates follow a seqlock: the writer makes seq odd, writes the fields and
+ * makes seq even again, never waiting for the readers. A reader copies the
+ * segment out and keeps the copy only if seq was even and unchanged from
+ * before to after the copy, retrying otherwise:
+ *
+ *     do {
+ *         while ((s1 = seq) & 1)
+ *             ;
+ *         <acquire barrier>
+ *         copy = *segment;
+ *         <acquire barrier>
+ *         s2 = seq;
+ *     } while (s1 != s2);
+ *
+ * The header fields before seq are written once, before the segment is
+ * made visible, and never change.
+ *
+ * All the fields are in the byte order of the machine of the writer.
+ */
+
+#include <stdint.h>
+
+#define CM_SHM_MAGIC     "CMSHM"
+#define CM_SHM_VERSION   1
+
+/** Sites of cm_shm_segment::sites, the ones with the most live bytes. */
+#define CM_SHM_TOP_SITES 16
+
+/** Entries of cm_shm_segment::classes, as many as CM_SIZE_CLASSES. */
+#define CM_SHM_CLASSES   252
+
+typedef struct cm_shm_site {
+	char file[60];          /**< File name without its path, NUL terminated. */
+	uint32_t line;
+	uint32_t live_bytes;    /**< See cm_site_stats. */
+	uint32_t live_count;
+	uint32_t alloc_count;
+	uint32_t alloc_bytes;
+	uint32_t free_count;
+	uint32_t peak_bytes;
+} cm_shm_site;
+
+typedef struct cm_shm_class {
+	uint64_t min_size;      /**< See cm_size_bucket. */
+	uint64_t max_size;
+	uint32_t allocs;
+	uint32_t frees;
+	uint32_t reallocs;
+	uint32_t reserved;
+} cm_shm_class;
+
+typedef struct cm_shm_segment {
+	char magic[8];          /**< CM_SHM_MAGIC, NUL terminated. */
+	uint32_t version;       /**< CM_SHM_VERSION. */
+	uint32_t size;          /**< sizeof(cm_shm_segment) of the writer. */
+	uint32_t pid;           /**< Process id of the writer. */
+
+	volatile uint32_t seq;  /**< Odd while an update is being written. */
+	uint64_t updates;       /**< Updates written so far. */
+	uint64_t time_ns;       /**< Nanoseconds since cm_init at the update. */
+	uint64_t rss_bytes;     /**< Resident memory of the process, 0 if
+	                             unknown. */
+	uint32_t interval_ms;   /**< Time between two updates. */
+
+	/** The cm_stats at the update, see there. */
+	uint32_t total_allocated;
+	uint32_t total_freed;
+	uint32_t malloc_count;
+	uint32_t free_count;
+	uint32_t calloc_count;
+	uint32_t realloc_count;
+	uint32_t overhead_bytes;
+	uint32_t dropped_events;
+	uint32_t live_bytes;
+	uint32_t live_blocks;
+	uint32_t peak_bytes;
+	uint32_t epoch;         /**< Current cm_checkpoint epoch. */
+
+	uint32_t site_count;    /**< Valid entries of sites. */
+	uint32_t class_count;   /**< Valid entries of classes. */
+	uint32_t reserved;
+	cm_shm_site sites[CM_SHM_TOP_SITES];   /**< Most live bytes first. */
+	cm_shm_class classes[CM_SHM_CLASSES];  /**< Size classes with traffic,
+	                                            smallest first. */
+} cm_shm_segment;
+
+#endif /* CM_SHM_H */
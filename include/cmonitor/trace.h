@@ -0,0 +1,103 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef CM_TRACE_H
+#define CM_TRACE_H
+
+/**
+ * @file
+ *
+ * Binary trace file format, see cm_trace_open.
+ *
+ * The file is made of a cm_trace_header, a table of site_capacity
+ * cm_trace_site entries and chunk_count chunks of chunk_size bytes used as
+ * a ring: when the last chunk is full the writer starts over from the
+ * first, overwriting the oldest events. Every chunk starts with a
+ * cm_trace_chunk followed by 'used' bytes of encoded events. Chunks with
+ * seq == 0 have never been written; the others are read in seq order.
+ *
+ * All the fixed-size fields are in the byte order of the machine that wrote
+ * the trace.
+ *
+ * Events are encoded as:
+ *
+ * - 1 byte, the event type (CM_TRACE_EV_*);
+ * - zigzag varint, nanoseconds since the previous event of the chunk (since
+ *   cm_trace_chunk::base_time for the first one). Events of different
+ *   threads may be stored slightly out of order, so it can be negative;
+ * - zigzag varint, address minus the previous event's address (minus
+ *   cm_trace_chunk::base_address for the first one);
+ * - varint, size in bytes (allocated, freed or the new size for realloc);
+ * - for CM_TRACE_EV_CALLOC: varint num, varint size of each element;
+ * - for CM_TRACE_EV_REALLOC: varint old size, zigzag varint old address
+ *   minus the new address;
+ * - varint, site id (1-based index in the site table, 0 if unknown).
+ *
+ * A varint is an unsigned integer stored 7 bits per byte, least significant
+ * first, with the high bit set on every byte but the last. Zigzag maps
+ * signed to unsigned as (n << 1) ^ (n >> 63).
+ */
+
+#include <stdint.h>
+
+#define CM_TRACE_MAGIC   "CMTRACE"
+#define CM_TRACE_VERSION 1
+
+#define CM_TRACE_EV_MALLOC         1
+#define CM_TRACE_EV_REALLOC_MALLOC 2 /**< realloc called with a NULL pointer */
+#define CM_TRACE_EV_FREE           3
+#define CM_TRACE_EV_CALLOC         4
+#define CM_TRACE_EV_REALLOC        5
+
+/** Longest possible encoded event. */
+#define CM_TRACE_EV_MAX_BYTES (1 + 8 * 10)
+
+typedef struct cm_trace_header {
+	char magic[8];          /**< CM_TRACE_MAGIC, NUL terminated. */
+	uint32_t version;       /**< CM_TRACE_VERSION. */
+	uint32_t chunk_size;    /**< Bytes per chunk, header included. */
+	uint32_t chunk_count;   /**< Chunks in the ring. */
+	uint32_t site_capacity; /**< Entries in the site table. */
+	uint32_t site_count;    /**< Highest site id in use. Entries of sites
+	                             never traced have an empty file name. */
+	uint32_t reserved;
+	uint64_t sites_offset;  /**< File offset of the site table. */
+	uint64_t chunks_offset; /**< File offset of the first chunk. */
+	uint64_t next_seq;      /**< Sequence number of the next chunk. */
+} cm_trace_header;
+
+typedef struct cm_trace_site {
+	uint32_t line;
+	char file[60];          /**< File name without its path, NUL terminated. */
+} cm_trace_site;
+
+typedef struct cm_trace_chunk {
+	uint64_t seq;           /**< 1 for the first chunk written, 0 if unused. */
+	uint64_t base_time;     /**< Monotonic clock, nanoseconds. */
+	uint64_t base_address;
+	uint32_t used;          /**< Bytes of events after this header. */
+	uint32_t events;        /**< Number of events in the chunk. */
+} cm_trace_chunk;
+
+#endif /* CM_TRACE_H */
@@ -27,240 +27,2938 @@
 #  define _CRT_SECURE_NO_WARNINGS
 #endif
 
+/* POSIX and GNU extensions (posix_memalign, ...) */
+#if !defined(_WIN32) && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+
 #include "cmonitor/cm.h"
+#include "cmonitor/counters.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "cm_platform.h"
+#include "cm_site.h"
+#include "cm_tag.h"
+#include "cm_index.h"
+#include "cm_slab.h"
+#include "cm_sample.h"
+#include "cm_stack.h"
+#include "cm_histogram.h"
+#include "cm_ring.h"
+#include "cm_timeline.h"
+#include "cm_rss.h"
+#include "cm_shm.h"
+#include "cm_log.h"
+#include "cm_trace.h"
+
+/* default mean bytes between two samples with CM_TRACK_SAMPLED */
+#ifndef CM_SAMPLE_INTERVAL
+#  define CM_SAMPLE_INTERVAL (512 * 1024)
+#endif
+
+/* default frames captured with CM_TRACK_STACKS */
+#ifndef CM_STACK_DEPTH
+#  define CM_STACK_DEPTH 16
+#endif
+
+/* longest sleep of the timeline sampler between two checks for a stop */
+#ifndef CM_TIMELINE_NAP_MS
+#  define CM_TIMELINE_NAP_MS 10
+#endif
+
+/* short lived sites listed by cm_print_stats */
+#ifndef CM_PRINT_LIFETIME_SITES
+#  define CM_PRINT_LIFETIME_SITES 10
+#endif
+
+/* realloc churn sites listed by cm_print_stats */
+#ifndef CM_PRINT_REALLOC_SITES
+#  define CM_PRINT_REALLOC_SITES 10
+#endif
+
+/* cross-thread free sites listed by cm_print_stats */
+#ifndef CM_PRINT_REMOTE_SITES
+#  define CM_PRINT_REMOTE_SITES 10
+#endif
+
+/* tags listed by cm_print_stats */
+#ifndef CM_PRINT_TAGS
+#  define CM_PRINT_TAGS 20
+#endif
+
+/* nested cm_tag_push scopes told apart */
+#ifndef CM_TAG_DEPTH
+#  define CM_TAG_DEPTH 32
+#endif
+
+/* time spent calibrating CM_CLOCK_TSC */
+#ifndef CM_CLOCK_CALIBRATION_NS
+#  define CM_CLOCK_CALIBRATION_NS 2000000
+#endif
+
+/* number of index shards with CM_TRACK_THREAD_SAFE, a power of two */
+#ifndef CM_INDEX_SHARDS
+#  define CM_INDEX_SHARDS 64
+#endif
+
+/* A slice of the live blocks index with its own lock. */
+/*
+ * With CM_TRACK_INLINE_HEADER the record sits in a header in front of the
+ * block, linked into the list of its shard instead of the index: free
+ * reaches it from the block and unlinks it without probing.
+ */
+typedef struct cm_block_header {
+	cm_alloc_map rec;
+	struct cm_block_header* prev; /* in the list of its shard */
+	struct cm_block_header* next;
+	uintptr_t cookie;
+} cm_block_header;
+
+typedef struct cm_shard {
+	cm_mutex lock;
+	cm_index index;
+	cm_block_header* headers; /* records in inline headers, not in index */
+	size_t header_count;
+	volatile uint32_t live;  /* records of the shard, readable without the lock */
+	char pad[CM_CACHE_LINE]; /* keep the neighbouring locks apart */
+} cm_shard;
+
+/* Per-thread stats, summed up by cm_get_stats. */
+typedef struct cm_thread_info {
+	cm_thread_counters counters; /* only written by the owning thread */
+	int in_use;              /* 0 once the thread exited, can be reused */
+	cm_log_ring* log_ring;   /* ring being filled by the thread */
+	void* volatile log_drain; /* oldest ring, owned by the log writer */
+	uint32_t id;             /* cm_thread_id, kept by the threads reusing the slot */
+	/*
+	 * By thread slot of the allocating thread, only written by the owning
+	 * thread as well: the live bytes of a thread are its owned_bytes minus
+	 * what every thread released of them.
+	 */
+	volatile uint32_t owned_bytes;               /* weight of the records stamped */
+	volatile uint32_t released[CM_THREAD_SLOTS]; /* weight taken off records */
+	volatile uint32_t frees_of[CM_THREAD_SLOTS]; /* records freed */
+	struct cm_thread_info* next;
+	char pad[CM_CACHE_LINE]; /* allocated cache-line aligned, no false sharing */
+} cm_thread_info;
+
+static struct {
+	int initialized;
+	uint32_t flags;
+	FILE* output;
+	cm_error_fn on_error;
+
+	cm_shard shards[CM_INDEX_SHARDS];
+	uint32_t shard_mask;      /* 0 (single shard) unless thread safe */
+	cm_slab records;          /* cm_alloc_map nodes */
+
+	cm_mutex sites_lock;
+	cm_site_table sites;
+
+	cm_mutex tags_lock;
+	cm_tag_table tags;
+
+	volatile uint32_t sample_interval; /* CM_TRACK_SAMPLED */
+	volatile uint32_t* sample_filter;  /* live records per filter slot */
+
+	volatile uint32_t epoch;           /* bumped by cm_checkpoint */
+
+	int clock;                         /* CM_CLOCK_*, see CM_TRACK_LIFETIMES */
+	uint64_t clock_mult;               /* ns per tick, 32.32 fixed point */
+
+	volatile uint32_t live_bytes;      /* published by the threads, see CM_PEAK_SLACK */
+	volatile uint32_t peak_bytes;
+
+	cm_mutex stacks_lock;              /* CM_TRACK_STACKS */
+	cm_stack_table stacks;
+	volatile uint32_t stack_depth;
+
+	cm_mutex threads_lock;
+	cm_thread_info* threads;
+	size_t thread_count;
+	cm_tls_key thread_key;    /* only used to get notified on thread exit */
+
+	cm_thread log_writer;     /* CM_LOG_ASYNC */
+	volatile uint32_t log_stop;
+	int log_running;          /* the writer was started */
+	volatile uint32_t log_passes; /* completed drains of all the rings */
+
+	cm_mutex trace_lock;
+	cm_trace trace;
+	volatile uint32_t trace_open;
+
+	cm_mutex timeline_lock;
+	cm_ring timeline;         /* of cm_timeline_sample */
+	cm_thread timeline_thread;
+	int timeline_running;
+	uint32_t timeline_interval; /* ms */
+	volatile uint32_t timeline_stop;
+
+	cm_mutex rss_lock;
+	cm_ring rss;              /* of cm_rss_sample */
+	cm_thread rss_thread;
+	int rss_running;          /* the sampler thread */
+	volatile uint32_t rss_recording;
+	uint32_t rss_interval;    /* ms */
+	volatile uint32_t rss_stop;
+	uint64_t start_ns;        /* cm_init */
+
+	cm_shm_map shm;           /* cm_shm_publish, seg NULL if none */
+	cm_shm_segment shm_next;  /* the next update, built by shm_thread */
+	cm_thread shm_thread;
+	uint32_t shm_interval;    /* ms */
+	volatile uint32_t shm_stop;
+
+	int free_unknown;         /* free() blocks without a record (cm_preload.c) */
+	int fail_null;            /* out of memory returns NULL (cm_preload.c) */
+} settings;
+
+/* this thread's spare cm_alloc_map nodes */
+static CM_TLS cm_slab_magazine records_magazine;
+
+volatile uint32_t cm_generation_;
+
+static CM_TLS cm_thread_info* this_thread;
+static CM_TLS uint32_t this_thread_generation;
+static CM_TLS cm_sampler sampler;
+
+/* direct mapped, a power of two */
+#ifndef CM_SITE_CACHE_SIZE
+#  define CM_SITE_CACHE_SIZE 256
+#endif
+
+typedef struct cm_site_cache_entry {
+	const char* filename;
+	int line;
+	cm_site* site;
+} cm_site_cache_entry;
+
+/* sites recently used by this thread, keyed by the filename pointer */
+static CM_TLS cm_site_cache_entry site_cache[CM_SITE_CACHE_SIZE];
+
+/* direct mapped, a power of two */
+#ifndef CM_TAG_CACHE_SIZE
+#  define CM_TAG_CACHE_SIZE 64
+#endif
+
+typedef struct cm_tag_cache_entry {
+	const char* name;
+	uint32_t parent;
+	cm_tag* tag;
+} cm_tag_cache_entry;
+
+/* tags recently pushed by this thread, keyed by the name pointer */
+static CM_TLS cm_tag_cache_entry tag_cache[CM_TAG_CACHE_SIZE];
+
+/* this thread's cm_tag_push scopes, tag_depth can exceed CM_TAG_DEPTH */
+static CM_TLS uint16_t tag_stack[CM_TAG_DEPTH];
+static CM_TLS uint32_t tag_depth;
+
+/* direct mapped, a power of two */
+#ifndef CM_STACK_CACHE_SIZE
+#  define CM_STACK_CACHE_SIZE 256
+#endif
+
+/* stacks recently captured by this thread, keyed by their hash */
+static CM_TLS cm_stack* stack_cache[CM_STACK_CACHE_SIZE];
+
+/* bounds of this thread's stack, NULL if unknown */
+static CM_TLS char* stack_lo;
+static CM_TLS char* stack_hi;
+
+static void invoke_on_error(int err, const char* format, ...)
+{
+	if (!settings.on_error)
+		return;
+
+	char buffer[128];
+	va_list vl;
+
+	va_start(vl, format);
+	vsprintf(buffer, format, vl);
+	va_end(vl);
+
+	settings.on_error(err, buffer);
+}
+
+static void invoke_on_error_at(int err, const char* filename, int line,
+							   const char* format, ...)
+{
+	if (!settings.on_error)
+		return;
+
+	char buffer[128];
+	int len;
+	va_list vl;
+
+	len = snprintf(buffer, sizeof(buffer), "[%s:%d] ", cm_basename(filename), line);
+	if (len < 0 || (size_t)len >= sizeof(buffer))
+		len = 0;
+	va_start(vl, format);
+	vsnprintf(buffer + len, sizeof(buffer) - len, format, vl);
+	va_end(vl);
+
+	settings.on_error(err, buffer);
+}
+
+/* expects 'filename' and 'line' in scope */
+#define notify(err, ...) \
+	invoke_on_error_at(err, filename, line, __VA_ARGS__)
+
+/* whether this build tracks at level, see CM_TRACK_LEVEL */
+#define tracks(level) (CM_TRACK_LEVEL >= (level))
+
+/* flags that do something in this build, the others are always clear */
+#if CM_TRACK_LEVEL >= CM_LEVEL_FULL
+#  define CM_BUILT_FLAGS 0xffffffffu
+#else
+#  define CM_BUILT_FLAGS (~(uint32_t)(CM_LOG_ASYNC | CM_LOG_FULL_DROP | CM_LOG_FULL_GROW))
+#endif
+
+static int is_flag_set(uint32_t flag)
+{
+	return settings.flags & flag & CM_BUILT_FLAGS;
+}
+
+/*------------------------------------------------------------------------------
+	Threads and index shards
+------------------------------------------------------------------------------*/
+
+/* Add this thread's pending live bytes to the global ones, raise the peak. */
+static void flush_live(cm_thread_info* t)
+{
+	uint32_t live, peak;
+
+	live = cm_atomic_add_u32(&settings.live_bytes, (uint32_t)t->counters.live_pending);
+	t->counters.live_pending = 0;
+	/* the sampled estimates can take it below zero for a while */
+	if ((int32_t)live < 0)
+		return;
+	peak = cm_atomic_load_u32(&settings.peak_bytes);
+	while (live > peak && !cm_atomic_cas_u32(&settings.peak_bytes, peak, live))
+		peak = cm_atomic_load_u32(&settings.peak_bytes);
+}
+
+static void on_thread_exit(void* value)
+{
+	cm_thread_info* t = value;
+
+	cm_slab_flush(&settings.records, &records_magazine);
+	flush_live(t);
+	cm_mutex_lock(&settings.threads_lock);
+	t->in_use = 0;
+	cm_mutex_unlock(&settings.threads_lock);
+	this_thread = NULL;
+}
+
+static cm_thread_info* register_thread(void)
+{
+	cm_thread_info* t;
+
+	cm_mutex_lock(&settings.threads_lock);
+	/* counters are cumulative, an exited thread's slot can keep counting */
+	for (t = settings.threads; t; t = t->next) {
+		if (!t->in_use)
+			break;
+	}
+	if (!t) {
+		t = cm_aligned_malloc(CM_CACHE_LINE, sizeof(cm_thread_info));
+		if (!t) {
+			cm_mutex_unlock(&settings.threads_lock);
+			invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+		memset(t, 0, sizeof(cm_thread_info));
+		t->next = settings.threads;
+		settings.threads = t;
+		t->id = (uint32_t)++settings.thread_count;
+	}
+	t->in_use = 1;
+	cm_mutex_unlock(&settings.threads_lock);
+	/* the sites and tags cached belong to a previous cm_init */
+	memset(site_cache, 0, sizeof(site_cache));
+	memset(tag_cache, 0, sizeof(tag_cache));
+	tag_depth = 0;
+	memset(stack_cache, 0, sizeof(stack_cache));
+	/* can be slow (the main thread's stack is looked up in /proc) */
+	if (is_flag_set(CM_TRACK_STACKS) && !stack_lo)
+		cm_thread_stack_bounds(&stack_lo, &stack_hi);
+	cm_sampler_init(&sampler, cm_now_ns() ^ ((uint64_t)(uintptr_t)&sampler << 16),
+					cm_atomic_load_u32(&settings.sample_interval));
+	cm_tls_key_set(settings.thread_key, t);
+	this_thread = t;
+	this_thread_generation = cm_generation_;
+	return t;
+}
+
+static cm_thread_info* current_thread(void)
+{
+	if (this_thread && this_thread_generation == cm_generation_)
+		return this_thread;
+	return register_thread();
+}
+
+/*
+ * Get the site of (filename, line). Call current_thread() first, it resets
+ * the cache after a cm_init.
+ */
+static cm_site* site_of(const char* filename, int line)
+{
+	cm_site_cache_entry* e;
+	cm_site* site;
+
+	e = &site_cache[(((uintptr_t)filename >> 4) ^ (uintptr_t)line * 0x9e3779b1u)
+					& (CM_SITE_CACHE_SIZE - 1)];
+	if (e->filename == filename && e->line == line)
+		return e->site;
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_lock(&settings.sites_lock);
+	site = cm_site_intern(&settings.sites, filename, NULL, line);
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_unlock(&settings.sites_lock);
+	if (!site) {
+		invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	e->filename = filename;
+	e->line = line;
+	e->site = site;
+	return site;
+}
+
+/*
+ * Point a call site descriptor to its site. The site is published after the
+ * generation so a reader seeing the current generation sees the site too.
+ */
+static cm_site* bind_site_desc(cm_site_desc* desc)
+{
+	cm_site* site;
+
+	site = cm_site_intern(&settings.sites, desc->filename, desc->basename, desc->line);
+	if (!site) {
+		invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	desc->site = site;
+	cm_atomic_store_release_u32(&desc->generation, cm_generation_);
+	return site;
+}
+
+/* Get the site of a descriptor emitted by the cm_* macros. */
+static cm_site* site_of_desc(cm_site_desc* desc)
+{
+	cm_site* site;
+
+	if (cm_atomic_load_acquire_u32(&desc->generation) == cm_generation_)
+		return desc->site;
+	/* not in the cm_sites section (another module) or first use */
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_lock(&settings.sites_lock);
+	if (desc->generation == cm_generation_)
+		site = desc->site;
+	else
+		site = bind_site_desc(desc);
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_unlock(&settings.sites_lock);
+	return site;
+}
+
+#ifdef CM_SITE_SECTION
+/* bounds of the section, set by the linker if at least one site is in it */
+extern cm_site_desc __start_cm_sites[] __attribute__((weak, visibility("hidden")));
+extern cm_site_desc __stop_cm_sites[] __attribute__((weak, visibility("hidden")));
+#endif
+
+/* Intern every site of the cm_sites section so none is bound at runtime. */
+static void bind_static_sites(void)
+{
+#ifdef CM_SITE_SECTION
+	cm_site_desc* desc;
+
+	if (!__start_cm_sites || !__stop_cm_sites)
+		return;
+	for (desc = __start_cm_sites; desc < __stop_cm_sites; ++desc)
+		bind_site_desc(desc);
+#endif
+}
+
+/*
+ * Capture the call stack of the user's call into cmonitor (frame is the
+ * CM_FRAME_ADDRESS of the entry point) and return its id, 0 if none.
+ */
+static uint32_t capture_stack(void* frame)
+{
+	void* frames[CM_STACK_MAX_DEPTH];
+	cm_stack** e;
+	cm_stack* stack;
+	uint64_t hash;
+	int depth;
+
+	if (!is_flag_set(CM_TRACK_STACKS))
+		return 0;
+	depth = cm_stack_capture(frame, stack_lo, stack_hi, frames,
+							 (int)cm_atomic_load_u32(&settings.stack_depth));
+	if (depth == 0)
+		return 0;
+	hash = cm_stack_hash(frames, depth);
+	e = &stack_cache[(size_t)hash & (CM_STACK_CACHE_SIZE - 1)];
+	if (*e && (*e)->hash == hash && cm_stack_equals(*e, frames, depth))
+		return (*e)->id;
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_lock(&settings.stacks_lock);
+	stack = cm_stack_intern(&settings.stacks, frames, depth, hash);
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_unlock(&settings.stacks_lock);
+	if (!stack) {
+		invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	*e = stack;
+	return stack->id;
+}
+
+/* Bump one of this thread's counters. */
+#define count(t, field, value) \
+	cm_counter_add_u32(&(t)->counters.stats.field, (uint32_t)(value))
+
+static void count_live(cm_thread_info* t, uint32_t delta)
+{
+	cm_counters_live_(&t->counters, delta);
+}
+
+static void count_allocated(cm_thread_info* t, size_t bytes)
+{
+	count(t, total_allocated, bytes);
+	count_live(t, (uint32_t)bytes);
+}
+
+static void count_freed(cm_thread_info* t, size_t bytes)
+{
+	count(t, total_freed, bytes);
+	count_live(t, (uint32_t)0 - (uint32_t)bytes);
+}
+
+/* Bump the class of size in one of this thread's size histograms. */
+#define count_size(t, hist, size, value) \
+	cm_counter_add_u32(&(t)->counters.hist[cm_size_class_(size)], (uint32_t)(value))
+
+/*
+ * Decide whether an allocation of size bytes gets a record. Always true
+ * unless sampling, weight is set to the bytes the record stands for.
+ */
+static int sample(size_t size, size_t* weight)
+{
+	size_t interval;
+
+	*weight = size;
+	if (!is_flag_set(CM_TRACK_SAMPLED))
+		return 1;
+	interval = cm_atomic_load_u32(&settings.sample_interval);
+	if (!cm_sampler_take(&sampler, size, interval))
+		return 0;
+	*weight = cm_sample_weight(size, interval);
+	return 1;
+}
+
+/* Estimated number of blocks a record stands for. */
+static uint32_t record_blocks(const cm_alloc_map* node)
+{
+	if (node->size == 0 || node->weight <= node->size)
+		return 1;
+	return (uint32_t)((double)node->weight / (double)node->size + 0.5);
+}
+
+/* Measure the tick of the lifetime clock against the monotonic clock. */
+static void calibrate_clock(void)
+{
+	uint64_t ns0, ns1, t0, t1;
+
+	settings.clock_mult = (uint64_t)1 << 32;
+#if defined(CM_HAS_TSC)
+	if (settings.clock != CM_CLOCK_TSC)
+		return;
+	ns0 = cm_now_ns();
+	t0 = cm_tsc();
+	do {
+		ns1 = cm_now_ns();
+		t1 = cm_tsc();
+	} while (ns1 - ns0 < CM_CLOCK_CALIBRATION_NS);
+	if (t1 > t0)
+		settings.clock_mult = ((ns1 - ns0) << 32) / (t1 - t0);
+#else
+	(void)ns0; (void)ns1; (void)t0; (void)t1;
+#endif /* CM_HAS_TSC */
+}
+
+static uint64_t clock_ticks(void)
+{
+	return settings.clock == CM_CLOCK_COARSE ? cm_coarse_ns() : cm_tsc();
+}
+
+static uint64_t ticks_to_ns(uint64_t ticks)
+{
+	uint64_t hi = ticks >> 32, lo = ticks & 0xffffffffu;
+
+	return hi * settings.clock_mult + lo * (settings.clock_mult >> 32)
+		+ ((lo * (settings.clock_mult & 0xffffffffu)) >> 32);
+}
+
+/* Slot of cm_thread_info::released and frees_of of a thread id. */
+static size_t thread_slot(uint32_t id)
+{
+	return id < CM_THREAD_SLOTS ? id : 0;
+}
+
+/* Innermost tag of this thread, 0 if none. */
+static uint16_t current_tag(void)
+{
+	if (tag_depth == 0)
+		return 0;
+	return tag_stack[(tag_depth < CM_TAG_DEPTH ? tag_depth : CM_TAG_DEPTH) - 1];
+}
+
+/*
+ * Set the epoch, the birth time, the realloc chain, the thread and the tag
+ * of a new record, allocated by t. Its weight must be set.
+ */
+static void stamp_record(cm_thread_info* t, cm_alloc_map* node)
+{
+	node->epoch = cm_atomic_load_u32(&settings.epoch);
+	node->reallocs = 0;
+	node->copied = 0;
+	node->thread = t->id;
+	cm_counter_add_u32(&t->owned_bytes, (uint32_t)node->weight);
+	node->tag = current_tag();
+	if (node->tag) {
+		cm_tag_on_alloc(cm_tag_get(&settings.tags, node->tag), node->weight,
+						record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+	}
+	node->born = is_flag_set(CM_TRACK_LIFETIMES) ? clock_ticks() : 0;
+}
+
+/* The block of node is being freed, or reallocated with CM_TRACK_SAMPLED. */
+static void count_tag_free(const cm_alloc_map* node)
+{
+	if (node->tag) {
+		cm_tag_on_free(cm_tag_get(&settings.tags, node->tag), node->weight,
+					   record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+	}
+}
+
+/* Undo stamp_record by t, for a record that never made it into the index. */
+static void unstamp_record(cm_thread_info* t, const cm_alloc_map* node)
+{
+	cm_counter_add_u32(&t->owned_bytes, (uint32_t)0 - (uint32_t)node->weight);
+	count_tag_free(node);
+}
+
+/* t takes bytes off the weight of node, counted for node's thread. */
+static void release_record(cm_thread_info* t, const cm_alloc_map* node, uint32_t bytes)
+{
+	cm_counter_add_u32(&t->released[thread_slot(node->thread)], bytes);
+}
+
+/* t frees the block of node. */
+static void count_thread_free(cm_thread_info* t, const cm_alloc_map* node)
+{
+	uint32_t n = record_blocks(node);
+
+	release_record(t, node, (uint32_t)node->weight);
+	cm_counter_add_u32(&t->frees_of[thread_slot(node->thread)], n);
+	if (node->thread != t->id)
+		cm_site_on_remote_free(node->site, n, is_flag_set(CM_TRACK_THREAD_SAFE));
+}
+
+/* The block of node is being freed, file its lifetime under its site. */
+static void count_lifetime(const cm_alloc_map* node)
+{
+	uint64_t now;
+
+	if (!is_flag_set(CM_TRACK_LIFETIMES))
+		return;
+	now = clock_ticks();
+	cm_site_on_lifetime(node->site, now > node->born ? ticks_to_ns(now - node->born) : 0,
+						record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+}
+
+/* A realloc at site resized node's block from old_size, moving it if moved. */
+static void count_realloc(cm_site* site, cm_alloc_map* node, size_t old_size, int moved)
+{
+	size_t size = node->size;
+	uint64_t before, after, wasted = 0;
+
+	if (moved) {
+		/* how far the copies of the chain went past the size of the block */
+		before = node->copied > old_size ? node->copied - old_size : 0;
+		node->copied += old_size < size ? old_size : size;
+		after = node->copied > size ? node->copied - size : 0;
+		wasted = after > before ? after - before : 0;
+	}
+	++node->reallocs;
+	cm_site_on_realloc(site, old_size, size, moved, wasted, is_flag_set(CM_TRACK_THREAD_SAFE));
+}
+
+static cm_shard* shard_of(const void* mem)
+{
+	/* the index itself uses the low bits of the same hash */
+	return &settings.shards[(size_t)(cm_index_hash((uintptr_t)mem) >> 40)
+							& settings.shard_mask];
+}
+
+static void shard_lock(cm_shard* shard)
+{
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_lock(&shard->lock);
+}
+
+static void shard_unlock(cm_shard* shard)
+{
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_unlock(&shard->lock);
+}
+
+static void sample_filter_add(const void* mem, uint32_t value)
+{
+	volatile uint32_t* c = &settings.sample_filter[cm_sample_filter_slot(mem)];
+
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_atomic_add_u32(c, value);
+	else
+		cm_counter_add_u32(c, value);
+}
+
+/* Records of a shard, call with it locked. */
+static size_t shard_count(const cm_shard* shard)
+{
+	return cm_index_count(&shard->index) + shard->header_count;
+}
+
+static void header_link(cm_shard* shard, cm_block_header* hdr)
+{
+	hdr->prev = NULL;
+	hdr->next = shard->headers;
+	if (hdr->next)
+		hdr->next->prev = hdr;
+	shard->headers = hdr;
+	++shard->header_count;
+}
+
+static void header_unlink(cm_shard* shard, cm_block_header* hdr)
+{
+	if (hdr->prev)
+		hdr->prev->next = hdr->next;
+	else
+		shard->headers = hdr->next;
+	if (hdr->next)
+		hdr->next->prev = hdr->prev;
+	--shard->header_count;
+}
+
+/* Records in an inline header go into the list of the shard, which can't fail. */
+static int index_insert(cm_alloc_map* node)
+{
+	cm_shard* shard = shard_of(node->block);
+	int ok = 1;
+
+	shard_lock(shard);
+	if (node->flags & CM_REC_INLINE)
+		header_link(shard, (cm_block_header*)node);
+	else
+		ok = cm_index_insert(&shard->index, node);
+	cm_atomic_store_u32(&shard->live, (uint32_t)shard_count(shard));
+	shard_unlock(shard);
+	if (ok && settings.sample_filter)
+		sample_filter_add(node->block, 1);
+	return ok;
+}
+
+static cm_alloc_map* index_remove(const void* mem)
+{
+	cm_shard* shard = shard_of(mem);
+	cm_alloc_map* node;
+
+	/* common when sampling: most blocks have no record */
+	if (settings.sample_filter
+		&& cm_atomic_load_u32(&settings.sample_filter[cm_sample_filter_slot(mem)]) == 0)
+		return NULL;
+	if (cm_atomic_load_u32(&shard->live) == 0)
+		return NULL;
+	shard_lock(shard);
+	node = cm_index_remove(&shard->index, mem);
+	cm_atomic_store_u32(&shard->live, (uint32_t)shard_count(shard));
+	shard_unlock(shard);
+	if (node && settings.sample_filter)
+		sample_filter_add(mem, (uint32_t)-1);
+	return node;
+}
+
+/* Take out the record of an inline header, in O(1). Never sampled. */
+static cm_alloc_map* index_remove_header(cm_block_header* hdr)
+{
+	cm_shard* shard = shard_of(hdr->rec.block);
+
+	shard_lock(shard);
+	header_unlink(shard, hdr);
+	cm_atomic_store_u32(&shard->live, (uint32_t)shard_count(shard));
+	shard_unlock(shard);
+	return &hdr->rec;
+}
+
+/*------------------------------------------------------------------------------
+	Event logging
+------------------------------------------------------------------------------*/
+
+#ifndef CM_LOG_RING_EVENTS
+#  define CM_LOG_RING_EVENTS 4096 /* a power of two */
+#endif
+
+#ifndef CM_LOG_BATCH_BYTES
+#  define CM_LOG_BATCH_BYTES (64 * 1024)
+#endif
+
+/* how long the log writer sleeps when there's nothing to write */
+#ifndef CM_LOG_IDLE_MS
+#  define CM_LOG_IDLE_MS 1
+#endif
+
+static void log_async(cm_thread_info* t, const cm_event* ev)
+{
+	cm_log_ring* ring = t->log_ring;
+	cm_log_ring* next;
+
+	if (!ring) {
+		ring = cm_log_ring_create(CM_LOG_RING_EVENTS);
+		if (!ring) {
+			invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+		t->log_ring = ring;
+		cm_atomic_store_release_ptr(&t->log_drain, ring);
+	}
+	while (!cm_log_ring_push(ring, ev)) {
+		if (is_flag_set(CM_LOG_FULL_DROP)) {
+			count(t, dropped_events, 1);
+			return;
+		}
+		if (is_flag_set(CM_LOG_FULL_GROW)) {
+			next = cm_log_ring_create(ring->capacity * 2);
+			/* out of memory: wait for the writer instead */
+			if (next) {
+				cm_atomic_store_release_ptr((void* volatile*)&ring->next, next);
+				t->log_ring = ring = next;
+				continue;
+			}
+		}
+		cm_thread_yield();
+	}
+}
+
+static void log_event(cm_thread_info* t, cm_event* ev)
+{
+	char line[CM_LOG_LINE_MAX];
+	int len;
+	int tracing;
+
+	if (!tracks(CM_LEVEL_FULL))
+		return;
+	tracing = (int)cm_atomic_load_u32(&settings.trace_open);
+	ev->time = tracing ? cm_now_ns() : 0;
+	if (is_flag_set(CM_LOG_ASYNC)) {
+		log_async(t, ev);
+		return;
+	}
+	if (tracing) {
+		cm_mutex_lock(&settings.trace_lock);
+		/* may have been closed in the meantime */
+		if (settings.trace_open)
+			cm_trace_write(&settings.trace, ev);
+		cm_mutex_unlock(&settings.trace_lock);
+		return;
+	}
+	len = cm_log_format(line, ev);
+	fwrite(line, 1, (size_t)len, settings.output);
+}
+
+/*
+ * Format everything buffered in the rings into batch and write it out in
+ * big chunks. Returns the number of events written.
+ */
+static size_t log_drain(char* batch, size_t* len)
+{
+	cm_thread_info* t;
+	cm_log_ring* ring;
+	cm_log_ring* next;
+	cm_event* ev;
+	size_t n = 0;
+
+	cm_mutex_lock(&settings.threads_lock);
+	t = settings.threads;
+	cm_mutex_unlock(&settings.threads_lock);
+	cm_mutex_lock(&settings.trace_lock);
+	/* threads are only ever pushed in front, the rest of the list is stable */
+	for (; t; t = t->next) {
+		ring = cm_atomic_load_acquire_ptr(&t->log_drain);
+		while (ring) {
+			while ((ev = cm_log_ring_peek(ring)) != NULL) {
+				if (settings.trace_open) {
+					cm_trace_write(&settings.trace, ev);
+				} else {
+					if (*len + CM_LOG_LINE_MAX > CM_LOG_BATCH_BYTES) {
+						fwrite(batch, 1, *len, settings.output);
+						*len = 0;
+					}
+					*len += (size_t)cm_log_format(batch + *len, ev);
+				}
+				cm_log_ring_pop(ring);
+				++n;
+			}
+			next = cm_atomic_load_acquire_ptr((void* const volatile*)&ring->next);
+			if (!next)
+				break;
+			/* the producer moved on, finish the old ring before dropping it */
+			if (cm_log_ring_peek(ring))
+				continue;
+			cm_aligned_free(ring);
+			ring = next;
+			cm_atomic_store_release_ptr(&t->log_drain, ring);
+		}
+	}
+	cm_mutex_unlock(&settings.trace_lock);
+	return n;
+}
+
+static void log_writer_main(void* arg)
+{
+	char* batch = arg;
+	size_t len = 0, n;
+	int stop;
+
+	for (;;) {
+		stop = cm_atomic_load_acquire_u32(&settings.log_stop);
+		n = log_drain(batch, &len);
+		if (len > 0) {
+			fwrite(batch, 1, len, settings.output);
+			fflush(settings.output);
+			len = 0;
+		}
+		cm_atomic_add_u32(&settings.log_passes, 1);
+		if (stop)
+			break;
+		if (n == 0)
+			cm_sleep_ms(CM_LOG_IDLE_MS);
+	}
+	free(batch);
+}
+
+static void log_start(void)
+{
+	char* batch;
+
+	settings.log_stop = 0;
+	settings.log_passes = 0;
+	batch = malloc(CM_LOG_BATCH_BYTES);
+	if (!batch || !cm_thread_start(&settings.log_writer, log_writer_main, batch)) {
+		invoke_on_error(CM_ERR_ERROR, "cm_init(): cannot start the log writer.");
+		exit(EXIT_FAILURE);
+	}
+	settings.log_running = 1;
+}
+
+/* Drop the rings of every thread, with whatever they still hold. */
+static void log_free_rings(void)
+{
+	cm_thread_info* t;
+	cm_log_ring* ring;
+	cm_log_ring* next;
+
+	for (t = settings.threads; t; t = t->next) {
+		for (ring = t->log_drain; ring; ring = next) {
+			next = ring->next;
+			cm_aligned_free(ring);
+		}
+		t->log_ring = NULL;
+		t->log_drain = NULL;
+	}
+}
+
+/* Write out everything and stop the log writer. */
+static void log_stop(void)
+{
+	cm_atomic_store_release_u32(&settings.log_stop, 1);
+	cm_thread_join(&settings.log_writer);
+	settings.log_running = 0;
+	log_free_rings();
+}
+
+/*------------------------------------------------------------------------------
+	Fork
+------------------------------------------------------------------------------*/
+
+/* the locks are held across a fork() */
+static int fork_locked;
+static int fork_handlers;
+
+/*
+ * Only the thread calling fork() lives on in the child, so every lock is
+ * taken around the fork: none is left held by a thread that is gone. The
+ * index shards come first, walk_live captures stacks while holding one.
+ */
+static void fork_prepare(void)
+{
+	size_t i;
+
+	if (!settings.initialized)
+		return;
+	for (i = 0; i < CM_INDEX_SHARDS; ++i)
+		shard_lock(&settings.shards[i]);
+	cm_mutex_lock(&settings.stacks_lock);
+	cm_mutex_lock(&settings.sites_lock);
+	cm_mutex_lock(&settings.tags_lock);
+	cm_mutex_lock(&settings.threads_lock);
+	cm_mutex_lock(&settings.trace_lock);
+	cm_mutex_lock(&settings.timeline_lock);
+	cm_mutex_lock(&settings.rss_lock);
+	cm_mutex_lock(&settings.records.lock);
+	fork_locked = 1;
+}
+
+static void fork_unlock(void)
+{
+	size_t i;
+
+	fork_locked = 0;
+	cm_mutex_unlock(&settings.records.lock);
+	cm_mutex_unlock(&settings.rss_lock);
+	cm_mutex_unlock(&settings.timeline_lock);
+	cm_mutex_unlock(&settings.trace_lock);
+	cm_mutex_unlock(&settings.threads_lock);
+	cm_mutex_unlock(&settings.tags_lock);
+	cm_mutex_unlock(&settings.sites_lock);
+	cm_mutex_unlock(&settings.stacks_lock);
+	for (i = CM_INDEX_SHARDS; i-- > 0;)
+		shard_unlock(&settings.shards[i]);
+}
+
+static void fork_parent(void)
+{
+	if (fork_locked)
+		fork_unlock();
+}
+
+/*
+ * The log writer, the samplers and the publisher stayed in the parent, as
+ * do the events buffered for the writer, the trace and the live stats
+ * segment: the child logs synchronously and keeps only its counters.
+ */
+static void fork_child(void)
+{
+	if (!fork_locked)
+		return;
+	fork_unlock();
+	if (settings.log_running) {
+		settings.log_running = 0;
+		log_free_rings();
+		settings.flags &= ~(uint32_t)CM_LOG_ASYNC;
+	}
+	if (settings.trace_open) {
+		settings.trace_open = 0;
+		cm_trace_destroy(&settings.trace);
+	}
+	settings.timeline_running = 0;
+	settings.rss_running = 0;
+	cm_shm_close(&settings.shm, 0);
+}
+
+/*------------------------------------------------------------------------------
+	Inline headers (CM_TRACK_INLINE_HEADER)
+------------------------------------------------------------------------------*/
+
+/* keep the user block aligned as malloc would */
+#define CM_HEADER_ALIGN 16
+#define CM_HEADER_SIZE \
+	((sizeof(cm_block_header) + CM_HEADER_ALIGN - 1) & ~(size_t)(CM_HEADER_ALIGN - 1))
+
+#define CM_HEADER_MAGIC ((uintptr_t)0x636d6f6eu) /* "cmon" */
+
+static void* header_block(cm_block_header* hdr)
+{
+	return (char*)hdr + CM_HEADER_SIZE;
+}
+
+static uintptr_t header_cookie(const cm_block_header* hdr)
+{
+	/* tied to the header address so a copied header won't match */
+	return (uintptr_t)hdr ^ CM_HEADER_MAGIC;
+}
+
+/*
+ * Get the header in front of mem, NULL if mem was not allocated by us.
+ *
+ * @warning Reads the bytes right before mem, a foreign pointer at the very
+ *          beginning of a mapping can fault.
+ */
+static cm_block_header* find_header(void* mem)
+{
+	cm_block_header* hdr;
+
+	if (!mem)
+		return NULL;
+	hdr = (cm_block_header*)((char*)mem - CM_HEADER_SIZE);
+	return hdr->cookie == header_cookie(hdr) ? hdr : NULL;
+}
+
+/*
+ * Allocate a block of size bytes (zeroed if 'zero') with its record. In
+ * inline header mode both come from a single underlying allocation.
+ */
+static cm_alloc_map* alloc_record(size_t size, int zero)
+{
+	cm_block_header* hdr;
+	cm_alloc_map* node;
+	void* mem;
+
+	if (is_flag_set(CM_TRACK_INLINE_HEADER)) {
+		if (size > SIZE_MAX - CM_HEADER_SIZE)
+			return NULL;
+		hdr = zero ? calloc(1, CM_HEADER_SIZE + size) : malloc(CM_HEADER_SIZE + size);
+		if (!hdr)
+			return NULL;
+		hdr->cookie = header_cookie(hdr);
+		node = &hdr->rec;
+		node->block = header_block(hdr);
+		node->flags = CM_REC_INLINE;
+		return node;
+	}
+	node = cm_slab_alloc(&settings.records, &records_magazine);
+	if (!node)
+		return NULL;
+	mem = zero ? calloc(1, size) : malloc(size);
+	if (!mem) {
+		cm_slab_free(&settings.records, &records_magazine, node);
+		return NULL;
+	}
+	node->block = mem;
+	node->flags = 0;
+	return node;
+}
+
+/* Free both the memory block and its record. */
+static void free_record(cm_alloc_map* node)
+{
+	cm_block_header* hdr;
+
+	if (node->flags & CM_REC_INLINE) {
+		hdr = (cm_block_header*)((char*)node->block - CM_HEADER_SIZE);
+		hdr->cookie = 0;
+		free(hdr);
+		return;
+	}
+	free(node->block);
+	cm_slab_free(&settings.records, &records_magazine, node);
+}
+
+/*
+ * Resize the block of a record. Returns the new record (inline headers move
+ * with the block) or NULL on failure, in which case node is left untouched.
+ */
+static cm_alloc_map* realloc_record(cm_alloc_map* node, size_t size)
+{
+	cm_block_header* hdr;
+	void* mem;
+
+	if (node->flags & CM_REC_INLINE) {
+		if (size > SIZE_MAX - CM_HEADER_SIZE)
+			return NULL;
+		hdr = (cm_block_header*)((char*)node->block - CM_HEADER_SIZE);
+		hdr = realloc(hdr, CM_HEADER_SIZE + size);
+		if (!hdr)
+			return NULL;
+		hdr->cookie = header_cookie(hdr);
+		hdr->rec.block = header_block(hdr);
+		return &hdr->rec;
+	}
+	mem = realloc(node->block, size);
+	if (!mem)
+		return NULL;
+	node->block = mem;
+	return node;
+}
+
+/* Drop all the bookkeeping. Live blocks are not freed. */
+static void release_metadata(void)
+{
+	cm_thread_info* t;
+	cm_thread_info* next;
+	size_t i;
+
+	cm_timeline_stop();
+	cm_ring_destroy(&settings.timeline);
+	cm_mutex_destroy(&settings.timeline_lock);
+	cm_rss_stop();
+	cm_shm_unpublish();
+	cm_ring_destroy(&settings.rss);
+	cm_mutex_destroy(&settings.rss_lock);
+	if (settings.log_running)
+		log_stop();
+	if (settings.trace_open) {
+		cm_trace_destroy(&settings.trace);
+		settings.trace_open = 0;
+	}
+	cm_mutex_destroy(&settings.trace_lock);
+	cm_tls_key_delete(settings.thread_key);
+	for (t = settings.threads; t; t = next) {
+		next = t->next;
+		cm_aligned_free(t);
+	}
+	settings.threads = NULL;
+	settings.thread_count = 0;
+	cm_mutex_destroy(&settings.threads_lock);
+	for (i = 0; i < CM_INDEX_SHARDS; ++i) {
+		cm_index_destroy(&settings.shards[i].index);
+		cm_mutex_destroy(&settings.shards[i].lock);
+	}
+	cm_slab_destroy(&settings.records);
+	cm_site_table_destroy(&settings.sites);
+	cm_mutex_destroy(&settings.sites_lock);
+	cm_tag_table_destroy(&settings.tags);
+	cm_mutex_destroy(&settings.tags_lock);
+	free((void*)settings.sample_filter);
+	settings.sample_filter = NULL;
+	cm_stack_table_destroy(&settings.stacks);
+	cm_mutex_destroy(&settings.stacks_lock);
+}
+
+int cm_init(FILE* output, cm_error_fn on_error, uint32_t flags)
+{
+	size_t i;
+
+	settings.on_error = on_error;
+	if (!output) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_init(): cmonitor doesn't have a valid file output.");
+		return 0;
+	}
+	/* torn down as set up, under the previous flags */
+	if (settings.initialized)
+		release_metadata();
+	settings.output = output;
+	settings.flags = flags;
+	if (is_flag_set(CM_TRACK_SAMPLED) && is_flag_set(CM_TRACK_INLINE_HEADER)) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_init(): CM_TRACK_INLINE_HEADER ignored when sampling.");
+		settings.flags &= ~(uint32_t)CM_TRACK_INLINE_HEADER;
+	}
+	if (!settings.sample_interval)
+		settings.sample_interval = CM_SAMPLE_INTERVAL;
+	if (is_flag_set(CM_TRACK_SAMPLED)) {
+		settings.sample_filter = calloc(CM_SAMPLE_FILTER_SIZE, sizeof(uint32_t));
+		if (!settings.sample_filter) {
+			invoke_on_error(CM_ERR_ERROR, "cm_init(): internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+	}
+	for (i = 0; i < CM_INDEX_SHARDS; ++i) {
+		cm_mutex_init(&settings.shards[i].lock);
+		cm_index_init(&settings.shards[i].index);
+		settings.shards[i].headers = NULL;
+		settings.shards[i].header_count = 0;
+	}
+	settings.shard_mask = is_flag_set(CM_TRACK_THREAD_SAFE) ? CM_INDEX_SHARDS - 1 : 0;
+	cm_slab_init(&settings.records, sizeof(cm_alloc_map));
+	cm_mutex_init(&settings.sites_lock);
+	cm_site_table_init(&settings.sites);
+	cm_mutex_init(&settings.tags_lock);
+	cm_tag_table_init(&settings.tags);
+	cm_mutex_init(&settings.stacks_lock);
+	cm_stack_table_init(&settings.stacks);
+	if (!settings.stack_depth)
+		settings.stack_depth = CM_STACK_DEPTH;
+	cm_mutex_init(&settings.threads_lock);
+	cm_mutex_init(&settings.trace_lock);
+	cm_mutex_init(&settings.timeline_lock);
+	cm_mutex_init(&settings.rss_lock);
+	settings.start_ns = cm_now_ns();
+	settings.live_bytes = 0;
+	settings.peak_bytes = 0;
+	if (!cm_tls_key_create(&settings.thread_key, on_thread_exit)) {
+		invoke_on_error(CM_ERR_ERROR, "cm_init(): cannot create a TLS key.");
+		exit(EXIT_FAILURE);
+	}
+	/* can't be undone, the handlers check settings.initialized */
+	if (!fork_handlers) {
+		fork_handlers = cm_atfork(fork_prepare, fork_parent, fork_child);
+		if (!fork_handlers)
+			invoke_on_error(CM_ERR_WARNING, "cm_init(): cannot register the fork handlers.");
+	}
+	++cm_generation_;
+	settings.epoch = 0;
+	if (is_flag_set(CM_TRACK_LIFETIMES) && !settings.clock_mult)
+		calibrate_clock();
+	bind_static_sites();
+	settings.initialized = 1;
+	if (is_flag_set(CM_LOG_ASYNC))
+		log_start();
+	return 1;
+}
+
+void cm_shutdown(void)
+{
+	if (!settings.initialized)
+		return;
+	release_metadata();
+	settings.initialized = 0;
+}
+
+void cm_flush(void)
+{
+	uint32_t target;
+
+	/* no writer in this process, e.g. in a forked child */
+	if (!settings.initialized || !settings.log_running) {
+		fflush(settings.output);
+		return;
+	}
+	/* the pass running now may have missed our last events, wait for the next */
+	target = cm_atomic_load_acquire_u32(&settings.log_passes) + 2;
+	while ((int32_t)(cm_atomic_load_acquire_u32(&settings.log_passes) - target) < 0)
+		cm_sleep_ms(CM_LOG_IDLE_MS);
+}
+
+int cm_trace_open(const char* path, size_t ring_bytes)
+{
+	int ok;
+
+	if (!settings.initialized || !path) {
+		invoke_on_error(CM_ERR_WARNING, "cm_trace_open(): invalid call.");
+		return 0;
+	}
+	if (!tracks(CM_LEVEL_FULL)) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_trace_open(): built without CM_LEVEL_FULL.");
+		return 0;
+	}
+	/* buffered events have no timestamp, get them out of the way */
+	cm_flush();
+	cm_trace_close();
+	cm_mutex_lock(&settings.trace_lock);
+	ok = cm_trace_create(&settings.trace, path, ring_bytes);
+	if (ok)
+		cm_atomic_store_release_u32(&settings.trace_open, 1);
+	cm_mutex_unlock(&settings.trace_lock);
+	if (!ok)
+		invoke_on_error(CM_ERR_WARNING, "cm_trace_open(): cannot map the trace file.");
+	return ok;
+}
+
+void cm_trace_close(void)
+{
+	if (!settings.initialized || !settings.trace_open)
+		return;
+	/* events still buffered belong to the trace */
+	cm_flush();
+	cm_mutex_lock(&settings.trace_lock);
+	cm_atomic_store_release_u32(&settings.trace_open, 0);
+	cm_trace_destroy(&settings.trace);
+	cm_mutex_unlock(&settings.trace_lock);
+}
+
+void cm_set_sample_interval(size_t bytes)
+{
+	if (bytes == 0)
+		bytes = CM_SAMPLE_INTERVAL;
+	if (bytes > UINT32_MAX)
+		bytes = UINT32_MAX;
+	cm_atomic_store_u32(&settings.sample_interval, (uint32_t)bytes);
+}
+
+void cm_set_stack_depth(int depth)
+{
+	if (depth <= 0)
+		depth = CM_STACK_DEPTH;
+	if (depth > CM_STACK_MAX_DEPTH)
+		depth = CM_STACK_MAX_DEPTH;
+	cm_atomic_store_u32(&settings.stack_depth, (uint32_t)depth);
+}
+
+void cm_set_clock(int clock)
+{
+	if (clock != CM_CLOCK_TSC && clock != CM_CLOCK_COARSE) {
+		invoke_on_error(CM_ERR_WARNING, "cm_set_clock(): unknown clock.");
+		return;
+	}
+	settings.clock = clock;
+	calibrate_clock();
+}
+
+void cm_print_stats(void)
+{
+	const char* msg =
+		"\n /=========================\\\n"
+		" |===    Quick Stats    ===|\n"
+		" |=========================|\n"
+		" |total alloc:      %.7d|\n"
+		" |total free:       %.7d|\n"
+		" |-------------------------|\n"
+		" |total leaks:      %.7d|\n"
+		" |peak:             %.7d|\n"
+		" |                         |\n"
+		" |total malloc():   %.7d|\n"
+		" |total calloc():   %.7d|\n"
+		" |-------------------------|\n"
+		" |total free():     %.7d|\n"
+		" |                         |\n"
+		" |total realloc():  %.7d|\n"
+		" |-------------------------|\n"
+		" |overhead:         %.7d|\n"
+		" \\=========================/\n\n";
+	cm_stats info;
+	cm_size_bucket sizes[CM_SIZE_CLASSES];
+	cm_site_lifetimes lifetimes[CM_PRINT_LIFETIME_SITES];
+	cm_realloc_site reallocs[CM_PRINT_REALLOC_SITES];
+	cm_site_stats remote[CM_PRINT_REMOTE_SITES];
+	cm_tag_stats tags[CM_PRINT_TAGS];
+	cm_rss_sample rss;
+	char site_name[64];
+	size_t i, n;
+
+	cm_get_stats(&info);
+	n = cm_get_size_histogram(sizes, CM_SIZE_CLASSES);
+	cm_flush();
+
+	fprintf(settings.output, msg,
+			info.total_allocated,
+			info.total_freed,
+			/*-------------------------*/
+			info.live_bytes,
+			info.peak_bytes,
+			/*                         */
+			info.malloc_count,
+			info.calloc_count,
+			/*-------------------------*/
+			info.free_count,
+			/*                         */
+			info.realloc_count,
+			/*-------------------------*/
+			info.overhead_bytes
+	);
+	if (n > 0) {
+		fprintf(settings.output, " %-23s %10s %10s %10s\n",
+				"size class", "allocs", "frees", "reallocs");
+		for (i = 0; i < n; ++i) {
+			fprintf(settings.output, " %10lu - %-10lu %10u %10u %10u\n",
+					(unsigned long)sizes[i].min_size, (unsigned long)sizes[i].max_size,
+					sizes[i].allocs, sizes[i].frees, sizes[i].reallocs);
+		}
+		fprintf(settings.output, "\n");
+	}
+	/* the sites whose blocks mostly die young, for the stack or an arena */
+	n = cm_get_site_lifetimes(lifetimes, CM_PRINT_LIFETIME_SITES);
+	for (i = 0; i < n && lifetimes[i].arena_candidate; ++i) {
+		if (i == 0) {
+			fprintf(settings.output, " %-40s %10s %10s\n",
+					"short lived sites", "short", "freed");
+		}
+		snprintf(site_name, sizeof(site_name), "%s:%d",
+				 cm_basename(lifetimes[i].filename), lifetimes[i].line);
+		fprintf(settings.output, " %-40s %10u %10u\n", site_name,
+				lifetimes[i].short_lived, lifetimes[i].freed);
+	}
+	if (i > 0)
+		fprintf(settings.output, "\n");
+	if (cm_atomic_load_u32(&settings.rss_recording) && cm_rss_sample_now(&rss)) {
+		fprintf(settings.output, " resident: %llu KB, anonymous: %llu KB, fragmentation: %.2f\n\n",
+				(unsigned long long)(rss.rss_bytes / 1024),
+				(unsigned long long)(rss.anon_bytes / 1024), rss.fragmentation);
+	}
+	/* the sites growing buffers a few bytes at a time */
+	n = cm_get_realloc_sites(reallocs, CM_PRINT_REALLOC_SITES);
+	for (i = 0; i < n && reallocs[i].wasted_bytes > 0; ++i) {
+		if (i == 0) {
+			fprintf(settings.output, " %-40s %10s %10s %7s %10s\n",
+					"realloc churn sites", "reallocs", "moves", "growth", "wasted");
+		}
+		snprintf(site_name, sizeof(site_name), "%s:%d",
+				 cm_basename(reallocs[i].filename), reallocs[i].line);
+		fprintf(settings.output, " %-40s %10u %10u %6.2fx %10llu\n", site_name,
+				reallocs[i].reallocs, reallocs[i].moves, reallocs[i].growth_factor,
+				(unsigned long long)reallocs[i].wasted_bytes);
+	}
+	if (i > 0)
+		fprintf(settings.output, "\n");
+	/* which subsystem owns the memory */
+	n = cm_get_tag_tree(tags, CM_PRINT_TAGS);
+	if (n > 0) {
+		fprintf(settings.output, " %-40s %10s %10s %10s %10s\n",
+				"tags", "tree live", "live", "blocks", "peak");
+		for (i = 0; i < n; ++i) {
+			snprintf(site_name, sizeof(site_name), "%*s%s",
+					 2 * tags[i].depth, "", tags[i].name);
+			fprintf(settings.output, " %-40s %10u %10u %10u %10u\n", site_name,
+					tags[i].tree_live_bytes, tags[i].live_bytes, tags[i].live_count,
+					tags[i].peak_bytes);
+		}
+		fprintf(settings.output, "\n");
+	}
+	/* producer/consumer hand-offs, the allocator pays for them */
+	n = cm_get_site_stats(remote, CM_PRINT_REMOTE_SITES, CM_SITE_REMOTE_FREES);
+	for (i = 0; i < n && remote[i].remote_frees > 0; ++i) {
+		if (i == 0) {
+			fprintf(settings.output, " %-40s %10s %10s\n",
+					"cross-thread free sites", "remote", "freed");
+		}
+		snprintf(site_name, sizeof(site_name), "%s:%d",
+				 cm_basename(remote[i].filename), remote[i].line);
+		fprintf(settings.output, " %-40s %10u %10u\n", site_name,
+				remote[i].remote_frees, remote[i].free_count);
+	}
+	if (i > 0)
+		fprintf(settings.output, "\n");
+}
+
+/* The counters of cm_stats, summed over the threads. */
+static void sum_thread_stats(cm_stats* out)
+{
+	cm_thread_info* t;
+
+	memset(out, 0, sizeof(cm_stats));
+	cm_mutex_lock(&settings.threads_lock);
+	for (t = settings.threads; t; t = t->next) {
+		out->total_allocated += cm_atomic_load_u32(&t->counters.stats.total_allocated);
+		out->total_freed += cm_atomic_load_u32(&t->counters.stats.total_freed);
+		out->malloc_count += cm_atomic_load_u32(&t->counters.stats.malloc_count);
+		out->free_count += cm_atomic_load_u32(&t->counters.stats.free_count);
+		out->calloc_count += cm_atomic_load_u32(&t->counters.stats.calloc_count);
+		out->realloc_count += cm_atomic_load_u32(&t->counters.stats.realloc_count);
+		out->dropped_events += cm_atomic_load_u32(&t->counters.stats.dropped_events);
+		out->live_blocks += cm_atomic_load_u32(&t->counters.stats.live_blocks);
+	}
+	cm_mutex_unlock(&settings.threads_lock);
+	out->live_bytes = out->total_allocated - out->total_freed;
+	out->peak_bytes = cm_atomic_load_u32(&settings.peak_bytes);
+	/* the threads publish their bytes late, the current value may be higher */
+	if ((int32_t)out->live_bytes > 0 && out->live_bytes > out->peak_bytes)
+		out->peak_bytes = out->live_bytes;
+}
+
+void cm_get_stats(cm_stats* out)
+{
+	size_t i, live, overhead;
+
+	if (!out) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_stats(): out is an invalid pointer.");
+		return;
+	}
+	sum_thread_stats(out);
+	overhead = cm_slab_overhead(&settings.records);
+	live = 0;
+	cm_mutex_lock(&settings.threads_lock);
+	overhead += settings.thread_count * sizeof(cm_thread_info);
+	cm_mutex_unlock(&settings.threads_lock);
+	cm_mutex_lock(&settings.sites_lock);
+	overhead += cm_site_table_overhead(&settings.sites);
+	cm_mutex_unlock(&settings.sites_lock);
+	cm_mutex_lock(&settings.tags_lock);
+	overhead += cm_tag_table_overhead(&settings.tags);
+	cm_mutex_unlock(&settings.tags_lock);
+	cm_mutex_lock(&settings.stacks_lock);
+	overhead += cm_stack_table_overhead(&settings.stacks);
+	cm_mutex_unlock(&settings.stacks_lock);
+	for (i = 0; i <= settings.shard_mask; ++i) {
+		shard_lock(&settings.shards[i]);
+		overhead += cm_index_overhead(&settings.shards[i].index);
+		live += settings.shards[i].header_count;
+		shard_unlock(&settings.shards[i]);
+	}
+	if (is_flag_set(CM_TRACK_INLINE_HEADER))
+		overhead += live * CM_HEADER_SIZE;
+	if (settings.sample_filter)
+		overhead += CM_SAMPLE_FILTER_SIZE * sizeof(uint32_t);
+	out->overhead_bytes = (uint32_t)overhead;
+}
+
+size_t cm_get_size_histogram(cm_size_bucket* out, size_t max_buckets)
+{
+	cm_thread_info* t;
+	cm_size_bucket b;
+	size_t c, n = 0;
+
+	if (!out && max_buckets > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_size_histogram(): out is an invalid pointer.");
+		return 0;
+	}
+	cm_mutex_lock(&settings.threads_lock);
+	for (c = 0; c < CM_SIZE_CLASSES && n < max_buckets; ++c) {
+		b.allocs = b.frees = b.reallocs = 0;
+		for (t = settings.threads; t; t = t->next) {
+			b.allocs += cm_atomic_load_u32(&t->counters.allocs[c]);
+			b.frees += cm_atomic_load_u32(&t->counters.frees[c]);
+			b.reallocs += cm_atomic_load_u32(&t->counters.reallocs[c]);
+		}
+		if (b.allocs == 0 && b.frees == 0 && b.reallocs == 0)
+			continue;
+		b.min_size = cm_size_class_min(c);
+		b.max_size = cm_size_class_max(c);
+		out[n++] = b;
+	}
+	cm_mutex_unlock(&settings.threads_lock);
+	return n;
+}
+
+/* Describe the live block of a record, valid until cm_shutdown/cm_init. */
+static void leak_of(const cm_alloc_map* rec, cm_leak_info* out)
+{
+	cm_stack* stack;
+
+	out->filename = rec->site->filename;
+	out->line = rec->site->line;
+	out->bytes = rec->size;
+	out->estimated_bytes = rec->weight;
+	out->address = rec->block;
+	out->stack = NULL;
+	out->stack_depth = 0;
+	out->epoch = rec->epoch;
+	out->reallocs = rec->reallocs;
+	out->thread = rec->thread;
+	out->tag = rec->tag ? cm_tag_get(&settings.tags, rec->tag)->name : NULL;
+	if (rec->stack_id) {
+		/* by_id may be moved by another thread interning a stack */
+		cm_mutex_lock(&settings.stacks_lock);
+		stack = cm_stack_get(&settings.stacks, rec->stack_id);
+		cm_mutex_unlock(&settings.stacks_lock);
+		out->stack = (void* const*)stack->frames;
+		out->stack_depth = (int)stack->depth;
+	}
+}
+
+/*
+ * Call fn on every live block, one shard at a time with its lock held. Stops
+ * when fn returns non zero. Returns the number of blocks fn was called on.
+ */
+static size_t walk_live(int (*fn)(const cm_alloc_map* rec, void* ctx), void* ctx)
+{
+	cm_alloc_map* rec;
+	cm_block_header* hdr;
+	size_t s, it, n = 0;
+	int stop = 0;
+
+	if (!settings.initialized)
+		return 0;
+	for (s = 0; s <= settings.shard_mask && !stop; ++s) {
+		shard_lock(&settings.shards[s]);
+		cm_index_foreach(&settings.shards[s].index, it, rec) {
+			++n;
+			stop = fn(rec, ctx);
+			if (stop)
+				break;
+		}
+		for (hdr = settings.shards[s].headers; hdr && !stop; hdr = hdr->next) {
+			++n;
+			stop = fn(&hdr->rec, ctx);
+		}
+		shard_unlock(&settings.shards[s]);
+	}
+	return n;
+}
+
+typedef struct cm_live_call {
+	cm_live_fn fn;
+	void* ctx;
+	cm_leak_info* snapshot; /* CM_LIVE_SNAPSHOT */
+	size_t count;
+	size_t capacity;
+} cm_live_call;
+
+static int live_call(const cm_alloc_map* rec, void* ctx)
+{
+	cm_live_call* call = ctx;
+	cm_leak_info info;
+
+	leak_of(rec, &info);
+	return call->fn(&info, call->ctx);
+}
+
+static int live_copy(const cm_alloc_map* rec, void* ctx)
+{
+	cm_live_call* call = ctx;
+
+	/* the caller made room for every block of the shard */
+	leak_of(rec, &call->snapshot[call->count++]);
+	return 0;
+}
+
+/*
+ * Copy the live blocks into call->snapshot, holding each shard's lock only
+ * while copying that shard. Returns 0 if out of memory.
+ */
+static int live_snapshot(cm_live_call* call)
+{
+	cm_shard* shard;
+	cm_leak_info* grown;
+	cm_alloc_map* rec;
+	cm_block_header* hdr;
+	size_t s, it, live;
+
+	call->snapshot = NULL;
+	call->count = call->capacity = 0;
+	for (s = 0; s <= settings.shard_mask; ++s) {
+		shard = &settings.shards[s];
+		for (;;) {
+			live = cm_atomic_load_u32(&shard->live);
+			if (call->capacity - call->count < live) {
+				/* leave some room for the blocks allocated in the meantime */
+				grown = realloc(call->snapshot,
+								(call->count + live + live / 8 + 16) * sizeof(cm_leak_info));
+				if (!grown) {
+					free(call->snapshot);
+					return 0;
+				}
+				call->snapshot = grown;
+				call->capacity = call->count + live + live / 8 + 16;
+			}
+			shard_lock(shard);
+			if (shard_count(shard) <= call->capacity - call->count)
+				break;
+			shard_unlock(shard);
+		}
+		cm_index_foreach(&shard->index, it, rec)
+			live_copy(rec, call);
+		for (hdr = shard->headers; hdr; hdr = hdr->next)
+			live_copy(&hdr->rec, call);
+		shard_unlock(shard);
+	}
+	return 1;
+}
+
+size_t cm_foreach_live(cm_live_fn fn, void* ctx, uint32_t flags)
+{
+	cm_live_call call;
+	size_t i;
+
+	if (!fn) {
+		invoke_on_error(CM_ERR_WARNING, "cm_foreach_live(): fn is an invalid pointer.");
+		return 0;
+	}
+	call.fn = fn;
+	call.ctx = ctx;
+	if (!(flags & CM_LIVE_SNAPSHOT))
+		return walk_live(live_call, &call);
+	if (!settings.initialized)
+		return 0;
+	if (!live_snapshot(&call)) {
+		invoke_on_error(CM_ERR_ERROR, "cm_foreach_live(): internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < call.count; ++i) {
+		if (fn(&call.snapshot[i], ctx)) {
+			++i;
+			break;
+		}
+	}
+	free(call.snapshot);
+	return i;
+}
+
+typedef struct cm_live_fill {
+	cm_leak_info* out;
+	size_t max_blocks;
+	size_t count;
+} cm_live_fill;
+
+static int live_fill(const cm_alloc_map* rec, void* ctx)
+{
+	cm_live_fill* fill = ctx;
+
+	if (fill->count < fill->max_blocks)
+		leak_of(rec, &fill->out[fill->count]);
+	++fill->count;
+	return 0;
+}
+
+size_t cm_get_live(cm_leak_info* out, size_t max_blocks)
+{
+	cm_live_fill fill;
+
+	if (!out && max_blocks > 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_get_live(): out is an invalid pointer.");
+		return 0;
+	}
+	fill.out = out;
+	fill.max_blocks = max_blocks;
+	fill.count = 0;
+	walk_live(live_fill, &fill);
+	return fill.count;
+}
+
+typedef struct cm_leaks_array {
+	cm_leak_info** leaks;
+	size_t count;
+	size_t capacity;
+	int failed;
+} cm_leaks_array;
+
+static int leaks_push(const cm_alloc_map* rec, void* ctx)
+{
+	cm_leaks_array* a = ctx;
+	cm_leak_info** grown;
+	cm_leak_info* leak;
+
+	if (a->count == a->capacity) {
+		a->capacity = a->capacity ? a->capacity * 2 : 64;
+		grown = realloc(a->leaks, a->capacity * sizeof(cm_leak_info*));
+		if (!grown) {
+			a->failed = 1;
+			return 1;
+		}
+		a->leaks = grown;
+	}
+	leak = malloc(sizeof(cm_leak_info));
+	if (!leak) {
+		a->failed = 1;
+		return 1;
+	}
+	leak_of(rec, leak);
+	a->leaks[a->count++] = leak;
+	return 0;
+}
+
+void cm_get_leaks(cm_leak_info*** out_array, size_t* out_leaks_count)
+{
+	cm_leaks_array a;
+
+	if (!out_leaks_count) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_leaks(): out_leaks_count is an invalid pointer.");
+		*out_array = NULL;
+		return;
+	}
+	a.leaks = NULL;
+	a.count = a.capacity = 0;
+	a.failed = 0;
+	walk_live(leaks_push, &a);
+	if (a.failed) {
+		invoke_on_error(CM_ERR_ERROR,
+						"cm_get_leaks(): internal malloc failed.");
+		cm_free_leaks_info(a.leaks, a.count);
+		if (a.count == 0)
+			free(a.leaks);
+		a.leaks = NULL;
+		a.count = 0;
+	}
+	*out_array = a.leaks;
+	*out_leaks_count = a.count;
+}
+
+void cm_free_leaks_info(cm_leak_info** leak_array, size_t size)
+{
+	size_t i;
+
+	if (!leak_array || size == 0)
+		return;
+	for (i = 0; i < size; ++i) {
+		free(leak_array[i]);
+	}
+	free(leak_array);
+}
+
+static uint32_t site_metric(const cm_site_stats* s, int metric)
+{
+	switch (metric) {
+		case CM_SITE_LIVE_COUNT:   return s->live_count;
+		case CM_SITE_ALLOC_COUNT:  return s->alloc_count;
+		case CM_SITE_FREE_COUNT:   return s->free_count;
+		case CM_SITE_PEAK_BYTES:   return s->peak_bytes;
+		case CM_SITE_REMOTE_FREES: return s->remote_frees;
+		default:                   return s->live_bytes;
+	}
+}
+
+size_t cm_get_site_stats(cm_site_stats* out, size_t max_sites, int metric)
+{
+	cm_site* site;
+	cm_site_stats s;
+	size_t i, j, n = 0;
+
+	if (!out && max_sites > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_site_stats(): out is an invalid pointer.");
+		return 0;
+	}
+	if (metric < CM_SITE_LIVE_BYTES || metric > CM_SITE_REMOTE_FREES) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_site_stats(): unknown metric.");
+		return 0;
+	}
+	if (max_sites == 0)
+		return 0;
+	cm_mutex_lock(&settings.sites_lock);
+	for (i = 0; i < settings.sites.count; ++i) {
+		site = settings.sites.by_id[i];
+		s.alloc_count = cm_atomic_load_u32(&site->alloc_count);
+		/* sites only used to free */
+		if (s.alloc_count == 0)
+			continue;
+		s.alloc_bytes = cm_atomic_load_u32(&site->alloc_bytes);
+		s.filename = site->filename;
+		s.line = site->line;
+		s.live_bytes = cm_atomic_load_u32(&site->live_bytes);
+		s.live_count = cm_atomic_load_u32(&site->live_count);
+		s.free_count = cm_atomic_load_u32(&site->free_count);
+		s.peak_bytes = cm_atomic_load_u32(&site->peak_bytes);
+		s.remote_frees = cm_atomic_load_u32(&site->remote_frees);
+		/* keep out sorted, only the top max_sites are of interest */
+		if (n == max_sites && site_metric(&s, metric) <= site_metric(&out[n - 1], metric))
+			continue;
+		j = n < max_sites ? n++ : n - 1;
+		for (; j > 0 && site_metric(&out[j - 1], metric) < site_metric(&s, metric); --j)
+			out[j] = out[j - 1];
+		out[j] = s;
+	}
+	cm_mutex_unlock(&settings.sites_lock);
+	return n;
+}
+
+size_t cm_get_site_lifetimes(cm_site_lifetimes* out, size_t max_sites)
+{
+	cm_site* site;
+	cm_site_lifetimes s;
+	size_t i, j, n = 0;
+	int b;
+
+	if (!out && max_sites > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_site_lifetimes(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_sites == 0)
+		return 0;
+	cm_mutex_lock(&settings.sites_lock);
+	for (i = 0; i < settings.sites.count; ++i) {
+		site = settings.sites.by_id[i];
+		s.freed = 0;
+		for (b = 0; b < CM_LIFETIME_BUCKETS; ++b) {
+			s.buckets[b] = cm_atomic_load_u32(&site->lifetimes[b]);
+			s.freed += s.buckets[b];
+		}
+		if (s.freed == 0)
+			continue;
+		s.filename = site->filename;
+		s.line = site->line;
+		s.short_lived = cm_atomic_load_u32(&site->short_lived);
+		s.arena_candidate = s.short_lived > s.freed / 2;
+		/* keep out sorted, only the top max_sites are of interest */
+		if (n == max_sites && s.short_lived <= out[n - 1].short_lived)
+			continue;
+		j = n < max_sites ? n++ : n - 1;
+		for (; j > 0 && out[j - 1].short_lived < s.short_lived; --j)
+			out[j] = out[j - 1];
+		out[j] = s;
+	}
+	cm_mutex_unlock(&settings.sites_lock);
+	return n;
+}
+
+size_t cm_get_realloc_sites(cm_realloc_site* out, size_t max_sites)
+{
+	cm_site* site;
+	cm_realloc_site s;
+	uint64_t from;
+	size_t i, j, n = 0;
+
+	if (!out && max_sites > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_realloc_sites(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_sites == 0)
+		return 0;
+	cm_mutex_lock(&settings.sites_lock);
+	for (i = 0; i < settings.sites.count; ++i) {
+		site = settings.sites.by_id[i];
+		s.reallocs = cm_atomic_load_u32(&site->realloc_count);
+		if (s.reallocs == 0)
+			continue;
+		s.filename = site->filename;
+		s.line = site->line;
+		s.moves = cm_atomic_load_u32(&site->realloc_moves);
+		s.grows = cm_atomic_load_u32(&site->grow_count);
+		s.slow_grows = cm_atomic_load_u32(&site->slow_grow_count);
+		from = cm_atomic_load_u64(&site->grow_from);
+		s.growth_factor = from ? (double)cm_atomic_load_u64(&site->grow_to) / (double)from : 0.0;
+		s.copied_bytes = cm_atomic_load_u64(&site->copied_bytes);
+		s.wasted_bytes = cm_atomic_load_u64(&site->wasted_bytes);
+		s.churn = s.slow_grows > s.grows / 2 || s.wasted_bytes > s.copied_bytes / 2;
+		/* keep out sorted, only the top max_sites are of interest */
+		if (n == max_sites && s.wasted_bytes <= out[n - 1].wasted_bytes)
+			continue;
+		j = n < max_sites ? n++ : n - 1;
+		for (; j > 0 && out[j - 1].wasted_bytes < s.wasted_bytes; --j)
+			out[j] = out[j - 1];
+		out[j] = s;
+	}
+	cm_mutex_unlock(&settings.sites_lock);
+	return n;
+}
+
+uint32_t cm_thread_id(void)
+{
+	if (!settings.initialized)
+		return 0;
+	return current_thread()->id;
+}
+
+size_t cm_get_thread_stats(cm_thread_stats* out, size_t max_threads)
+{
+	cm_thread_info* t;
+	uint32_t owned[CM_THREAD_SLOTS], released[CM_THREAD_SLOTS];
+	uint32_t remote[CM_THREAD_SLOTS], foreign[CM_THREAD_SLOTS];
+	uint32_t frees;
+	cm_thread_stats s;
+	size_t i, j, own, n = 0;
+
+	if (!out && max_threads > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_thread_stats(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_threads == 0)
+		return 0;
+	memset(owned, 0, sizeof(owned));
+	memset(released, 0, sizeof(released));
+	memset(remote, 0, sizeof(remote));
+	memset(foreign, 0, sizeof(foreign));
+	cm_mutex_lock(&settings.threads_lock);
+	for (t = settings.threads; t; t = t->next) {
+		own = thread_slot(t->id);
+		owned[own] += cm_atomic_load_u32(&t->owned_bytes);
+		for (i = 0; i < CM_THREAD_SLOTS; ++i) {
+			released[i] += cm_atomic_load_u32(&t->released[i]);
+			frees = cm_atomic_load_u32(&t->frees_of[i]);
+			if (i != own) {
+				remote[i] += frees;
+				foreign[own] += frees;
+			}
+		}
+	}
+	cm_mutex_unlock(&settings.threads_lock);
+	for (i = 0; i < CM_THREAD_SLOTS; ++i) {
+		if (owned[i] == 0 && remote[i] == 0 && foreign[i] == 0)
+			continue;
+		s.thread = (uint32_t)i;
+		s.live_bytes = owned[i] - released[i];
+		s.remote_frees = remote[i];
+		s.foreign_frees = foreign[i];
+		/* keep out sorted, only the top max_threads are of interest */
+		if (n == max_threads && s.live_bytes <= out[n - 1].live_bytes)
+			continue;
+		j = n < max_threads ? n++ : n - 1;
+		for (; j > 0 && out[j - 1].live_bytes < s.live_bytes; --j)
+			out[j] = out[j - 1];
+		out[j] = s;
+	}
+	return n;
+}
+
+size_t cm_get_thread_pairs(cm_thread_pair* out, size_t max_pairs)
+{
+	cm_thread_info* t;
+	uint32_t row[CM_THREAD_SLOTS];
+	cm_thread_pair p;
+	size_t i, j, f, n = 0;
+
+	if (!out && max_pairs > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_thread_pairs(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_pairs == 0)
+		return 0;
+	cm_mutex_lock(&settings.threads_lock);
+	/* one freeing slot at a time, threads past the slots share slot 0 */
+	for (f = 0; f < CM_THREAD_SLOTS; ++f) {
+		memset(row, 0, sizeof(row));
+		for (t = settings.threads; t; t = t->next) {
+			if (thread_slot(t->id) != f)
+				continue;
+			for (i = 0; i < CM_THREAD_SLOTS; ++i)
+				row[i] += cm_atomic_load_u32(&t->frees_of[i]);
+		}
+		for (i = 0; i < CM_THREAD_SLOTS; ++i) {
+			if (i == f || row[i] == 0)
+				continue;
+			p.alloc_thread = (uint32_t)i;
+			p.free_thread = (uint32_t)f;
+			p.frees = row[i];
+			if (n == max_pairs && p.frees <= out[n - 1].frees)
+				continue;
+			j = n < max_pairs ? n++ : n - 1;
+			for (; j > 0 && out[j - 1].frees < p.frees; --j)
+				out[j] = out[j - 1];
+			out[j] = p;
+		}
+	}
+	cm_mutex_unlock(&settings.threads_lock);
+	return n;
+}
+
+/* Get the tag name under parent, adding it if new. NULL if out of resources. */
+static cm_tag* tag_of(uint32_t parent, const char* name)
+{
+	cm_tag_cache_entry* e;
+	cm_tag* tag;
+
+	e = &tag_cache[(((uintptr_t)name >> 4) ^ parent * 0x9e3779b1u) & (CM_TAG_CACHE_SIZE - 1)];
+	/* the same buffer may hold another name by now */
+	if (e->name == name && e->parent == parent && strcmp(e->tag->name, name) == 0)
+		return e->tag;
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_lock(&settings.tags_lock);
+	tag = cm_tag_intern(&settings.tags, parent, name);
+	if (is_flag_set(CM_TRACK_THREAD_SAFE))
+		cm_mutex_unlock(&settings.tags_lock);
+	if (tag) {
+		e->name = name;
+		e->parent = parent;
+		e->tag = tag;
+	}
+	return tag;
+}
+
+int cm_tag_push(const char* name)
+{
+	cm_tag* tag = NULL;
+	uint16_t parent;
+
+	/* drops the scopes of a previous cm_init */
+	if (settings.initialized)
+		current_thread();
+	parent = current_tag();
+	if (tag_depth >= CM_TAG_DEPTH) {
+		++tag_depth;
+		return 1;
+	}
+	if (settings.initialized && name)
+		tag = tag_of(parent, name);
+	/* a failed push still needs its pop */
+	tag_stack[tag_depth++] = tag ? (uint16_t)tag->id : parent;
+	if (!settings.initialized || !name) {
+		invoke_on_error(CM_ERR_WARNING, "cm_tag_push(): invalid call.");
+		return 0;
+	}
+	if (!tag) {
+		invoke_on_error(CM_ERR_WARNING, "cm_tag_push(): cannot add the tag.");
+		return 0;
+	}
+	return 1;
+}
+
+void cm_tag_pop(void)
+{
+	if (tag_depth == 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_tag_pop(): no tag to pop.");
+		return;
+	}
+	--tag_depth;
+}
+
+/* Siblings together, the most tree_live_bytes first. */
+static int tag_order(const void* a, const void* b)
+{
+	const cm_tag_stats* x = *(const cm_tag_stats* const*)a;
+	const cm_tag_stats* y = *(const cm_tag_stats* const*)b;
+
+	if (x->parent != y->parent)
+		return x->parent < y->parent ? -1 : 1;
+	if (x->tree_live_bytes != y->tree_live_bytes)
+		return x->tree_live_bytes > y->tree_live_bytes ? -1 : 1;
+	return x->id < y->id ? -1 : 1;
+}
+
+size_t cm_get_tag_tree(cm_tag_stats* out, size_t max_tags)
+{
+	cm_tag* tag;
+	cm_tag_stats* all;
+	cm_tag_stats** order;
+	size_t* first;
+	size_t stack[CM_TAG_DEPTH + 1][2]; /* next and end of the children left */
+	size_t i, count, n = 0;
+	int sp = 0;
+
+	if (!out && max_tags > 0) {
+		invoke_on_error(CM_ERR_WARNING,
+						"cm_get_tag_tree(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_tags == 0 || !settings.initialized)
+		return 0;
+	cm_mutex_lock(&settings.tags_lock);
+	count = settings.tags.count;
+	if (count == 0) {
+		cm_mutex_unlock(&settings.tags_lock);
+		return 0;
+	}
+	all = malloc(count * sizeof(cm_tag_stats));
+	order = malloc(count * sizeof(cm_tag_stats*));
+	first = calloc(count + 2, sizeof(size_t));
+	if (!all || !order || !first) {
+		cm_mutex_unlock(&settings.tags_lock);
+		invoke_on_error(CM_ERR_ERROR, "cm_get_tag_tree(): internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < count; ++i) {
+		tag = cm_tag_get(&settings.tags, (uint32_t)i + 1);
+		all[i].name = tag->name;
+		all[i].id = tag->id;
+		all[i].parent = tag->parent;
+		all[i].depth = (int)tag->depth;
+		all[i].live_bytes = cm_atomic_load_u32(&tag->live_bytes);
+		all[i].live_count = cm_atomic_load_u32(&tag->live_count);
+		all[i].alloc_count = cm_atomic_load_u32(&tag->alloc_count);
+		all[i].alloc_bytes = cm_atomic_load_u32(&tag->alloc_bytes);
+		all[i].free_count = cm_atomic_load_u32(&tag->free_count);
+		all[i].peak_bytes = cm_atomic_load_u32(&tag->peak_bytes);
+		all[i].tree_live_bytes = all[i].live_bytes;
+		all[i].tree_live_count = all[i].live_count;
+		order[i] = &all[i];
+	}
+	cm_mutex_unlock(&settings.tags_lock);
+	/* a parent is always interned before its children */
+	for (i = count; i-- > 0; ) {
+		if (all[i].parent) {
+			all[all[i].parent - 1].tree_live_bytes += all[i].tree_live_bytes;
+			all[all[i].parent - 1].tree_live_count += all[i].tree_live_count;
+		}
+	}
+	qsort(order, count, sizeof(cm_tag_stats*), tag_order);
+	/* the children of tag p are order[first[p]] to order[first[p + 1] - 1] */
+	for (i = 0; i < count; ++i)
+		++first[order[i]->parent + 1];
+	for (i = 1; i < count + 2; ++i)
+		first[i] += first[i - 1];
+	stack[0][0] = first[0];
+	stack[0][1] = first[1];
+	while (sp >= 0 && n < max_tags) {
+		if (stack[sp][0] == stack[sp][1]) {
+			--sp;
+			continue;
+		}
+		out[n] = *order[stack[sp][0]++];
+		++sp;
+		stack[sp][0] = first[out[n].id];
+		stack[sp][1] = first[out[n].id + 1];
+		++n;
+	}
+	free(first);
+	free(order);
+	free(all);
+	return n;
+}
+
+uint32_t cm_checkpoint(void)
+{
+	uint32_t epoch = cm_atomic_add_u32(&settings.epoch, 1);
+
+	if (cm_atomic_load_u32(&settings.rss_recording))
+		cm_rss_sample_now(NULL);
+	return epoch;
+}
+
+typedef struct cm_diff_walk {
+	uint32_t epoch_a;
+	uint32_t epoch_b;
+	cm_site_growth* sites; /* by site id - 1 */
+	size_t site_count;
+} cm_diff_walk;
+
+static int diff_add(const cm_alloc_map* rec, void* ctx)
+{
+	cm_diff_walk* w = ctx;
+	cm_site_growth* g;
+
+	/* sites interned after the walk started are left out */
+	if (rec->epoch < w->epoch_a || rec->epoch >= w->epoch_b
+		|| rec->site->id > w->site_count)
+		return 0;
+	g = &w->sites[rec->site->id - 1];
+	g->bytes += rec->weight;
+	g->count += record_blocks(rec);
+	return 0;
+}
+
+size_t cm_diff(uint32_t epoch_a, uint32_t epoch_b, cm_site_growth* out, size_t max_sites)
+{
+	cm_diff_walk w;
+	cm_site_growth g;
+	cm_site* site;
+	size_t i, j, n = 0;
+
+	if (!out && max_sites > 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_diff(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_sites == 0 || !settings.initialized)
+		return 0;
+	w.epoch_a = epoch_a;
+	w.epoch_b = epoch_b;
+	cm_mutex_lock(&settings.sites_lock);
+	w.site_count = settings.sites.count;
+	cm_mutex_unlock(&settings.sites_lock);
+	w.sites = calloc(w.site_count ? w.site_count : 1, sizeof(cm_site_growth));
+	if (!w.sites) {
+		invoke_on_error(CM_ERR_ERROR, "cm_diff(): internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	walk_live(diff_add, &w);
+	cm_mutex_lock(&settings.sites_lock);
+	for (i = 0; i < w.site_count; ++i) {
+		g = w.sites[i];
+		if (g.count == 0)
+			continue;
+		site = settings.sites.by_id[i];
+		g.filename = site->filename;
+		g.line = site->line;
+		/* keep out sorted, only the top max_sites are of interest */
+		if (n == max_sites && g.bytes <= out[n - 1].bytes)
+			continue;
+		j = n < max_sites ? n++ : n - 1;
+		for (; j > 0 && out[j - 1].bytes < g.bytes; --j)
+			out[j] = out[j - 1];
+		out[j] = g;
+	}
+	cm_mutex_unlock(&settings.sites_lock);
+	free(w.sites);
+	return n;
+}
+
+/*------------------------------------------------------------------------------
+	Memory timeline
+------------------------------------------------------------------------------*/
+
+/* Per second rate of a counter that moved by delta in elapsed_ns. */
+static uint32_t timeline_rate(uint32_t delta, uint64_t elapsed_ns)
+{
+	uint64_t rate;
+
+	if ((int32_t)delta <= 0 || elapsed_ns == 0)
+		return 0;
+	rate = (uint64_t)delta * 1000000000ull / elapsed_ns;
+	return rate > UINT32_MAX ? UINT32_MAX : (uint32_t)rate;
+}
+
+static void timeline_main(void* arg)
+{
+	cm_stats prev, cur;
+	cm_timeline_sample s;
+	uint64_t start, last, now;
+	unsigned slept, step;
+
+	(void)arg;
+	sum_thread_stats(&prev);
+	start = last = cm_now_ns();
+	for (;;) {
+		/* short naps so that cm_timeline_stop does not wait a whole interval */
+		for (slept = 0; slept < settings.timeline_interval; slept += step) {
+			if (cm_atomic_load_acquire_u32(&settings.timeline_stop))
+				return;
+			step = settings.timeline_interval - slept;
+			if (step > CM_TIMELINE_NAP_MS)
+				step = CM_TIMELINE_NAP_MS;
+			cm_sleep_ms(step);
+		}
+		sum_thread_stats(&cur);
+		now = cm_now_ns();
+		s.time_ns = now - start;
+		s.live_bytes = (int32_t)cur.live_bytes > 0 ? cur.live_bytes : 0;
+		s.live_blocks = (int32_t)cur.live_blocks > 0 ? cur.live_blocks : 0;
+		s.alloc_rate = timeline_rate(cur.total_allocated - prev.total_allocated,
+									 now - last);
+		s.op_rate = timeline_rate(cur.malloc_count + cur.calloc_count + cur.realloc_count
+								  + cur.free_count - prev.malloc_count - prev.calloc_count
+								  - prev.realloc_count - prev.free_count, now - last);
+		cm_mutex_lock(&settings.timeline_lock);
+		cm_ring_push(&settings.timeline, &s);
+		cm_mutex_unlock(&settings.timeline_lock);
+		prev = cur;
+		last = now;
+	}
+}
+
+int cm_timeline_start(uint32_t interval_ms, size_t max_samples)
+{
+	cm_ring tl;
+
+	if (!settings.initialized || interval_ms == 0 || max_samples == 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_start(): invalid call.");
+		return 0;
+	}
+	cm_timeline_stop();
+	if (!cm_ring_create(&tl, sizeof(cm_timeline_sample), max_samples)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_start(): cannot allocate the samples.");
+		return 0;
+	}
+	cm_mutex_lock(&settings.timeline_lock);
+	cm_ring_destroy(&settings.timeline);
+	settings.timeline = tl;
+	cm_mutex_unlock(&settings.timeline_lock);
+	settings.timeline_interval = interval_ms;
+	settings.timeline_stop = 0;
+	if (!cm_thread_start(&settings.timeline_thread, timeline_main, NULL)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_start(): cannot start the sampler.");
+		return 0;
+	}
+	settings.timeline_running = 1;
+	return 1;
+}
+
+void cm_timeline_stop(void)
+{
+	if (!settings.timeline_running)
+		return;
+	cm_atomic_store_release_u32(&settings.timeline_stop, 1);
+	cm_thread_join(&settings.timeline_thread);
+	settings.timeline_running = 0;
+}
+
+size_t cm_timeline_get(cm_timeline_sample* out, size_t max_samples)
+{
+	size_t n;
+
+	if (!out && max_samples > 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_get(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_samples == 0 || !settings.initialized)
+		return 0;
+	cm_mutex_lock(&settings.timeline_lock);
+	n = cm_ring_copy(&settings.timeline, out, max_samples);
+	cm_mutex_unlock(&settings.timeline_lock);
+	return n;
+}
+
+int cm_timeline_write(FILE* out, int format)
+{
+	cm_timeline_sample* samples;
+	size_t n;
+	int ok;
+
+	if (!out || !settings.initialized) {
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_write(): invalid call.");
+		return 0;
+	}
+	/* copy first, the sampler must not wait for the file */
+	cm_mutex_lock(&settings.timeline_lock);
+	n = settings.timeline.count;
+	samples = malloc((n ? n : 1) * sizeof(cm_timeline_sample));
+	if (samples)
+		n = cm_ring_copy(&settings.timeline, samples, n);
+	cm_mutex_unlock(&settings.timeline_lock);
+	if (!samples) {
+		invoke_on_error(CM_ERR_ERROR, "cm_timeline_write(): internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	ok = cm_timeline_export(out, format, samples, n);
+	free(samples);
+	if (!ok)
+		invoke_on_error(CM_ERR_WARNING, "cm_timeline_write(): cannot write the samples.");
+	return ok;
+}
+
+/*------------------------------------------------------------------------------
+	Resident memory
+------------------------------------------------------------------------------*/
+
+static void rss_main(void* arg)
+{
+	unsigned slept, step;
+
+	(void)arg;
+	for (;;) {
+		for (slept = 0; slept < settings.rss_interval; slept += step) {
+			if (cm_atomic_load_acquire_u32(&settings.rss_stop))
+				return;
+			step = settings.rss_interval - slept;
+			if (step > CM_TIMELINE_NAP_MS)
+				step = CM_TIMELINE_NAP_MS;
+			cm_sleep_ms(step);
+		}
+		cm_rss_sample_now(NULL);
+	}
+}
+
+int cm_rss_start(uint32_t interval_ms, size_t max_samples)
+{
+	cm_ring h;
+	uint64_t rss, anon;
+
+	if (!settings.initialized || max_samples == 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_rss_start(): invalid call.");
+		return 0;
+	}
+	if (!cm_rss_read(&rss, &anon)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_rss_start(): cannot read the resident memory.");
+		return 0;
+	}
+	cm_rss_stop();
+	if (!cm_ring_create(&h, sizeof(cm_rss_sample), max_samples)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_rss_start(): cannot allocate the samples.");
+		return 0;
+	}
+	cm_mutex_lock(&settings.rss_lock);
+	cm_ring_destroy(&settings.rss);
+	settings.rss = h;
+	cm_mutex_unlock(&settings.rss_lock);
+	cm_atomic_store_release_u32(&settings.rss_recording, 1);
+	if (interval_ms == 0)
+		return 1;
+	settings.rss_interval = interval_ms;
+	settings.rss_stop = 0;
+	if (!cm_thread_start(&settings.rss_thread, rss_main, NULL)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_rss_start(): cannot start the sampler.");
+		return 0;
+	}
+	settings.rss_running = 1;
+	return 1;
+}
 
-#include <stdlib.h>
-#include <string.h>
-#include <stdint.h>
-#include <stdarg.h>
+void cm_rss_stop(void)
+{
+	cm_atomic_store_release_u32(&settings.rss_recording, 0);
+	if (!settings.rss_running)
+		return;
+	cm_atomic_store_release_u32(&settings.rss_stop, 1);
+	cm_thread_join(&settings.rss_thread);
+	settings.rss_running = 0;
+}
 
-#include "c4c_linked_list.h"
+int cm_rss_sample_now(cm_rss_sample* out)
+{
+	cm_rss_sample s;
+	cm_stats st;
+	uint64_t rss, anon;
+	double held;
 
-static struct {
-	uint32_t flags;
-	FILE* output;
-	cm_error_fn on_error;
+	if (!settings.initialized || !cm_rss_read(&rss, &anon))
+		return 0;
+	cm_get_stats(&st);
+	s.time_ns = cm_now_ns() - settings.start_ns;
+	s.rss_bytes = rss;
+	s.anon_bytes = anon;
+	s.live_bytes = (int32_t)st.live_bytes > 0 ? st.live_bytes : 0;
+	s.overhead_bytes = st.overhead_bytes;
+	s.epoch = cm_atomic_load_u32(&settings.epoch);
+	held = (double)s.live_bytes + (double)s.overhead_bytes;
+	s.fragmentation = held > 0.0 ? (double)(anon ? anon : rss) / held : 0.0;
+	cm_mutex_lock(&settings.rss_lock);
+	if (cm_atomic_load_u32(&settings.rss_recording))
+		cm_ring_push(&settings.rss, &s);
+	cm_mutex_unlock(&settings.rss_lock);
+	if (out)
+		*out = s;
+	return 1;
+}
 
-	cm_stats info;
+size_t cm_rss_get(cm_rss_sample* out, size_t max_samples)
+{
+	size_t n;
 
-	cm_alloc_map map;
-} settings;
+	if (!out && max_samples > 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_rss_get(): out is an invalid pointer.");
+		return 0;
+	}
+	if (max_samples == 0 || !settings.initialized)
+		return 0;
+	cm_mutex_lock(&settings.rss_lock);
+	n = cm_ring_copy(&settings.rss, out, max_samples);
+	cm_mutex_unlock(&settings.rss_lock);
+	return n;
+}
 
-static const char* get_filename(const char* file)
+/*------------------------------------------------------------------------------
+	Live stats segment
+------------------------------------------------------------------------------*/
+
+/*
+ * Create (or take over) the segment, zeroed but for the fixed header. It
+ * is readable by the user only.
+ */
+static int shm_create(cm_shm_map* map, const char* name)
 {
-#if defined(_WIN32) || defined(__CYGWIN__)
-	return (strrchr(file, '\\') ? strrchr(file, '\\') + 1 : file);
+	cm_shm_segment* seg;
+#if !defined(_WIN32)
+	int fd;
+#endif /* _WIN32 */
+
+	if (strlen(name) >= sizeof(map->name))
+		return 0;
+#if defined(_WIN32)
+	map->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+									  sizeof(cm_shm_segment), name);
+	if (!map->mapping)
+		return 0;
+	seg = MapViewOfFile(map->mapping, FILE_MAP_WRITE, 0, 0, sizeof(cm_shm_segment));
+	if (!seg) {
+		CloseHandle(map->mapping);
+		return 0;
+	}
+#else
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return 0;
+	if (ftruncate(fd, sizeof(cm_shm_segment)) != 0) {
+		close(fd);
+		shm_unlink(name);
+		return 0;
+	}
+	seg = mmap(NULL, sizeof(cm_shm_segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED) {
+		shm_unlink(name);
+		return 0;
+	}
+#endif /* _WIN32 */
+	/* a segment left behind by a dead process of the same pid */
+	memset(seg->magic, 0, sizeof(seg->magic));
+	cm_atomic_fence();
+	memset(seg, 0, sizeof(*seg));
+	seg->version = CM_SHM_VERSION;
+	seg->size = sizeof(cm_shm_segment);
+#if defined(_WIN32)
+	seg->pid = (uint32_t)GetCurrentProcessId();
 #else
-	return (strrchr(file, '/') ? strrchr(file, '/') + 1 : file);
+	seg->pid = (uint32_t)getpid();
 #endif /* _WIN32 */
+	cm_atomic_fence();
+	/* readers check the magic last */
+	memcpy(seg->magic, CM_SHM_MAGIC, sizeof(CM_SHM_MAGIC));
+	map->seg = seg;
+	strcpy(map->name, name);
+	return 1;
 }
 
-static void invoke_on_error(int err, const char* format, ...)
+/* Copy src into the segment, everything after seq. */
+static void shm_write(cm_shm_segment* seg, const cm_shm_segment* src)
 {
-	if (!settings.on_error)
-		return;
+	size_t from = offsetof(cm_shm_segment, seq) + sizeof(seg->seq);
+	uint32_t seq = cm_atomic_load_u32(&seg->seq);
 
-	char buffer[128];
-	va_list vl;
+	cm_atomic_store_u32(&seg->seq, seq + 1);
+	/* readers must see seq odd before any of the new fields */
+	cm_atomic_fence();
+	memcpy((char*)seg + from, (const char*)src + from, sizeof(*seg) - from);
+	cm_atomic_store_release_u32(&seg->seq, seq + 2);
+}
 
-	va_start(vl, format);
-	vsprintf(buffer, format, vl);
-	va_end(vl);
+/*
+ * Gather everything into shm_next first, taking the locks the counters
+ * need, so that seq is odd only for the time of a memcpy: readers spin
+ * meanwhile.
+ */
+static void shm_update(void)
+{
+	cm_shm_segment* next = &settings.shm_next;
+	cm_stats st;
+	cm_site_stats sites[CM_SHM_TOP_SITES];
+	cm_size_bucket classes[CM_SHM_CLASSES];
+	uint64_t rss, anon;
+	size_t i, n;
 
-	settings.on_error(err, buffer);
+	cm_get_stats(&st);
+	++next->updates;
+	next->time_ns = cm_now_ns() - settings.start_ns;
+	next->rss_bytes = cm_rss_read(&rss, &anon) ? rss : 0;
+	next->interval_ms = settings.shm_interval;
+	next->total_allocated = st.total_allocated;
+	next->total_freed = st.total_freed;
+	next->malloc_count = st.malloc_count;
+	next->free_count = st.free_count;
+	next->calloc_count = st.calloc_count;
+	next->realloc_count = st.realloc_count;
+	next->overhead_bytes = st.overhead_bytes;
+	next->dropped_events = st.dropped_events;
+	next->live_bytes = st.live_bytes;
+	next->live_blocks = st.live_blocks;
+	next->peak_bytes = st.peak_bytes;
+	next->epoch = cm_atomic_load_u32(&settings.epoch);
+	n = cm_get_site_stats(sites, CM_SHM_TOP_SITES, CM_SITE_LIVE_BYTES);
+	for (i = 0; i < n; ++i) {
+		snprintf(next->sites[i].file, sizeof(next->sites[i].file), "%s",
+				 cm_basename(sites[i].filename));
+		next->sites[i].line = (uint32_t)sites[i].line;
+		next->sites[i].live_bytes = sites[i].live_bytes;
+		next->sites[i].live_count = sites[i].live_count;
+		next->sites[i].alloc_count = sites[i].alloc_count;
+		next->sites[i].alloc_bytes = sites[i].alloc_bytes;
+		next->sites[i].free_count = sites[i].free_count;
+		next->sites[i].peak_bytes = sites[i].peak_bytes;
+	}
+	next->site_count = (uint32_t)n;
+	n = cm_get_size_histogram(classes, CM_SHM_CLASSES);
+	for (i = 0; i < n; ++i) {
+		next->classes[i].min_size = classes[i].min_size;
+		next->classes[i].max_size = classes[i].max_size;
+		next->classes[i].allocs = classes[i].allocs;
+		next->classes[i].frees = classes[i].frees;
+		next->classes[i].reallocs = classes[i].reallocs;
+	}
+	next->class_count = (uint32_t)n;
+	shm_write(settings.shm.seg, next);
 }
 
-#define notify(err, format, ...) \
-	invoke_on_error(err, "[%s:%d] " format, get_filename(filename), line, __VA_ARGS__)
-
-static int is_flag_set(uint32_t flag)
+static void shm_main(void* arg)
 {
-	return settings.flags & flag;
+	unsigned slept, step;
+
+	(void)arg;
+	for (;;) {
+		for (slept = 0; slept < settings.shm_interval; slept += step) {
+			if (cm_atomic_load_acquire_u32(&settings.shm_stop))
+				return;
+			step = settings.shm_interval - slept;
+			if (step > CM_TIMELINE_NAP_MS)
+				step = CM_TIMELINE_NAP_MS;
+			cm_sleep_ms(step);
+		}
+		shm_update();
+	}
 }
 
-int cm_init(FILE* output, cm_error_fn on_error, uint32_t flags)
+int cm_shm_publish(const char* name, uint32_t interval_ms)
 {
-	settings.output = output;
-	settings.on_error = on_error;
-	settings.flags = flags;
-	if (!output) {
-		invoke_on_error(CM_ERR_WARNING,
-						"cm_init(): cmonitor doesn't have a valid file output.");
+	char def[64];
+
+	if (!settings.initialized || interval_ms == 0) {
+		invoke_on_error(CM_ERR_WARNING, "cm_shm_publish(): invalid call.");
+		return 0;
+	}
+	cm_shm_unpublish();
+	if (!name) {
+#if defined(_WIN32)
+		cm_shm_default_name(def, sizeof(def), (unsigned long)GetCurrentProcessId());
+#else
+		cm_shm_default_name(def, sizeof(def), (unsigned long)getpid());
+#endif /* _WIN32 */
+		name = def;
+	}
+	if (!shm_create(&settings.shm, name)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_shm_publish(): cannot create the segment.");
+		return 0;
+	}
+	memset(&settings.shm_next, 0, sizeof(settings.shm_next));
+	settings.shm_interval = interval_ms;
+	settings.shm_stop = 0;
+	/* readers attaching right away find numbers */
+	shm_update();
+	if (!cm_thread_start(&settings.shm_thread, shm_main, NULL)) {
+		invoke_on_error(CM_ERR_WARNING, "cm_shm_publish(): cannot start the publisher.");
+		cm_shm_close(&settings.shm, 1);
 		return 0;
 	}
-	settings.map.block = NULL;
-	settings.map.size = 0;
-	cm_map_init(&settings.map);
-	memset(&settings.info, 0, sizeof(cm_stats));
 	return 1;
 }
 
-void cm_print_stats(void)
+void cm_shm_unpublish(void)
 {
-	const char* msg =
-		"\n /=========================\\\n"
-		" |===    Quick Stats    ===|\n"
-		" |=========================|\n"
-		" |total alloc:      %.7d|\n"
-		" |total free:       %.7d|\n"
-		" |-------------------------|\n"
-		" |total leaks:      %.7d|\n"
-		" |                         |\n"
-		" |total malloc():   %.7d|\n"
-		" |total calloc():   %.7d|\n"
-		" |-------------------------|\n"
-		" |total free():     %.7d|\n"
-		" |                         |\n"
-		" |total realloc():  %.7d|\n"
-		" \\=========================/\n\n";
+	if (!settings.shm.seg)
+		return;
+	cm_atomic_store_release_u32(&settings.shm_stop, 1);
+	cm_thread_join(&settings.shm_thread);
+	cm_shm_close(&settings.shm, 1);
+}
 
-	fprintf(settings.output, msg,
-			settings.info.total_allocated,
-			settings.info.total_freed,
-			/*-------------------------*/
-			settings.info.total_allocated - settings.info.total_freed,
-			/*                         */
-			settings.info.malloc_count,
-			settings.info.calloc_count,
-			/*-------------------------*/
-			settings.info.free_count,
-			/*                         */
-			settings.info.realloc_count
-	);
+/*------------------------------------------------------------------------------
+	Counters only (CM_LEVEL_COUNTERS, CM_LEVEL_SITES)
+------------------------------------------------------------------------------*/
+
+static cm_site* site_from(cm_site_desc* desc, const char* filename, int line)
+{
+	return desc ? site_of_desc(desc) : site_of(filename, line);
 }
 
-void cm_get_stats(cm_stats* out)
+/* the counters level itself is inline in counters.h */
+
+void* cm_malloc_count_(size_t size)
 {
-	if (!out) {
-		invoke_on_error(CM_ERR_WARNING,
-						"cm_get_stats(): out is an invalid pointer.");
-		return;
-	}
-	out->total_allocated = settings.info.total_allocated;
-	out->total_freed = settings.info.total_freed;
-	out->malloc_count = settings.info.malloc_count;
-	out->free_count = settings.info.free_count;
-	out->calloc_count = settings.info.calloc_count;
-	out->realloc_count = settings.info.realloc_count;
+	return cm_malloc_inline_(size);
 }
 
-void cm_get_leaks(cm_leak_info*** out_array, size_t* out_leaks_count)
+void cm_free_count_(void* mem)
 {
-	size_t delta, i;
-	cm_alloc_map* il;
-	cm_leak_info* leak;
+	cm_free_inline_(mem);
+}
 
-	if (!out_leaks_count) {
-		invoke_on_error(CM_ERR_WARNING,
-						"cm_get_leaks(): out_leaks_count is an invalid pointer.");
-		*out_array = NULL;
-		return;
-	}
-	delta = settings.info.malloc_count + settings.info.calloc_count
-		- settings.info.free_count;
-	if (delta == 0)
-		goto zero_all;
-	*out_array = malloc(sizeof(cm_leak_info*) * delta);
-	if (!*out_array) {
-		invoke_on_error(CM_ERR_ERROR,
-						"cm_get_leaks(): internal malloc failed.");
-		exit(EXIT_FAILURE);
-	}
-	i = 0;
-	c4c_list_foreach(&settings.map, il) {
-		leak = malloc(sizeof(cm_leak_info));
-		if (!leak) {
-			invoke_on_error(CM_ERR_ERROR,
-							"cm_get_leaks(): internal malloc failed.");
-			free(*out_array);
-			goto zero_all;
-		}
-		leak->filename = il->filename;
-		leak->line = il->line;
-		leak->bytes = il->size;
-		leak->address = il->block;
-		(*out_array)[i] = leak;
-		++i;
-	}
-	*out_leaks_count = delta;
-	return;
+void* cm_calloc_count_(size_t num, size_t size)
+{
+	return cm_calloc_inline_(num, size);
+}
 
-zero_all:
-	*out_array = NULL;
-	*out_leaks_count = 0;
+void* cm_realloc_count_(void* mem, size_t size)
+{
+	return cm_realloc_inline_(mem, size);
 }
 
-void cm_free_leaks_info(cm_leak_info** leak_array, size_t size)
+cm_thread_counters* cm_thread_counters_(void)
 {
-	size_t i;
+	if (!tracks(CM_LEVEL_COUNTERS))
+		return NULL;
+	return &current_thread()->counters;
+}
 
-	if (!leak_array || size == 0)
-		return;
-	for (i = 0; i < size; ++i) {
-		free(leak_array[i]);
+void cm_flush_live_(void)
+{
+	flush_live(current_thread());
+}
+
+void* cm_malloc_site_(size_t size, cm_site_desc* desc, const char* filename, int line)
+{
+	void* mem = cm_malloc_inline_(size);
+
+	if (tracks(CM_LEVEL_SITES) && mem)
+		cm_site_on_count(site_from(desc, filename, line), size,
+						 is_flag_set(CM_TRACK_THREAD_SAFE));
+	return mem;
+}
+
+void* cm_calloc_site_(size_t num, size_t size, cm_site_desc* desc,
+					  const char* filename, int line)
+{
+	void* mem = cm_calloc_inline_(num, size);
+
+	if (tracks(CM_LEVEL_SITES) && mem)
+		cm_site_on_count(site_from(desc, filename, line), num * size,
+						 is_flag_set(CM_TRACK_THREAD_SAFE));
+	return mem;
+}
+
+void* cm_realloc_site_(void* mem, size_t size, cm_site_desc* desc,
+					   const char* filename, int line)
+{
+	void* new_mem = cm_realloc_inline_(mem, size);
+
+	/* as with records, a resized block still belongs to its first site */
+	if (tracks(CM_LEVEL_SITES) && new_mem && !mem)
+		cm_site_on_count(site_from(desc, filename, line), size,
+						 is_flag_set(CM_TRACK_THREAD_SAFE));
+	return new_mem;
+}
+
+/*------------------------------------------------------------------------------
+	Allocation functions
+------------------------------------------------------------------------------*/
+
+/*
+ * The C allocator failed on the user's block: end the program as cm_malloc
+ * always has or, with settings.fail_null, fail as malloc does.
+ */
+static void* out_of_memory(const char* filename, int line, const char* what)
+{
+	if (settings.fail_null) {
+		errno = ENOMEM;
+		return NULL;
 	}
-	free(leak_array);
-	*leak_array = NULL;
+	notify(CM_ERR_ERROR, "%s failed.", what);
+	exit(EXIT_FAILURE);
 }
 
-void* cm_malloc_(size_t size, const char* filename, int line, int is_realloc)
+static void* malloc_at(cm_thread_info* t, cm_site* site, size_t size, int is_realloc,
+					   void* frame)
 {
 	void* mem;
 	cm_alloc_map* node;
+	cm_event ev;
+	size_t weight;
+	const char* filename = site->filename;
+	int line = site->line;
 
 	/* alloc new node */
 	if (size == 0 && is_flag_set(CM_SIGNAL_ON_MALLOC_SIZE_ZERO))
 		notify(CM_ERR_UB, "malloc called with 'size' zero. Undefined behavior.");
-	node = malloc(sizeof(cm_alloc_map));
-	if (!node) {
-		notify(CM_ERR_ERROR, "internal malloc failed.");
-		exit(EXIT_FAILURE);
-	}
-	mem = malloc(size);
-	if (!mem) {
-		/* check if realloc is calling malloc */
-		if (is_realloc)
-			notify(CM_ERR_ERROR, "(realloc) malloc failed.");
-		else
-			notify(CM_ERR_ERROR, "malloc failed.");
-		exit(EXIT_FAILURE);
+	if (!sample(size, &weight)) {
+		mem = malloc(size);
+		if (!mem)
+			return out_of_memory(filename, line, is_realloc ? "(realloc) malloc" : "malloc");
+		count_allocated(t, size);
+		count(t, malloc_count, 1);
+		count(t, live_blocks, 1);
+		count_size(t, allocs, size, 1);
+		return mem;
 	}
+	node = alloc_record(size, 0);
+	/* check if realloc is calling malloc */
+	if (!node)
+		return out_of_memory(filename, line, is_realloc ? "(realloc) malloc" : "malloc");
+	mem = node->block;
 	/* intialize new node */
-	node->block = mem;
 	node->size = size;
-	node->filename = filename;
-	node->line = line;
+	node->weight = weight;
+	node->site = site;
+	node->stack_id = capture_stack(frame);
+	stamp_record(t, node);
+	if (!index_insert(node)) {
+		unstamp_record(t, node);
+		free_record(node);
+		return out_of_memory(filename, line, "internal malloc");
+	}
 	/* update stats */
-	settings.info.total_allocated += size;
-	++settings.info.malloc_count;
-	cm_map_add(&settings.map, node);
+	count_allocated(t, size);
+	count(t, malloc_count, 1);
+	count(t, live_blocks, 1);
+	count_size(t, allocs, size, 1);
+	cm_site_on_alloc(site, weight, record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
 	/* report allocation to output */
-	if (is_realloc)
-		fprintf(settings.output, "[%s:%d] <%p> <realloc> malloc(%d)\n",
-				get_filename(filename), line, mem, size);
-	else
-		fprintf(settings.output, "[%s:%d] <%p> malloc(%d)\n",
-				get_filename(filename), line, mem, size);
+	ev.type = is_realloc ? CM_EV_REALLOC_MALLOC : CM_EV_MALLOC;
+	ev.filename = site->basename;
+	ev.site = site->id;
+	ev.line = line;
+	ev.address = mem;
+	ev.size = size;
+	ev.arg1 = ev.arg2 = 0;
+	ev.old_address = NULL;
+	log_event(t, &ev);
 	return mem;
 }
 
-void cm_free_(void* mem, const char* filename, int line)
+static void free_at(cm_thread_info* t, cm_site* site, void* mem)
 {
 	cm_alloc_map* i;
+	cm_block_header* hdr;
+	cm_event ev;
+	const char* filename = site->filename;
+	int line = site->line;
 
-	settings.info.free_count++;
-	c4c_list_foreach(&settings.map, i) {
-		if (i->block == mem) {
-			settings.info.total_freed += i->size;
-			fprintf(settings.output, "[%s:%d] <%p> free(%d)\n",
-					get_filename(filename), line, i->block, i->size);
-			break;
-		}
+	count(t, free_count, 1);
+	if (is_flag_set(CM_TRACK_INLINE_HEADER)) {
+		/* a block without a valid header can't be ours */
+		hdr = find_header(mem);
+		i = hdr ? index_remove_header(hdr) : NULL;
+	} else {
+		i = index_remove(mem);
 	}
-	if (i != &settings.map) {
-		cm_map_delete(i);
-		free(i);
-		free(mem);
+	if (i) {
+		count_freed(t, i->weight);
+		count(t, live_blocks, (uint32_t)0 - record_blocks(i));
+		count_size(t, frees, i->size, record_blocks(i));
+		/* freed blocks count against the site that allocated them */
+		cm_site_on_free(i->site, i->weight, record_blocks(i),
+						is_flag_set(CM_TRACK_THREAD_SAFE));
+		count_thread_free(t, i);
+		count_tag_free(i);
+		count_lifetime(i);
+		ev.type = CM_EV_FREE;
+		ev.filename = site->basename;
+		ev.site = site->id;
+		ev.line = line;
+		ev.address = i->block;
+		ev.size = i->size;
+		ev.arg1 = ev.arg2 = 0;
+		ev.old_address = NULL;
+		log_event(t, &ev);
+		free_record(i);
 		return;
 	}
 	if (is_flag_set(CM_SIGNAL_ON_FREEING_NULL)) {
@@ -269,77 +2967,331 @@ void cm_free_(void* mem, const char* filename, int line)
 			return;
 		}
 	}
+	/* blocks not sampled, or not allocated through us, have no record */
+	if (is_flag_set(CM_TRACK_SAMPLED) || settings.free_unknown) {
+		free(mem);
+		return;
+	}
 	if (is_flag_set(CM_SIGNAL_ON_FREEING_UNKNOWN)) {
 		notify(CM_ERR_WARNING, "attempt to free an unkwnown memory block.");
 	}
 }
 
-void* cm_calloc_(size_t num, size_t size, const char* filename, int line)
+static void* calloc_at(cm_thread_info* t, cm_site* site, size_t num, size_t size,
+					   void* frame)
 {
 	void* mem;
 	cm_alloc_map* node;
+	cm_event ev;
+	size_t weight;
+	const char* filename = site->filename;
+	int line = site->line;
 
 	if (size == 0 && is_flag_set(CM_SIGNAL_ON_CALLOC_SIZE_ZERO))
 		notify(CM_ERR_UB, "calloc called with param 'size' invalid value.");
-	/* alloc new node */
-	node = malloc(sizeof(cm_alloc_map));
-	if (!node) {
-		notify(CM_ERR_ERROR, "internal malloc failed.");
-		exit(EXIT_FAILURE);
-	}
-	mem = calloc(num, size);
-	if (!mem) {
-		notify(CM_ERR_ERROR, "calloc failed.");
-		exit(EXIT_FAILURE);
+	if (size != 0 && num > SIZE_MAX / size)
+		return out_of_memory(filename, line, "calloc");
+	if (!sample(num * size, &weight)) {
+		mem = calloc(num, size);
+		if (!mem)
+			return out_of_memory(filename, line, "calloc");
+		count_allocated(t, num * size);
+		count(t, calloc_count, 1);
+		count(t, live_blocks, 1);
+		count_size(t, allocs, num * size, 1);
+		return mem;
 	}
+	/* alloc new node */
+	node = alloc_record(num * size, 1);
+	if (!node)
+		return out_of_memory(filename, line, "calloc");
+	mem = node->block;
 	/* intialize new node */
-	node->block = mem;
 	node->size = num * size;
-	node->filename = filename;
-	node->line = line;
+	node->weight = weight;
+	node->site = site;
+	node->stack_id = capture_stack(frame);
+	stamp_record(t, node);
+	if (!index_insert(node)) {
+		unstamp_record(t, node);
+		free_record(node);
+		return out_of_memory(filename, line, "internal malloc");
+	}
 	/* update stats */
-	settings.info.total_allocated += num * size;
-	++settings.info.calloc_count;
-	cm_map_add(&settings.map, node);
+	count_allocated(t, num * size);
+	count(t, calloc_count, 1);
+	count(t, live_blocks, 1);
+	count_size(t, allocs, num * size, 1);
+	cm_site_on_alloc(site, weight, record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
 	/* report allocation to output */
-	fprintf(settings.output, "[%s:%d] <%p> calloc(%d, %d) | total: %d\n",
-			get_filename(filename), line, mem, num, size, num * size);
+	ev.type = CM_EV_CALLOC;
+	ev.filename = site->basename;
+	ev.site = site->id;
+	ev.line = line;
+	ev.address = mem;
+	ev.size = num * size;
+	ev.arg1 = num;
+	ev.arg2 = size;
+	ev.old_address = NULL;
+	log_event(t, &ev);
 	return mem;
 }
 
-void* cm_realloc_(void* mem, size_t size, const char* filename, int line)
+/*
+ * realloc with CM_TRACK_SAMPLED. The old size of a block without a record
+ * isn't known, so a realloc counts as a free of the old block and a malloc
+ * of the new one, sampled again.
+ */
+static void* realloc_sampled(cm_thread_info* t, cm_site* site, void* mem, size_t size,
+							 void* frame)
+{
+	void* new_mem;
+	cm_alloc_map* node;
+	cm_event ev;
+	size_t old_size = 0, weight;
+	int tracked;
+	const char* filename = site->filename;
+	int line = site->line;
+
+	node = index_remove(mem);
+	ev.old_address = mem;
+	new_mem = realloc(mem, size);
+	if (!new_mem) {
+		/* the old block is still there, and so is its record */
+		if (node && !index_insert(node)) {
+			notify(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+		return out_of_memory(filename, line, "realloc");
+	}
+	count_allocated(t, size);
+	count(t, realloc_count, 1);
+	tracked = node != NULL;
+	if (node) {
+		old_size = node->size;
+		count_freed(t, node->weight);
+		count_size(t, reallocs, size > old_size ? size - old_size : old_size - size,
+				   record_blocks(node));
+		cm_site_on_free(node->site, node->weight, record_blocks(node),
+						is_flag_set(CM_TRACK_THREAD_SAFE));
+		release_record(t, node, (uint32_t)node->weight);
+		count_tag_free(node);
+	}
+	if (sample(size, &weight)) {
+		if (!node)
+			node = cm_slab_alloc(&settings.records, &records_magazine);
+		if (!node) {
+			notify(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+		node->block = new_mem;
+		node->size = size;
+		node->weight = weight;
+		node->site = site;
+		node->flags = 0;
+		node->stack_id = capture_stack(frame);
+		if (tracked) {
+			/*
+			 * A block sampled again keeps its realloc chain, thread, tag,
+			 * epoch and age: its thread takes back the new weight.
+			 */
+			release_record(t, node, (uint32_t)0 - (uint32_t)weight);
+			if (node->tag) {
+				cm_tag_on_alloc(cm_tag_get(&settings.tags, node->tag), weight,
+								record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+			}
+			count_realloc(site, node, old_size, new_mem != mem);
+		} else {
+			stamp_record(t, node);
+		}
+		if (!index_insert(node)) {
+			notify(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+		cm_site_on_alloc(site, weight, record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+		tracked = 1;
+	} else if (node) {
+		/* the block drops out of the sample, as if freed */
+		count_lifetime(node);
+		cm_slab_free(&settings.records, &records_magazine, node);
+	}
+	if (!tracked)
+		return new_mem;
+	/* report reallocation to output */
+	ev.type = CM_EV_REALLOC;
+	ev.filename = site->basename;
+	ev.site = site->id;
+	ev.line = line;
+	ev.address = new_mem;
+	ev.size = size;
+	ev.arg1 = old_size;
+	ev.arg2 = 0;
+	log_event(t, &ev);
+	return new_mem;
+}
+
+static void* realloc_at(cm_thread_info* t, cm_site* site, void* mem, size_t size,
+						void* frame)
 {
 	void* new_mem;
 	cm_alloc_map* node;
+	cm_alloc_map* new_node;
+	cm_block_header* hdr;
+	cm_event ev;
 	size_t old_size = 0;
-	int found = 0;
+	const char* filename = site->filename;
+	int line = site->line;
 
 	if (!mem)
-		return cm_malloc_(size, filename, line, 1);
+		return malloc_at(t, site, size, 1, frame);
 	if (size == 0 && is_flag_set(CM_SIGNAL_ON_REALLOC_SIZE_ZERO))
 		notify(CM_ERR_UB, "realloc called with 'size' zero. Undefined behavior.");
-	new_mem = realloc(mem, size);
-	if (!new_mem) {
-		notify(CM_ERR_ERROR, "realloc failed.");
-		exit(EXIT_FAILURE);
+	if (is_flag_set(CM_TRACK_SAMPLED))
+		return realloc_sampled(t, site, mem, size, frame);
+	/* the block may move, take it out of the index while it is still valid */
+	if (is_flag_set(CM_TRACK_INLINE_HEADER)) {
+		hdr = find_header(mem);
+		node = hdr ? index_remove_header(hdr) : NULL;
+	} else {
+		node = index_remove(mem);
 	}
-	/* update memory */
-	c4c_list_foreach(&settings.map, node) {
-		if (node->block == mem) {
-			node->block = new_mem;
-			old_size = node->size;
-			node->size = size;
-			found = 1;
-			break;
+	if (node) {
+		old_size = node->size;
+		new_node = realloc_record(node, size);
+		/* on failure the old block and its record are left as they were */
+		if (!new_node && !index_insert(node)) {
+			notify(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
 		}
+		node = new_node;
+		new_mem = node ? node->block : NULL;
+	} else {
+		new_mem = realloc(mem, size);
 	}
-	if (!found && is_flag_set(CM_SIGNAL_ON_REALLOC_UNKNOWN))
+	if (!new_mem)
+		return out_of_memory(filename, line, "realloc");
+	/* update memory */
+	if (node) {
+		count_size(t, reallocs, size > old_size ? size - old_size : old_size - size, 1);
+		node->size = size;
+		node->weight = size;
+		/* the block still belongs to the site and the thread that allocated it */
+		cm_site_on_resize(node->site, old_size, size, is_flag_set(CM_TRACK_THREAD_SAFE));
+		release_record(t, node, (uint32_t)old_size - (uint32_t)size);
+		if (node->tag) {
+			cm_tag_on_resize(cm_tag_get(&settings.tags, node->tag), old_size, size,
+							 is_flag_set(CM_TRACK_THREAD_SAFE));
+		}
+		count_realloc(site, node, old_size, new_mem != mem);
+		if (!index_insert(node)) {
+			notify(CM_ERR_ERROR, "internal malloc failed.");
+			exit(EXIT_FAILURE);
+		}
+	} else if (is_flag_set(CM_SIGNAL_ON_REALLOC_UNKNOWN)) {
 		notify(CM_ERR_WARNING, "reallocated unknown memory block.");
+	}
 	/* update stats */
-	settings.info.total_allocated += (size - old_size);
-	++settings.info.realloc_count;
+	count_allocated(t, size - old_size);
+	count(t, realloc_count, 1);
 	/* report reallocation to output */
-	fprintf(settings.output, "[%s:%d] <%p> realloc(from: %d, to: %d) | diff: %d\n",
-			get_filename(filename), line, new_mem, old_size, size, size - old_size);
+	ev.type = CM_EV_REALLOC;
+	ev.filename = site->basename;
+	ev.site = site->id;
+	ev.line = line;
+	ev.address = new_mem;
+	ev.old_address = mem;
+	ev.size = size;
+	ev.arg1 = old_size;
+	ev.arg2 = 0;
+	log_event(t, &ev);
 	return new_mem;
 }
+
+/*
+ * The entry points take their own frame address so the stacks captured
+ * start at the user's call, whatever got inlined below them.
+ */
+
+void* cm_malloc_(size_t size, const char* filename, int line, int is_realloc)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_malloc_site_(size, NULL, filename, line);
+	t = current_thread();
+	return malloc_at(t, site_of(filename, line), size, is_realloc, CM_FRAME_ADDRESS());
+}
+
+void cm_free_(void* mem, const char* filename, int line)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS)) {
+		cm_free_count_(mem);
+		return;
+	}
+	t = current_thread();
+	free_at(t, site_of(filename, line), mem);
+}
+
+void* cm_calloc_(size_t num, size_t size, const char* filename, int line)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_calloc_site_(num, size, NULL, filename, line);
+	t = current_thread();
+	return calloc_at(t, site_of(filename, line), num, size, CM_FRAME_ADDRESS());
+}
+
+void* cm_realloc_(void* mem, size_t size, const char* filename, int line)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_realloc_site_(mem, size, NULL, filename, line);
+	t = current_thread();
+	return realloc_at(t, site_of(filename, line), mem, size, CM_FRAME_ADDRESS());
+}
+
+void* cm_malloc_at_(size_t size, cm_site_desc* desc)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_malloc_site_(size, desc, NULL, 0);
+	t = current_thread();
+	return malloc_at(t, site_of_desc(desc), size, 0, CM_FRAME_ADDRESS());
+}
+
+void cm_free_at_(void* mem, cm_site_desc* desc)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS)) {
+		cm_free_count_(mem);
+		return;
+	}
+	t = current_thread();
+	free_at(t, site_of_desc(desc), mem);
+}
+
+void* cm_calloc_at_(size_t num, size_t size, cm_site_desc* desc)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_calloc_site_(num, size, desc, NULL, 0);
+	t = current_thread();
+	return calloc_at(t, site_of_desc(desc), num, size, CM_FRAME_ADDRESS());
+}
+
+void* cm_realloc_at_(void* mem, size_t size, cm_site_desc* desc)
+{
+	cm_thread_info* t;
+
+	if (!tracks(CM_LEVEL_RECORDS))
+		return cm_realloc_site_(mem, size, desc, NULL, 0);
+	t = current_thread();
+	return realloc_at(t, site_of_desc(desc), mem, size, CM_FRAME_ADDRESS());
+}
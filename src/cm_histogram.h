@@ -0,0 +1,77 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Bounds of the log-linear size classes of cm_size_class_ (counters.h),
+ * which the per-thread histograms of cm_thread_counters are kept by.
+ *
+ * Every power of two is split into CM_SIZE_CLASS_SUB classes of equal width:
+ * 4-7 has four classes of one byte, 64-127 four of sixteen bytes and so on,
+ * so the relative error of a class stays under 25% whatever the size.
+ * Sizes under CM_SIZE_CLASS_SUB get a class each.
+ *
+ * The histograms are written only by their thread, without atomic
+ * read-modify-write, and summed up by the readers.
+ */
+
+#ifndef CMONITOR_CM_HISTOGRAM_H
+#define CMONITOR_CM_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cmonitor/cm.h"
+#include "cmonitor/counters.h"
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static size_t cm_size_class_min(size_t c);
+static size_t cm_size_class_max(size_t c);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+/* Smallest size in class c. */
+static size_t cm_size_class_min(size_t c)
+{
+	unsigned e;
+
+	if (c < CM_SIZE_CLASS_SUB)
+		return c;
+	e = (unsigned)(c / CM_SIZE_CLASS_SUB) + CM_SIZE_CLASS_BITS - 1;
+	return (CM_SIZE_CLASS_SUB + (c & (CM_SIZE_CLASS_SUB - 1))) << (e - CM_SIZE_CLASS_BITS);
+}
+
+/* Largest size in class c. */
+static size_t cm_size_class_max(size_t c)
+{
+	if (c + 1 >= CM_SIZE_CLASSES || cm_size_class_min(c + 1) == 0)
+		return SIZE_MAX;
+	return cm_size_class_min(c + 1) - 1;
+}
+
+#endif /* CMONITOR_CM_HISTOGRAM_H */
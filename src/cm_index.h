@@ -0,0 +1,303 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Open-addressing hash index of the live memory blocks, keyed by block
+ * address.
+ *
+ * Linear probing with tombstone deletion. When the table gets too crowded a
+ * new table is allocated and the old one is migrated a few slots at a time
+ * on every following insert/remove, so no single operation pays for a full
+ * rehash. Until the migration is done lookups check both tables.
+ */
+
+#ifndef CMONITOR_CM_INDEX_H
+#define CMONITOR_CM_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cm_site.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_alloc_map {
+	void* block;
+	size_t size;
+	size_t weight;     /* estimated bytes it stands for, see CM_TRACK_SAMPLED */
+	cm_site* site;     /* where the block was allocated */
+	uint16_t flags;
+	uint16_t tag;      /* innermost tag of the allocation, 0 if none */
+	uint32_t stack_id; /* call stack of the allocation, 0 if none */
+	uint32_t epoch;    /* cm_checkpoint epoch of the allocation */
+	uint32_t reallocs; /* length of the realloc chain so far */
+	uint32_t thread;   /* id of the allocating thread, see cm_thread_id */
+	uint64_t copied;   /* bytes copied by the moves of the chain */
+	uint64_t born;     /* clock ticks at the allocation, see CM_TRACK_LIFETIMES */
+} cm_alloc_map;
+
+/* The record lives in a header right before block (CM_TRACK_INLINE_HEADER). */
+#define CM_REC_INLINE 0x0001
+
+typedef struct cm_index_slot {
+	uintptr_t key;
+	cm_alloc_map* rec;
+} cm_index_slot;
+
+typedef struct cm_index {
+	cm_index_slot* slots;     /* current table */
+	size_t capacity;          /* always a power of two (or zero) */
+	size_t live;              /* live entries in both tables */
+	size_t used;              /* live + tombstones in the current table */
+
+	cm_index_slot* old_slots; /* table being migrated, NULL if none */
+	size_t old_capacity;
+	size_t migrate_pos;       /* next old slot to migrate */
+} cm_index;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_INDEX_EMPTY        ((uintptr_t)0)
+#define CM_INDEX_TOMBSTONE    ((uintptr_t)1)
+
+#define CM_INDEX_MIN_CAPACITY 64
+
+/* old slots moved to the new table per insert/remove during a resize */
+#define CM_INDEX_MIGRATE_STEP 16
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void          cm_index_init   (cm_index* idx);
+static void          cm_index_destroy(cm_index* idx);
+static int           cm_index_insert (cm_index* idx, cm_alloc_map* rec);
+static cm_alloc_map* cm_index_remove (cm_index* idx, const void* block);
+static size_t        cm_index_count  (const cm_index* idx);
+static size_t        cm_index_overhead(const cm_index* idx);
+static cm_alloc_map* cm_index_next   (const cm_index* idx, size_t* cursor);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static uint64_t cm_index_hash(uintptr_t key)
+{
+	uint64_t h = (uint64_t)key;
+
+	/* murmur3 finalizer: malloc'd addresses share their low bits */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+static int cm_index_is_live(uintptr_t key)
+{
+	return key != CM_INDEX_EMPTY && key != CM_INDEX_TOMBSTONE;
+}
+
+static void cm_index_init(cm_index* idx)
+{
+	idx->slots = NULL;
+	idx->capacity = 0;
+	idx->live = 0;
+	idx->used = 0;
+	idx->old_slots = NULL;
+	idx->old_capacity = 0;
+	idx->migrate_pos = 0;
+}
+
+static void cm_index_destroy(cm_index* idx)
+{
+	free(idx->slots);
+	free(idx->old_slots);
+	cm_index_init(idx);
+}
+
+/* Put key into a table known not to contain it. */
+static void cm_index_place(cm_index_slot* slots, size_t capacity,
+						   uintptr_t key, cm_alloc_map* rec)
+{
+	size_t mask = capacity - 1;
+	size_t pos = (size_t)cm_index_hash(key) & mask;
+
+	while (cm_index_is_live(slots[pos].key))
+		pos = (pos + 1) & mask;
+	slots[pos].key = key;
+	slots[pos].rec = rec;
+}
+
+static cm_index_slot* cm_index_probe(cm_index_slot* slots, size_t capacity,
+									 uintptr_t key)
+{
+	size_t mask, pos;
+
+	if (!slots)
+		return NULL;
+	mask = capacity - 1;
+	pos = (size_t)cm_index_hash(key) & mask;
+	while (slots[pos].key != CM_INDEX_EMPTY) {
+		if (slots[pos].key == key)
+			return &slots[pos];
+		pos = (pos + 1) & mask;
+	}
+	return NULL;
+}
+
+static void cm_index_migrate(cm_index* idx, size_t steps)
+{
+	cm_index_slot* s;
+
+	if (!idx->old_slots)
+		return;
+	while (steps-- > 0 && idx->migrate_pos < idx->old_capacity) {
+		s = &idx->old_slots[idx->migrate_pos++];
+		if (cm_index_is_live(s->key)) {
+			cm_index_place(idx->slots, idx->capacity, s->key, s->rec);
+			++idx->used;
+			/* keep the probe chains of the old table intact */
+			s->key = CM_INDEX_TOMBSTONE;
+			s->rec = NULL;
+		}
+	}
+	if (idx->migrate_pos == idx->old_capacity) {
+		free(idx->old_slots);
+		idx->old_slots = NULL;
+		idx->old_capacity = 0;
+		idx->migrate_pos = 0;
+	}
+}
+
+/*
+ * Replace the current table with a fresh one and start migrating. The new
+ * table is doubled only if live entries fill more than half of the current
+ * one, otherwise it just gets rid of the tombstones.
+ */
+static int cm_index_start_resize(cm_index* idx)
+{
+	cm_index_slot* slots;
+	size_t capacity = idx->capacity;
+
+	/* never stack two migrations */
+	if (idx->old_slots)
+		cm_index_migrate(idx, idx->old_capacity);
+	if (capacity == 0)
+		capacity = CM_INDEX_MIN_CAPACITY;
+	else if (idx->live * 2 >= capacity)
+		capacity *= 2;
+	slots = calloc(capacity, sizeof(cm_index_slot));
+	if (!slots)
+		return 0;
+	idx->old_slots = idx->slots;
+	idx->old_capacity = idx->capacity;
+	idx->migrate_pos = 0;
+	idx->slots = slots;
+	idx->capacity = capacity;
+	idx->used = 0;
+	return 1;
+}
+
+static int cm_index_insert(cm_index* idx, cm_alloc_map* rec)
+{
+	cm_index_migrate(idx, CM_INDEX_MIGRATE_STEP);
+	/* keep the load factor of the current table under 3/4 */
+	if ((idx->used + 1) * 4 > idx->capacity * 3) {
+		if (!cm_index_start_resize(idx))
+			return 0;
+	}
+	cm_index_place(idx->slots, idx->capacity, (uintptr_t)rec->block, rec);
+	++idx->used;
+	++idx->live;
+	return 1;
+}
+
+static cm_alloc_map* cm_index_remove(cm_index* idx, const void* block)
+{
+	cm_index_slot* s;
+	cm_alloc_map* rec;
+
+	/* NULL and the tombstone marker are never stored */
+	if (!cm_index_is_live((uintptr_t)block))
+		return NULL;
+	cm_index_migrate(idx, CM_INDEX_MIGRATE_STEP);
+	s = cm_index_probe(idx->slots, idx->capacity, (uintptr_t)block);
+	if (!s)
+		s = cm_index_probe(idx->old_slots, idx->old_capacity, (uintptr_t)block);
+	if (!s)
+		return NULL;
+	rec = s->rec;
+	s->key = CM_INDEX_TOMBSTONE;
+	s->rec = NULL;
+	--idx->live;
+	return rec;
+}
+
+static size_t cm_index_count(const cm_index* idx)
+{
+	return idx->live;
+}
+
+/* Bytes taken from the C allocator. */
+static size_t cm_index_overhead(const cm_index* idx)
+{
+	return (idx->capacity + idx->old_capacity) * sizeof(cm_index_slot);
+}
+
+/* Return the next live record starting from *cursor, NULL at the end. */
+static cm_alloc_map* cm_index_next(const cm_index* idx, size_t* cursor)
+{
+	const cm_index_slot* s;
+
+	while (*cursor < idx->old_capacity + idx->capacity) {
+		if (*cursor < idx->old_capacity)
+			s = &idx->old_slots[*cursor];
+		else
+			s = &idx->slots[*cursor - idx->old_capacity];
+		++*cursor;
+		if (cm_index_is_live(s->key))
+			return s->rec;
+	}
+	return NULL;
+}
+
+/*------------------------------------------------------------------------------
+	macros
+------------------------------------------------------------------------------*/
+
+/*
+ * Iterate over every live record. 'it' is a size_t cursor, 'rec' a
+ * cm_alloc_map*. The index must not be modified during the loop.
+ */
+#define cm_index_foreach(idx, it, rec) \
+	for (it = 0; (rec = cm_index_next(idx, &it)) != NULL; )
+
+#endif /* CMONITOR_CM_INDEX_H */
@@ -0,0 +1,187 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Allocation events and the per-thread rings they are buffered in when
+ * logging asynchronously (CM_LOG_ASYNC).
+ *
+ * Every ring has exactly one producer (the thread owning it) and one
+ * consumer (the log writer thread). When a ring is grown the producer
+ * links a bigger one after it and never touches the old one again; the
+ * consumer frees the old ring once it has been drained.
+ */
+
+#ifndef CMONITOR_CM_LOG_H
+#define CMONITOR_CM_LOG_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cm_platform.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+enum {
+	CM_EV_MALLOC,
+	CM_EV_REALLOC_MALLOC, /* cm_realloc_ of a NULL pointer */
+	CM_EV_FREE,
+	CM_EV_CALLOC,
+	CM_EV_REALLOC
+};
+
+typedef struct cm_event {
+	int type;
+	int line;
+	const char* filename; /* without its path */
+	uint32_t site;        /* cm_site id of (filename, line) */
+	void* address;
+	size_t size;          /* bytes allocated/freed, new size for realloc */
+	size_t arg1;          /* calloc: num, realloc: old size */
+	size_t arg2;          /* calloc: size */
+	void* old_address;    /* realloc: block before the call */
+	uint64_t time;        /* cm_now_ns(), only set when tracing */
+} cm_event;
+
+typedef struct cm_log_ring {
+	volatile uint32_t head;     /* next event to read, consumer owned */
+	char pad0[CM_CACHE_LINE];
+	volatile uint32_t tail;     /* next free slot, producer owned */
+	char pad1[CM_CACHE_LINE];
+	uint32_t capacity;          /* a power of two */
+	struct cm_log_ring* volatile next; /* newer ring, see CM_LOG_FULL_GROW */
+	cm_event events[1];
+} cm_log_ring;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+/* longest line cm_log_format can produce */
+#define CM_LOG_LINE_MAX 256
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static inline int          cm_log_format      (char* buf, const cm_event* ev);
+static inline cm_log_ring* cm_log_ring_create (uint32_t capacity);
+static inline int          cm_log_ring_push   (cm_log_ring* ring, const cm_event* ev);
+static inline cm_event*    cm_log_ring_peek   (cm_log_ring* ring);
+static inline void         cm_log_ring_pop    (cm_log_ring* ring);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+/*
+ * Write the text line of an event to buf (at least CM_LOG_LINE_MAX bytes).
+ * Returns the line length.
+ */
+static inline int cm_log_format(char* buf, const cm_event* ev)
+{
+	int len = 0;
+
+	switch (ev->type) {
+		case CM_EV_MALLOC:
+			len = snprintf(buf, CM_LOG_LINE_MAX, "[%s:%d] <%p> malloc(%d)\n",
+						   ev->filename, ev->line, ev->address, (int)ev->size);
+			break;
+		case CM_EV_REALLOC_MALLOC:
+			len = snprintf(buf, CM_LOG_LINE_MAX, "[%s:%d] <%p> <realloc> malloc(%d)\n",
+						   ev->filename, ev->line, ev->address, (int)ev->size);
+			break;
+		case CM_EV_FREE:
+			len = snprintf(buf, CM_LOG_LINE_MAX, "[%s:%d] <%p> free(%d)\n",
+						   ev->filename, ev->line, ev->address, (int)ev->size);
+			break;
+		case CM_EV_CALLOC:
+			len = snprintf(buf, CM_LOG_LINE_MAX, "[%s:%d] <%p> calloc(%d, %d) | total: %d\n",
+						   ev->filename, ev->line, ev->address, (int)ev->arg1,
+						   (int)ev->arg2, (int)ev->size);
+			break;
+		case CM_EV_REALLOC:
+			len = snprintf(buf, CM_LOG_LINE_MAX,
+						   "[%s:%d] <%p> realloc(from: %d, to: %d) | diff: %d | old: <%p>\n",
+						   ev->filename, ev->line, ev->address, (int)ev->arg1,
+						   (int)ev->size, (int)(ev->size - ev->arg1), ev->old_address);
+			break;
+	}
+	if (len < 0)
+		return 0;
+	/* a truncated line still ends with its newline */
+	if (len >= CM_LOG_LINE_MAX) {
+		buf[CM_LOG_LINE_MAX - 2] = '\n';
+		len = CM_LOG_LINE_MAX - 1;
+	}
+	return len;
+}
+
+static inline cm_log_ring* cm_log_ring_create(uint32_t capacity)
+{
+	cm_log_ring* ring;
+
+	ring = cm_aligned_malloc(CM_CACHE_LINE,
+							 sizeof(cm_log_ring) + (capacity - 1) * sizeof(cm_event));
+	if (!ring)
+		return NULL;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->capacity = capacity;
+	ring->next = NULL;
+	return ring;
+}
+
+/* Producer side. Returns 0 if the ring is full. */
+static inline int cm_log_ring_push(cm_log_ring* ring, const cm_event* ev)
+{
+	uint32_t tail = ring->tail;
+
+	if (tail - cm_atomic_load_acquire_u32(&ring->head) == ring->capacity)
+		return 0;
+	ring->events[tail & (ring->capacity - 1)] = *ev;
+	cm_atomic_store_release_u32(&ring->tail, tail + 1);
+	return 1;
+}
+
+/* Consumer side. Returns the oldest event or NULL if the ring is empty. */
+static inline cm_event* cm_log_ring_peek(cm_log_ring* ring)
+{
+	uint32_t head = ring->head;
+
+	if (head == cm_atomic_load_acquire_u32(&ring->tail))
+		return NULL;
+	return &ring->events[head & (ring->capacity - 1)];
+}
+
+/* Consumer side. Release the event returned by cm_log_ring_peek. */
+static inline void cm_log_ring_pop(cm_log_ring* ring)
+{
+	cm_atomic_store_release_u32(&ring->head, ring->head + 1);
+}
+
+#endif /* CMONITOR_CM_LOG_H */
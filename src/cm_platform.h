@@ -0,0 +1,684 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Thin wrappers around the few OS primitives cmonitor needs. They are
+ * static inline, the tools and the benchmarks only use some of them.
+ */
+
+#ifndef CMONITOR_CM_PLATFORM_H
+#define CMONITOR_CM_PLATFORM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#  include <malloc.h>
+#  include <intrin.h>
+#else
+#  include <pthread.h>
+#  include <sched.h>
+#  include <time.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif /* _WIN32 */
+
+/*------------------------------------------------------------------------------
+	paths
+------------------------------------------------------------------------------*/
+
+/* Strip the directories from a __FILE__ path. */
+static inline const char* cm_basename(const char* file)
+{
+#if defined(_WIN32) || defined(__CYGWIN__)
+	return (strrchr(file, '\\') ? strrchr(file, '\\') + 1 : file);
+#else
+	return (strrchr(file, '/') ? strrchr(file, '/') + 1 : file);
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	thread local storage
+------------------------------------------------------------------------------*/
+
+#if defined(_MSC_VER)
+#  define CM_TLS __declspec(thread)
+#else
+#  define CM_TLS __thread
+#endif /* _MSC_VER */
+
+/*------------------------------------------------------------------------------
+	mutex
+------------------------------------------------------------------------------*/
+
+#if defined(_WIN32)
+typedef CRITICAL_SECTION cm_mutex;
+#else
+typedef pthread_mutex_t cm_mutex;
+#endif /* _WIN32 */
+
+static inline void cm_mutex_init(cm_mutex* m)
+{
+#if defined(_WIN32)
+	InitializeCriticalSection(m);
+#else
+	pthread_mutex_init(m, NULL);
+#endif /* _WIN32 */
+}
+
+static inline void cm_mutex_destroy(cm_mutex* m)
+{
+#if defined(_WIN32)
+	DeleteCriticalSection(m);
+#else
+	pthread_mutex_destroy(m);
+#endif /* _WIN32 */
+}
+
+static inline void cm_mutex_lock(cm_mutex* m)
+{
+#if defined(_WIN32)
+	EnterCriticalSection(m);
+#else
+	pthread_mutex_lock(m);
+#endif /* _WIN32 */
+}
+
+static inline void cm_mutex_unlock(cm_mutex* m)
+{
+#if defined(_WIN32)
+	LeaveCriticalSection(m);
+#else
+	pthread_mutex_unlock(m);
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	thread exit notification
+------------------------------------------------------------------------------*/
+
+/* Called on thread exit with the value set with cm_tls_key_set. */
+typedef void (*cm_tls_destructor)(void* value);
+
+#if defined(_WIN32)
+typedef DWORD cm_tls_key;
+#else
+typedef pthread_key_t cm_tls_key;
+#endif /* _WIN32 */
+
+static inline int cm_tls_key_create(cm_tls_key* key, cm_tls_destructor fn)
+{
+#if defined(_WIN32)
+	*key = FlsAlloc((PFLS_CALLBACK_FUNCTION)fn);
+	return *key != FLS_OUT_OF_INDEXES;
+#else
+	return pthread_key_create(key, fn) == 0;
+#endif /* _WIN32 */
+}
+
+static inline void cm_tls_key_delete(cm_tls_key key)
+{
+#if defined(_WIN32)
+	FlsFree(key);
+#else
+	pthread_key_delete(key);
+#endif /* _WIN32 */
+}
+
+static inline void cm_tls_key_set(cm_tls_key key, void* value)
+{
+#if defined(_WIN32)
+	FlsSetValue(key, value);
+#else
+	pthread_setspecific(key, value);
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	atomics
+------------------------------------------------------------------------------*/
+
+/*
+ * Relaxed loads/stores are enough for statistics: a reader may see a slightly
+ * stale value but never a torn one.
+ */
+
+#if defined(_MSC_VER)
+
+static inline uint32_t cm_atomic_load_u32(const volatile uint32_t* p)
+{
+	return *p;
+}
+
+static inline void cm_atomic_store_u32(volatile uint32_t* p, uint32_t v)
+{
+	*p = v;
+}
+
+static inline uint32_t cm_atomic_add_u32(volatile uint32_t* p, uint32_t v)
+{
+	return (uint32_t)InterlockedExchangeAdd((volatile LONG*)p, (LONG)v) + v;
+}
+
+static inline uint64_t cm_atomic_load_u64(const volatile uint64_t* p)
+{
+#if defined(_M_IX86)
+	/* a plain 64-bit load may tear on x86 */
+	return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)p, 0, 0);
+#else
+	return *p;
+#endif /* _M_IX86 */
+}
+
+static inline void cm_atomic_store_u64(volatile uint64_t* p, uint64_t v)
+{
+#if defined(_M_IX86)
+	InterlockedExchange64((volatile LONG64*)p, (LONG64)v);
+#else
+	*p = v;
+#endif /* _M_IX86 */
+}
+
+static inline uint64_t cm_atomic_add_u64(volatile uint64_t* p, uint64_t v)
+{
+	return (uint64_t)InterlockedExchangeAdd64((volatile LONG64*)p, (LONG64)v) + v;
+}
+
+static inline int cm_atomic_cas_u32(volatile uint32_t* p, uint32_t expected, uint32_t v)
+{
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)p, (LONG)v,
+												(LONG)expected) == expected;
+}
+
+static inline uint32_t cm_atomic_load_acquire_u32(const volatile uint32_t* p)
+{
+	uint32_t v = *p;
+
+	MemoryBarrier();
+	return v;
+}
+
+static inline void cm_atomic_store_release_u32(volatile uint32_t* p, uint32_t v)
+{
+	InterlockedExchange((volatile LONG*)p, (LONG)v);
+}
+
+static inline void* cm_atomic_load_acquire_ptr(void* const volatile* p)
+{
+	void* v = *p;
+
+	MemoryBarrier();
+	return v;
+}
+
+static inline void cm_atomic_store_release_ptr(void* volatile* p, void* v)
+{
+	InterlockedExchangePointer(p, v);
+}
+
+static inline void cm_atomic_fence(void)
+{
+	MemoryBarrier();
+}
+
+#else
+
+static inline uint32_t cm_atomic_load_u32(const volatile uint32_t* p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void cm_atomic_store_u32(volatile uint32_t* p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t cm_atomic_add_u32(volatile uint32_t* p, uint32_t v)
+{
+	return __atomic_add_fetch(p, v, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t cm_atomic_load_u64(const volatile uint64_t* p)
+{
+	return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void cm_atomic_store_u64(volatile uint64_t* p, uint64_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t cm_atomic_add_u64(volatile uint64_t* p, uint64_t v)
+{
+	return __atomic_add_fetch(p, v, __ATOMIC_RELAXED);
+}
+
+static inline int cm_atomic_cas_u32(volatile uint32_t* p, uint32_t expected, uint32_t v)
+{
+	return __atomic_compare_exchange_n(p, &expected, v, 0,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t cm_atomic_load_acquire_u32(const volatile uint32_t* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void cm_atomic_store_release_u32(volatile uint32_t* p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline void* cm_atomic_load_acquire_ptr(void* const volatile* p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void cm_atomic_store_release_ptr(void* volatile* p, void* v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline void cm_atomic_fence(void)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif /* _MSC_VER */
+
+/*
+ * Add to a counter only ever written by the calling thread. No locked
+ * instruction is needed, other threads only read it.
+ */
+static inline void cm_counter_add_u32(volatile uint32_t* p, uint32_t v)
+{
+	cm_atomic_store_u32(p, cm_atomic_load_u32(p) + v);
+}
+
+static inline void cm_counter_add_u64(volatile uint64_t* p, uint64_t v)
+{
+	cm_atomic_store_u64(p, cm_atomic_load_u64(p) + v);
+}
+
+/*------------------------------------------------------------------------------
+	threads
+------------------------------------------------------------------------------*/
+
+typedef void (*cm_thread_fn)(void* arg);
+
+typedef struct cm_thread {
+	cm_thread_fn fn;
+	void* arg;
+#if defined(_WIN32)
+	HANDLE handle;
+#else
+	pthread_t handle;
+#endif /* _WIN32 */
+} cm_thread;
+
+#if defined(_WIN32)
+static inline DWORD WINAPI cm_thread_main(LPVOID p)
+{
+	cm_thread* t = p;
+
+	t->fn(t->arg);
+	return 0;
+}
+#else
+static inline void* cm_thread_main(void* p)
+{
+	cm_thread* t = p;
+
+	t->fn(t->arg);
+	return NULL;
+}
+#endif /* _WIN32 */
+
+/* t must stay valid until cm_thread_join returns. */
+static inline int cm_thread_start(cm_thread* t, cm_thread_fn fn, void* arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+#if defined(_WIN32)
+	t->handle = CreateThread(NULL, 0, cm_thread_main, t, 0, NULL);
+	return t->handle != NULL;
+#else
+	return pthread_create(&t->handle, NULL, cm_thread_main, t) == 0;
+#endif /* _WIN32 */
+}
+
+static inline void cm_thread_join(cm_thread* t)
+{
+#if defined(_WIN32)
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+#else
+	pthread_join(t->handle, NULL);
+#endif /* _WIN32 */
+}
+
+/*
+ * Have prepare called before fork() and parent and child after it, in the
+ * thread that forked. There's nothing to do without fork().
+ */
+static inline int cm_atfork(void (*prepare)(void), void (*parent)(void),
+							void (*child)(void))
+{
+#if defined(_WIN32)
+	(void)prepare;
+	(void)parent;
+	(void)child;
+	return 1;
+#else
+	return pthread_atfork(prepare, parent, child) == 0;
+#endif /* _WIN32 */
+}
+
+static inline void cm_thread_yield(void)
+{
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif /* _WIN32 */
+}
+
+static inline void cm_sleep_ms(unsigned ms)
+{
+#if defined(_WIN32)
+	Sleep(ms);
+#else
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	nanosleep(&ts, NULL);
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	time
+------------------------------------------------------------------------------*/
+
+/* Monotonic clock in nanoseconds. */
+static inline uint64_t cm_now_ns(void)
+{
+#if defined(_WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000000ull
+		+ (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000000ull / (uint64_t)freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif /* _WIN32 */
+}
+
+/* Monotonic clock in nanoseconds, cheaper but only as fine as the tick. */
+static inline uint64_t cm_coarse_ns(void)
+{
+#if defined(_WIN32)
+	return (uint64_t)GetTickCount64() * 1000000ull;
+#elif defined(CLOCK_MONOTONIC_COARSE)
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+	return cm_now_ns();
+#endif /* _WIN32 */
+}
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#  define CM_HAS_TSC
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define CM_HAS_TSC
+#endif
+
+/* CPU time stamp counter, cm_now_ns() where there is none. */
+static inline uint64_t cm_tsc(void)
+{
+#if defined(CM_HAS_TSC) && defined(_MSC_VER)
+	return __rdtsc();
+#elif defined(CM_HAS_TSC)
+	uint32_t lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+#else
+	return cm_now_ns();
+#endif /* CM_HAS_TSC */
+}
+
+/*------------------------------------------------------------------------------
+	memory mapped files
+------------------------------------------------------------------------------*/
+
+typedef struct cm_file_map {
+	void* base;
+	size_t size;
+#if defined(_WIN32)
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif /* _WIN32 */
+} cm_file_map;
+
+/* Create (or truncate) a file of size bytes and map it read/write. */
+static inline int cm_file_map_create(cm_file_map* map, const char* path, size_t size)
+{
+#if defined(_WIN32)
+	map->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+							NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (map->file == INVALID_HANDLE_VALUE)
+		return 0;
+	map->mapping = CreateFileMappingA(map->file, NULL, PAGE_READWRITE,
+									  (DWORD)((uint64_t)size >> 32), (DWORD)size, NULL);
+	if (!map->mapping) {
+		CloseHandle(map->file);
+		return 0;
+	}
+	map->base = MapViewOfFile(map->mapping, FILE_MAP_WRITE, 0, 0, size);
+	if (!map->base) {
+		CloseHandle(map->mapping);
+		CloseHandle(map->file);
+		return 0;
+	}
+#else
+	map->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (map->fd < 0)
+		return 0;
+	if (ftruncate(map->fd, (off_t)size) != 0) {
+		close(map->fd);
+		return 0;
+	}
+	map->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, map->fd, 0);
+	if (map->base == MAP_FAILED) {
+		close(map->fd);
+		return 0;
+	}
+#endif /* _WIN32 */
+	map->size = size;
+	return 1;
+}
+
+static inline void cm_file_map_close(cm_file_map* map)
+{
+#if defined(_WIN32)
+	FlushViewOfFile(map->base, 0);
+	UnmapViewOfFile(map->base);
+	CloseHandle(map->mapping);
+	CloseHandle(map->file);
+#else
+	msync(map->base, map->size, MS_SYNC);
+	munmap(map->base, map->size);
+	close(map->fd);
+#endif /* _WIN32 */
+	map->base = NULL;
+	map->size = 0;
+}
+
+/*------------------------------------------------------------------------------
+	stack walking
+------------------------------------------------------------------------------*/
+
+/*
+ * Where the current function's return address can be found, for
+ * cm_stack_capture. NULL if unsupported.
+ */
+#if defined(_MSC_VER)
+#  define CM_FRAME_ADDRESS() _AddressOfReturnAddress()
+#elif defined(__GNUC__)
+#  define CM_FRAME_ADDRESS() __builtin_frame_address(0)
+#else
+#  define CM_FRAME_ADDRESS() NULL
+#endif /* _MSC_VER */
+
+/* the farthest apart two frames of a chain can be */
+#define CM_STACK_MAX_FRAME (1024 * 1024)
+
+/* Bounds of the calling thread's stack. Returns 0 if unknown. */
+static inline int cm_thread_stack_bounds(char** lo, char** hi)
+{
+#if defined(__linux__) && defined(_GNU_SOURCE)
+	pthread_attr_t attr;
+	void* addr;
+	size_t size;
+
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return 0;
+	if (pthread_attr_getstack(&attr, &addr, &size) != 0) {
+		pthread_attr_destroy(&attr);
+		return 0;
+	}
+	pthread_attr_destroy(&attr);
+	*lo = addr;
+	*hi = (char*)addr + size;
+	return 1;
+#else
+	(void)lo;
+	(void)hi;
+	return 0;
+#endif
+}
+
+/*
+ * Write the return addresses of up to max_depth callers to out, starting
+ * with the return address of the function 'frame' (CM_FRAME_ADDRESS) was
+ * taken in. lo/hi bound the stack, NULL if unknown. Returns the depth.
+ *
+ * Elsewhere than on Windows the frame pointer chain is followed: frames
+ * of code built without frame pointers end the walk early.
+ */
+static inline int cm_stack_capture(void* frame, const char* lo, const char* hi,
+							void** out, int max_depth)
+{
+#if defined(_WIN32)
+	void* frames[128];
+	int n, i;
+
+	(void)lo;
+	(void)hi;
+	if (!frame)
+		return 0;
+	n = RtlCaptureStackBackTrace(0, 128, frames, NULL);
+	/* drop cmonitor's own frames, up to the caller of 'frame' */
+	for (i = 0; i < n && frames[i] != *(void**)frame; ++i)
+		;
+	n -= i;
+	if (n > max_depth)
+		n = max_depth;
+	memcpy(out, frames + i, n * sizeof(void*));
+	return n;
+#elif defined(__GNUC__)
+	void** fp = frame;
+	void** next;
+	int n = 0;
+
+	while (fp && n < max_depth) {
+		if (lo && ((const char*)fp < lo || (const char*)(fp + 2) > hi))
+			break;
+		/* garbage read through a frame built without frame pointer */
+		if ((uintptr_t)fp[1] < 0x100000
+			|| (lo && (const char*)fp[1] >= lo && (const char*)fp[1] < hi))
+			break;
+		out[n++] = fp[1];
+		next = fp[0];
+		/* stacks grow down: callers' frames are at higher addresses */
+		if (next <= fp || (char*)next - (char*)fp > CM_STACK_MAX_FRAME
+			|| ((uintptr_t)next & (sizeof(void*) - 1)))
+			break;
+		fp = next;
+	}
+	return n;
+#else
+	(void)frame;
+	(void)lo;
+	(void)hi;
+	(void)out;
+	(void)max_depth;
+	return 0;
+#endif /* _WIN32 */
+}
+
+/*------------------------------------------------------------------------------
+	memory
+------------------------------------------------------------------------------*/
+
+#define CM_CACHE_LINE 64
+
+static inline void* cm_aligned_malloc(size_t alignment, size_t size)
+{
+#if defined(_WIN32)
+	return _aligned_malloc(size, alignment);
+#else
+	void* mem;
+
+	return posix_memalign(&mem, alignment, size) == 0 ? mem : NULL;
+#endif /* _WIN32 */
+}
+
+static inline void cm_aligned_free(void* mem)
+{
+#if defined(_WIN32)
+	_aligned_free(mem);
+#else
+	free(mem);
+#endif /* _WIN32 */
+}
+
+#endif /* CMONITOR_CM_PLATFORM_H */
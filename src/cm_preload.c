@@ -0,0 +1,515 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Whole-process tracking without the cm_* macros (Linux).
+ *
+ * Built as a shared library and loaded through LD_PRELOAD it replaces malloc,
+ * free, calloc, realloc, posix_memalign and aligned_alloc, so the
+ * allocations of the program, of its libraries and of C++ operator new all
+ * go through cmonitor. Build it with:
+ *
+ *   gcc -shared -fPIC -O2 -fno-omit-frame-pointer -ftls-model=initial-exec \
+ *       -Iinclude src/cm_preload.c -o libcmonitor_preload.so -ldl -lpthread -lm
+ *
+ * (add -lrt with glibc before 2.34)
+ *
+ * and run the program with LD_PRELOAD=./libcmonitor_preload.so. It is set up
+ * through the environment:
+ *
+ *   CM_OUTPUT           file the events and the report are written to,
+ *                       a copy of stderr by default.
+ *   CM_FLAGS            cm_init flags (e.g. 0x2c0000), by default
+ *                       CM_TRACK_SAMPLED | CM_LOG_ASYNC | CM_LOG_FULL_DROP.
+ *                       CM_TRACK_THREAD_SAFE is always added,
+ *                       CM_TRACK_INLINE_HEADER and the unknown block
+ *                       signals are always removed.
+ *   CM_SAMPLE_INTERVAL  see cm_set_sample_interval.
+ *   CM_STACK_DEPTH      see cm_set_stack_depth.
+ *   CM_CLOCK            "coarse" for CM_CLOCK_COARSE, see cm_set_clock.
+ *   CM_TRACE            write a binary trace there, see cm_trace_open.
+ *   CM_REPORT_LEAKS     set to 1 to list the blocks still live at exit.
+ *   CM_SHM              publish the live stats every that many ms, see
+ *                       cm_shm_publish and tools/cm_top.c.
+ *
+ * The stats are printed when the program exits, and by a forked child when
+ * it exits (see CM_LOG_ASYNC for its events). The default output is a
+ * duplicate of the stderr descriptor taken at startup, so the report still
+ * goes where stderr pointed then, even if the program closes stderr on its
+ * way out as coreutils do. The program can also call the cmonitor API
+ * exported by the library (cm_get_stats, cm_get_leaks, ...) but must not
+ * call cm_init or cm_shutdown. Every allocation has the
+ * "<preload>" call site, enable CM_TRACK_STACKS to tell them apart.
+ *
+ * Allocations made by the C library on behalf of cmonitor (stdio, thread
+ * creation, ...) are recognized through a per-thread flag and passed through
+ * untracked. Running out of memory returns NULL with errno set to ENOMEM,
+ * as with the C allocator, a failed realloc leaves the old block alone.
+ */
+
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+/* everything cm.c includes, before the C allocator gets renamed below */
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* The C allocator the functions below stand in front of. */
+typedef struct cm_real_allocator {
+	void* (*malloc)(size_t);
+	void  (*free)(void*);
+	void* (*calloc)(size_t, size_t);
+	void* (*realloc)(void*, size_t);
+	int   (*posix_memalign)(void**, size_t, size_t);
+	void* (*aligned_alloc)(size_t, size_t);
+} cm_real_allocator;
+
+static cm_real_allocator real;
+
+/* cmonitor's own allocations must not come back here */
+#define malloc(size)                         real.malloc(size)
+#define free(mem)                            real.free(mem)
+#define calloc(num, size)                    real.calloc(num, size)
+#define realloc(mem, size)                   real.realloc(mem, size)
+#define posix_memalign(out, alignment, size) real.posix_memalign(out, alignment, size)
+
+#include "cm.c"
+
+#undef malloc
+#undef free
+#undef calloc
+#undef realloc
+#undef posix_memalign
+
+/* ring size of the CM_TRACE binary trace */
+#ifndef CM_PRELOAD_TRACE_BYTES
+#  define CM_PRELOAD_TRACE_BYTES (64 * 1024 * 1024)
+#endif
+
+/* memory handed out while dlsym looks up the real allocator */
+#ifndef CM_PRELOAD_BOOTSTRAP_BYTES
+#  define CM_PRELOAD_BOOTSTRAP_BYTES (16 * 1024)
+#endif
+
+#define CM_PRELOAD_UNRESOLVED 0
+#define CM_PRELOAD_RESOLVING  1 /* inside dlsym */
+#define CM_PRELOAD_RESOLVED   2 /* real allocator known, not tracking yet */
+#define CM_PRELOAD_TRACKING   3
+
+static volatile uint32_t preload_state;
+
+/* set while the thread is inside cmonitor */
+static CM_TLS int in_cmonitor;
+
+static cm_site_desc preload_desc = { "<preload>", "<preload>", 0, 0, 0 };
+
+/* the output file's buffer, stdio would malloc one from the log writer */
+static char output_buffer[64 * 1024];
+
+/* each block is preceded by its size, never released */
+static char bootstrap[CM_PRELOAD_BOOTSTRAP_BYTES] __attribute__((aligned(16)));
+static size_t bootstrap_used;
+
+#define CM_BOOTSTRAP_HEADER 16
+
+/*------------------------------------------------------------------------------
+	Bootstrap
+------------------------------------------------------------------------------*/
+
+static void* bootstrap_alloc(size_t size)
+{
+	char* hdr;
+
+	if (size > sizeof(bootstrap))
+		return NULL;
+	size = (size + CM_BOOTSTRAP_HEADER - 1) & ~(size_t)(CM_BOOTSTRAP_HEADER - 1);
+	if (size + CM_BOOTSTRAP_HEADER > sizeof(bootstrap) - bootstrap_used)
+		return NULL;
+	hdr = bootstrap + bootstrap_used;
+	*(size_t*)hdr = size;
+	bootstrap_used += CM_BOOTSTRAP_HEADER + size;
+	/* static storage, already zeroed for calloc */
+	return hdr + CM_BOOTSTRAP_HEADER;
+}
+
+static int is_bootstrap(const void* mem)
+{
+	return (const char*)mem >= bootstrap && (const char*)mem < bootstrap + sizeof(bootstrap);
+}
+
+static size_t bootstrap_size(const void* mem)
+{
+	return *(const size_t*)((const char*)mem - CM_BOOTSTRAP_HEADER);
+}
+
+#define resolve(fn) (*(void**)&real.fn = dlsym(RTLD_NEXT, #fn))
+
+/*
+ * Look up the allocator we are interposing. dlsym may allocate itself,
+ * those allocations get bootstrap memory. Happens before main, while the
+ * process has a single thread.
+ */
+static void resolve_real(void)
+{
+	static const char msg[] = "cmonitor: cannot find the C allocator.\n";
+	ssize_t n;
+
+	preload_state = CM_PRELOAD_RESOLVING;
+	if (!resolve(malloc) || !resolve(free) || !resolve(calloc) || !resolve(realloc)
+		|| !resolve(posix_memalign) || !resolve(aligned_alloc)) {
+		/* no stdio, it would allocate */
+		n = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+		(void)n;
+		abort();
+	}
+	preload_state = CM_PRELOAD_RESOLVED;
+}
+
+/* Make sure the real allocator is known, 0 if it is being looked up. */
+static int real_ready(void)
+{
+	if (preload_state >= CM_PRELOAD_RESOLVED)
+		return 1;
+	if (preload_state == CM_PRELOAD_RESOLVING)
+		return 0;
+	resolve_real();
+	return 1;
+}
+
+/* Whether the call must go straight to the real allocator. */
+static int bypass(void)
+{
+	return cm_atomic_load_acquire_u32(&preload_state) != CM_PRELOAD_TRACKING || in_cmonitor;
+}
+
+/*------------------------------------------------------------------------------
+	Tracking
+------------------------------------------------------------------------------*/
+
+static cm_site* preload_site(void)
+{
+	return site_of_desc(&preload_desc);
+}
+
+/* Record a block the real allocator just returned, as malloc_at would. */
+static void track_block(cm_thread_info* t, cm_site* site, void* mem, size_t size,
+						void* frame)
+{
+	cm_alloc_map* node;
+	cm_event ev;
+	size_t weight;
+
+	count_allocated(t, size);
+	count(t, malloc_count, 1);
+	count(t, live_blocks, 1);
+	count_size(t, allocs, size, 1);
+	if (!sample(size, &weight))
+		return;
+	node = cm_slab_alloc(&settings.records, &records_magazine);
+	if (!node) {
+		invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	node->block = mem;
+	node->size = size;
+	node->weight = weight;
+	node->site = site;
+	node->flags = 0;
+	node->stack_id = capture_stack(frame);
+	stamp_record(t, node);
+	if (!index_insert(node)) {
+		invoke_on_error(CM_ERR_ERROR, "internal malloc failed.");
+		exit(EXIT_FAILURE);
+	}
+	cm_site_on_alloc(site, weight, record_blocks(node), is_flag_set(CM_TRACK_THREAD_SAFE));
+	ev.type = CM_EV_MALLOC;
+	ev.filename = site->basename;
+	ev.site = site->id;
+	ev.line = site->line;
+	ev.address = mem;
+	ev.size = size;
+	ev.arg1 = ev.arg2 = 0;
+	ev.old_address = NULL;
+	log_event(t, &ev);
+}
+
+/* No stdio, stderr may already be closed. */
+static void on_error(int err, const char* msg)
+{
+	char line[256];
+	ssize_t n;
+	int len;
+
+	(void)err;
+	len = snprintf(line, sizeof(line), "cmonitor: %s\n", msg);
+	if (len < 0)
+		return;
+	if ((size_t)len >= sizeof(line))
+		len = (int)sizeof(line) - 1;
+	n = write(STDERR_FILENO, line, (size_t)len);
+	(void)n;
+}
+
+/*
+ * A FILE of its own on the stderr descriptor, line buffered as stderr is
+ * almost. NULL if there's no stderr.
+ */
+static FILE* open_stderr(void)
+{
+	FILE* output;
+	int fd;
+
+	fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+	if (fd < 0)
+		return NULL;
+	output = fdopen(fd, "w");
+	if (!output) {
+		close(fd);
+		return NULL;
+	}
+	setvbuf(output, output_buffer, _IOLBF, sizeof(output_buffer));
+	return output;
+}
+
+/* Called with an index shard locked, in_cmonitor keeps stdio out of cmonitor. */
+static int report_leak(const cm_leak_info* leak, void* ctx)
+{
+	int i;
+
+	(void)ctx;
+	fprintf(settings.output, "[%s:%d] <%p> leak(%lu) | estimated: %lu\n",
+			leak->filename, leak->line, leak->address,
+			(unsigned long)leak->bytes, (unsigned long)leak->estimated_bytes);
+	for (i = 0; i < leak->stack_depth; ++i)
+		fprintf(settings.output, "\t#%d %p\n", i, leak->stack[i]);
+	return 0;
+}
+
+__attribute__((constructor))
+static void preload_init(void)
+{
+	const char* env;
+	FILE* output = NULL;
+	uint32_t flags = CM_TRACK_SAMPLED | CM_LOG_ASYNC | CM_LOG_FULL_DROP;
+
+	if (!real_ready())
+		return;
+	in_cmonitor = 1;
+	env = getenv("CM_OUTPUT");
+	if (env && *env) {
+		output = fopen(env, "w");
+		if (output)
+			setvbuf(output, output_buffer, _IOFBF, sizeof(output_buffer));
+		else
+			fprintf(stderr, "cmonitor: cannot open '%s', using stderr.\n", env);
+	}
+	if (!output)
+		output = open_stderr();
+	if (!output) {
+		in_cmonitor = 0;
+		return;
+	}
+	env = getenv("CM_FLAGS");
+	if (env && *env)
+		flags = (uint32_t)strtoul(env, NULL, 0);
+	/* any library may start threads, and foreign pointers have no header */
+	flags |= CM_TRACK_THREAD_SAFE;
+	flags &= ~(uint32_t)(CM_TRACK_INLINE_HEADER
+						 | CM_SIGNAL_ON_FREEING_UNKNOWN
+						 | CM_SIGNAL_ON_REALLOC_UNKNOWN);
+	env = getenv("CM_SAMPLE_INTERVAL");
+	if (env && *env)
+		cm_set_sample_interval((size_t)strtoul(env, NULL, 0));
+	env = getenv("CM_CLOCK");
+	if (env && strcmp(env, "coarse") == 0)
+		cm_set_clock(CM_CLOCK_COARSE);
+	env = getenv("CM_STACK_DEPTH");
+	if (env && *env)
+		cm_set_stack_depth(atoi(env));
+	/* blocks allocated before us or by the C library itself */
+	settings.free_unknown = 1;
+	/* programs expect malloc to fail, not to exit */
+	settings.fail_null = 1;
+	if (cm_init(output, on_error, flags)) {
+		env = getenv("CM_TRACE");
+		if (env && *env)
+			cm_trace_open(env, CM_PRELOAD_TRACE_BYTES);
+		env = getenv("CM_SHM");
+		if (env && *env)
+			cm_shm_publish(NULL, (uint32_t)strtoul(env, NULL, 0));
+		cm_atomic_store_release_u32(&preload_state, CM_PRELOAD_TRACKING);
+	}
+	in_cmonitor = 0;
+}
+
+/*
+ * Other threads and later destructors may still allocate: keep tracking,
+ * only write out the report.
+ */
+__attribute__((destructor))
+static void preload_exit(void)
+{
+	const char* env;
+
+	if (preload_state != CM_PRELOAD_TRACKING)
+		return;
+	in_cmonitor = 1;
+	cm_print_stats();
+	env = getenv("CM_REPORT_LEAKS");
+	if (env && strcmp(env, "1") == 0)
+		cm_foreach_live(report_leak, NULL, 0);
+	fflush(settings.output);
+	/* nothing else removes the segment */
+	cm_shm_unpublish();
+	in_cmonitor = 0;
+}
+
+/*------------------------------------------------------------------------------
+	Interposed functions
+------------------------------------------------------------------------------*/
+
+/*
+ * Each one takes its own frame address so the stacks captured start at the
+ * caller of the C allocator.
+ */
+
+void* malloc(size_t size)
+{
+	void* mem;
+
+	if (!real_ready())
+		return bootstrap_alloc(size);
+	if (bypass())
+		return real.malloc(size);
+	in_cmonitor = 1;
+	mem = malloc_at(current_thread(), preload_site(), size, 0, CM_FRAME_ADDRESS());
+	in_cmonitor = 0;
+	return mem;
+}
+
+void free(void* mem)
+{
+	if (!mem || is_bootstrap(mem) || !real_ready())
+		return;
+	if (bypass()) {
+		real.free(mem);
+		return;
+	}
+	in_cmonitor = 1;
+	free_at(current_thread(), preload_site(), mem);
+	in_cmonitor = 0;
+}
+
+void* calloc(size_t num, size_t size)
+{
+	void* mem;
+
+	if (size != 0 && num > SIZE_MAX / size) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	if (!real_ready())
+		return bootstrap_alloc(num * size);
+	if (bypass())
+		return real.calloc(num, size);
+	in_cmonitor = 1;
+	mem = calloc_at(current_thread(), preload_site(), num, size, CM_FRAME_ADDRESS());
+	in_cmonitor = 0;
+	return mem;
+}
+
+void* realloc(void* mem, size_t size)
+{
+	void* new_mem;
+	size_t old_size;
+
+	if (mem && is_bootstrap(mem)) {
+		new_mem = malloc(size);
+		old_size = bootstrap_size(mem);
+		if (new_mem)
+			memcpy(new_mem, mem, old_size < size ? old_size : size);
+		return new_mem;
+	}
+	if (!real_ready())
+		return bootstrap_alloc(size);
+	if (bypass())
+		return real.realloc(mem, size);
+	/* cm_realloc takes a failure for out of memory */
+	if (mem && size == 0) {
+		free(mem);
+		return NULL;
+	}
+	in_cmonitor = 1;
+	new_mem = realloc_at(current_thread(), preload_site(), mem, size, CM_FRAME_ADDRESS());
+	in_cmonitor = 0;
+	return new_mem;
+}
+
+int posix_memalign(void** out, size_t alignment, size_t size)
+{
+	int err;
+
+	if (!real_ready())
+		return ENOMEM;
+	err = real.posix_memalign(out, alignment, size);
+	if (err || bypass())
+		return err;
+	in_cmonitor = 1;
+	track_block(current_thread(), preload_site(), *out, size, CM_FRAME_ADDRESS());
+	in_cmonitor = 0;
+	return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+	void* mem;
+
+	if (!real_ready()) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	mem = real.aligned_alloc(alignment, size);
+	if (!mem || bypass())
+		return mem;
+	in_cmonitor = 1;
+	track_block(current_thread(), preload_site(), mem, size, CM_FRAME_ADDRESS());
+	in_cmonitor = 0;
+	return mem;
+}
@@ -0,0 +1,111 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Bounded ring of fixed size items: once full, each push drops the oldest
+ * one. Holds the samples of the memory timeline and of the resident memory.
+ *
+ * Not thread safe: the caller serializes the pushes and the copies.
+ */
+
+#ifndef CMONITOR_CM_RING_H
+#define CMONITOR_CM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_ring {
+	unsigned char* items;
+	size_t item_size;
+	size_t capacity;
+	size_t head;  /* next slot written */
+	size_t count; /* valid items, at most capacity */
+} cm_ring;
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int    cm_ring_create (cm_ring* ring, size_t item_size, size_t capacity);
+static void   cm_ring_destroy(cm_ring* ring);
+static void   cm_ring_push   (cm_ring* ring, const void* item);
+static size_t cm_ring_copy   (const cm_ring* ring, void* out, size_t max_items);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static int cm_ring_create(cm_ring* ring, size_t item_size, size_t capacity)
+{
+	ring->items = NULL;
+	if (item_size != 0 && capacity <= SIZE_MAX / item_size)
+		ring->items = malloc(capacity * item_size);
+	ring->item_size = item_size;
+	ring->capacity = ring->items ? capacity : 0;
+	ring->head = 0;
+	ring->count = 0;
+	return ring->items != NULL;
+}
+
+static void cm_ring_destroy(cm_ring* ring)
+{
+	free(ring->items);
+	ring->items = NULL;
+	ring->capacity = ring->head = ring->count = 0;
+}
+
+static void cm_ring_push(cm_ring* ring, const void* item)
+{
+	if (ring->capacity == 0)
+		return;
+	memcpy(ring->items + ring->head * ring->item_size, item, ring->item_size);
+	ring->head = (ring->head + 1) % ring->capacity;
+	if (ring->count < ring->capacity)
+		++ring->count;
+}
+
+/* Copy the latest max_items items, oldest first. */
+static size_t cm_ring_copy(const cm_ring* ring, void* out, size_t max_items)
+{
+	size_t n = ring->count < max_items ? ring->count : max_items;
+	size_t pos, first;
+
+	if (n == 0)
+		return 0;
+	pos = (ring->head + ring->capacity - n) % ring->capacity;
+	/* at most two runs: up to the end of the buffer, then from its start */
+	first = ring->capacity - pos < n ? ring->capacity - pos : n;
+	memcpy(out, ring->items + pos * ring->item_size, first * ring->item_size);
+	memcpy((unsigned char*)out + first * ring->item_size, ring->items,
+		   (n - first) * ring->item_size);
+	return n;
+}
+
+#endif /* CMONITOR_CM_RING_H */
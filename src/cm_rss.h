@@ -0,0 +1,132 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Resident memory of the process as the OS sees it. cm.c keeps the samples
+ * taken of it in a cm_ring.
+ *
+ * On Linux the resident set comes from /proc/self/statm and the anonymous
+ * memory from /proc/self/smaps_rollup (Linux 4.14 on), both read with plain
+ * open/read so that sampling never goes through malloc. Windows reports the
+ * working set and the private bytes, macOS the resident size only.
+ */
+
+#ifndef CMONITOR_CM_RSS_H
+#define CMONITOR_CM_RSS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmonitor/cm.h"
+#include "cm_platform.h"
+
+#if defined(_WIN32)
+#  include <psapi.h>
+#elif defined(__APPLE__)
+#  include <mach/mach.h>
+#endif /* _WIN32 */
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int cm_rss_read(uint64_t* rss, uint64_t* anon);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+#if defined(__linux__)
+/* Read up to size - 1 bytes of a small file, NUL terminated. */
+static int cm_rss_read_file(const char* path, char* buf, size_t size)
+{
+	ssize_t n;
+	size_t len = 0;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return 0;
+	while (len < size - 1 && (n = read(fd, buf + len, size - 1 - len)) > 0)
+		len += (size_t)n;
+	close(fd);
+	buf[len] = '\0';
+	return len > 0;
+}
+#endif /* __linux__ */
+
+/*
+ * Resident bytes of the process and, of those, the anonymous ones (0 if
+ * unknown). Returns 0 if the OS is not supported.
+ */
+static int cm_rss_read(uint64_t* rss, uint64_t* anon)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS_EX pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS*)&pmc,
+							  sizeof(pmc)))
+		return 0;
+	*rss = pmc.WorkingSetSize;
+	/* committed, not resident: the closest there is */
+	*anon = pmc.PrivateUsage < pmc.WorkingSetSize ? pmc.PrivateUsage : pmc.WorkingSetSize;
+	return 1;
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info;
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+	if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info,
+				  &count) != KERN_SUCCESS)
+		return 0;
+	*rss = info.resident_size;
+	*anon = 0;
+	return 1;
+#elif defined(__linux__)
+	char buf[2048];
+	char* p;
+	unsigned long long pages;
+
+	/* "size resident shared text lib data dt", in pages */
+	if (!cm_rss_read_file("/proc/self/statm", buf, sizeof(buf)))
+		return 0;
+	p = strchr(buf, ' ');
+	if (!p)
+		return 0;
+	pages = strtoull(p + 1, NULL, 10);
+	*rss = (uint64_t)pages * (uint64_t)sysconf(_SC_PAGESIZE);
+	*anon = 0;
+	if (cm_rss_read_file("/proc/self/smaps_rollup", buf, sizeof(buf))) {
+		p = strstr(buf, "\nAnonymous:");
+		if (p)
+			*anon = (uint64_t)strtoull(p + strlen("\nAnonymous:"), NULL, 10) * 1024;
+	}
+	return 1;
+#else
+	*rss = *anon = 0;
+	return 0;
+#endif /* _WIN32 */
+}
+
+#endif /* CMONITOR_CM_RSS_H */
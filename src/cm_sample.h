@@ -0,0 +1,134 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Byte based Poisson sampling (CM_TRACK_SAMPLED).
+ *
+ * Every allocated byte has the same chance of being picked: a countdown of
+ * bytes, drawn from an exponential distribution with mean 'interval', is
+ * decremented by each allocation and the allocation that brings it to zero
+ * is sampled. An allocation of size bytes is then sampled with probability
+ * p = 1 - exp(-size / interval) and stands for size / p bytes, which makes
+ * the sums of the sampled weights unbiased estimates of the real totals.
+ *
+ * Most freed blocks were not sampled. A counting filter of the sampled
+ * addresses lets free skip the index lookup for them with a single load.
+ */
+
+#ifndef CMONITOR_CM_SAMPLE_H
+#define CMONITOR_CM_SAMPLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_sampler {
+	int64_t countdown; /* bytes left before the next sample */
+	uint64_t rng;
+} cm_sampler;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+/* counters in the filter of sampled addresses, a power of two */
+#define CM_SAMPLE_FILTER_BITS 14
+#define CM_SAMPLE_FILTER_SIZE ((size_t)1 << CM_SAMPLE_FILTER_BITS)
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void   cm_sampler_init  (cm_sampler* s, uint64_t seed, size_t interval);
+static int    cm_sampler_take  (cm_sampler* s, size_t size, size_t interval);
+static size_t cm_sample_weight (size_t size, size_t interval);
+static size_t cm_sample_filter_slot(const void* mem);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+/* xorshift64* */
+static uint64_t cm_sampler_rand(cm_sampler* s)
+{
+	s->rng ^= s->rng >> 12;
+	s->rng ^= s->rng << 25;
+	s->rng ^= s->rng >> 27;
+	return s->rng * 0x2545f4914f6cdd1dULL;
+}
+
+/* Bytes until the next sample, exponentially distributed. */
+static int64_t cm_sampler_next(cm_sampler* s, size_t interval)
+{
+	/* uniform in (0, 1] so the log is finite */
+	double u = (double)((cm_sampler_rand(s) >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double n = -log(u) * (double)interval;
+
+	if (n < 1.0)
+		return 1;
+	if (n > 4e18)
+		return (int64_t)4e18;
+	return (int64_t)n;
+}
+
+static void cm_sampler_init(cm_sampler* s, uint64_t seed, size_t interval)
+{
+	s->rng = seed ? seed : 0x9e3779b97f4a7c15ULL;
+	s->countdown = cm_sampler_next(s, interval);
+}
+
+/* Account for an allocation of size bytes, returns 1 if it is sampled. */
+static int cm_sampler_take(cm_sampler* s, size_t size, size_t interval)
+{
+	s->countdown -= (int64_t)size;
+	if (s->countdown > 0)
+		return 0;
+	s->countdown = cm_sampler_next(s, interval);
+	return 1;
+}
+
+/* Bytes a sampled allocation of size bytes stands for. */
+static size_t cm_sample_weight(size_t size, size_t interval)
+{
+	double p;
+
+	if (size == 0)
+		return 0;
+	p = -expm1(-(double)size / (double)interval);
+	return p > 0.0 ? (size_t)((double)size / p + 0.5) : size;
+}
+
+/* Counter of the filter covering mem. */
+static size_t cm_sample_filter_slot(const void* mem)
+{
+	/* fibonacci hashing, blocks are at least 16 bytes apart */
+	return (size_t)((((uint64_t)(uintptr_t)mem >> 4) * 0x9e3779b97f4a7c15ULL)
+					>> (64 - CM_SAMPLE_FILTER_BITS));
+}
+
+#endif /* CMONITOR_CM_SAMPLE_H */
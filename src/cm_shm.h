@@ -0,0 +1,97 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Named shared memory holding a cm_shm_segment. The writer side of its
+ * seqlock is in cm.c (shm_create, shm_write), the reader side in
+ * tools/cm_top.c (shm_attach, shm_read).
+ *
+ * POSIX systems use shm_open, which needs -lrt with glibc before 2.34.
+ * Windows uses a file mapping backed by the paging file: it goes away with
+ * the last handle, so there is nothing to unlink.
+ *
+ * Only one thread may write a segment at a time; readers never block it.
+ */
+
+#ifndef CMONITOR_CM_SHM_H
+#define CMONITOR_CM_SHM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmonitor/shm.h"
+#include "cm_platform.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_shm_map {
+	cm_shm_segment* seg;
+	char name[64];
+#if defined(_WIN32)
+	HANDLE mapping;
+#endif /* _WIN32 */
+} cm_shm_map;
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void cm_shm_default_name(char* name, size_t size, unsigned long pid);
+static void cm_shm_close       (cm_shm_map* map, int unlink);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static void cm_shm_default_name(char* name, size_t size, unsigned long pid)
+{
+#if defined(_WIN32)
+	snprintf(name, size, "Local\\cmonitor.%lu", pid);
+#else
+	snprintf(name, size, "/cmonitor.%lu", pid);
+#endif /* _WIN32 */
+}
+
+/* Unmap the segment and, if unlink, remove its name. */
+static void cm_shm_close(cm_shm_map* map, int unlink)
+{
+	if (!map->seg)
+		return;
+#if defined(_WIN32)
+	(void)unlink;
+	UnmapViewOfFile(map->seg);
+	CloseHandle(map->mapping);
+#else
+	munmap(map->seg, sizeof(cm_shm_segment));
+	if (unlink)
+		shm_unlink(map->name);
+#endif /* _WIN32 */
+	map->seg = NULL;
+}
+
+#endif /* CMONITOR_CM_SHM_H */
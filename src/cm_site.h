@@ -0,0 +1,367 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Table of the call sites, the (file, line) pairs passed by the cm_*
+ * macros, with the allocation profile of each one.
+ *
+ * Sites are interned once and never move or go away until the table is
+ * destroyed, so records and caches can keep pointers to them. Counters are
+ * updated in place; with 'shared' set they are updated atomically since
+ * any thread can free a block allocated at a given site.
+ *
+ * Interning is not thread safe: the caller serializes it.
+ */
+
+#ifndef CMONITOR_CM_SITE_H
+#define CMONITOR_CM_SITE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmonitor/cm.h"
+#include "cm_platform.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_site {
+	const char* filename;           /* as passed by the caller */
+	const char* basename;           /* filename without its path */
+	int line;
+	uint32_t id;                    /* 1-based, in interning order */
+
+	volatile uint32_t live_bytes;
+	volatile uint32_t live_count;
+	volatile uint32_t alloc_count;
+	volatile uint32_t alloc_bytes;
+	volatile uint32_t free_count;
+	volatile uint32_t peak_bytes;   /* highest live_bytes seen */
+	volatile uint32_t remote_frees; /* frees by another thread than the allocating one */
+
+	/* blocks freed by lifetime, see CM_TRACK_LIFETIMES */
+	volatile uint32_t lifetimes[CM_LIFETIME_BUCKETS];
+	volatile uint32_t short_lived;  /* of those, freed within CM_SHORT_LIVED_NS */
+
+	/* reallocs of tracked blocks made here */
+	volatile uint32_t realloc_count;
+	volatile uint32_t realloc_moves;   /* the block moved */
+	volatile uint32_t grow_count;
+	volatile uint32_t slow_grow_count; /* growths under CM_GROWTH_NUM / CM_GROWTH_DEN */
+	volatile uint64_t grow_from;       /* bytes before and after the growths */
+	volatile uint64_t grow_to;
+	volatile uint64_t copied_bytes;
+	volatile uint64_t wasted_bytes;    /* see cm_site_on_realloc */
+} cm_site;
+
+typedef struct cm_site_table {
+	cm_site** slots;                /* hashed by file name and line */
+	size_t capacity;                /* a power of two (or zero) */
+	cm_site** by_id;                /* by_id[id - 1] */
+	size_t count;
+	size_t by_id_capacity;
+} cm_site_table;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_SITE_MIN_CAPACITY 256
+
+/* lifetimes freed within this many nanoseconds count as short */
+#ifndef CM_SHORT_LIVED_NS
+#  define CM_SHORT_LIVED_NS 10000
+#endif
+
+/* growths by a smaller factor than this are sub-geometric */
+#define CM_GROWTH_NUM 3
+#define CM_GROWTH_DEN 2
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void     cm_site_table_init    (cm_site_table* table);
+static void     cm_site_table_destroy (cm_site_table* table);
+static cm_site* cm_site_intern        (cm_site_table* table, const char* filename,
+									   const char* basename, int line);
+static size_t   cm_site_table_overhead(const cm_site_table* table);
+static void     cm_site_on_alloc      (cm_site* site, size_t size, uint32_t n, int shared);
+static void     cm_site_on_count      (cm_site* site, size_t size, int shared);
+static void     cm_site_on_free       (cm_site* site, size_t size, uint32_t n, int shared);
+static void     cm_site_on_remote_free(cm_site* site, uint32_t n, int shared);
+static void     cm_site_on_resize     (cm_site* site, size_t old_size, size_t size, int shared);
+static void     cm_site_on_lifetime   (cm_site* site, uint64_t ns, uint32_t n, int shared);
+static void     cm_site_on_realloc    (cm_site* site, size_t old_size, size_t size,
+									   int moved, uint64_t wasted, int shared);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+/*
+ * The same file may be passed through different pointers (one string per
+ * translation unit), so sites are keyed by the name, not by the pointer.
+ */
+static size_t cm_site_hash(const char* filename, int line)
+{
+	uint32_t h = 2166136261u; /* FNV-1a */
+
+	while (*filename) {
+		h ^= (unsigned char)*filename++;
+		h *= 16777619u;
+	}
+	h ^= (uint32_t)line;
+	h *= 0x9e3779b1u;
+	return (size_t)(h ^ (h >> 15));
+}
+
+static int cm_site_equals(const cm_site* site, const char* filename, int line)
+{
+	return site->line == line
+		&& (site->filename == filename || strcmp(site->filename, filename) == 0);
+}
+
+static void cm_site_table_init(cm_site_table* table)
+{
+	table->slots = NULL;
+	table->capacity = 0;
+	table->by_id = NULL;
+	table->count = 0;
+	table->by_id_capacity = 0;
+}
+
+static void cm_site_table_destroy(cm_site_table* table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; ++i)
+		cm_aligned_free(table->by_id[i]);
+	free(table->slots);
+	free(table->by_id);
+	cm_site_table_init(table);
+}
+
+static int cm_site_table_grow(cm_site_table* table)
+{
+	cm_site** slots;
+	size_t capacity, i, pos;
+
+	capacity = table->capacity ? table->capacity * 2 : CM_SITE_MIN_CAPACITY;
+	slots = calloc(capacity, sizeof(cm_site*));
+	if (!slots)
+		return 0;
+	for (i = 0; i < table->count; ++i) {
+		pos = cm_site_hash(table->by_id[i]->filename, table->by_id[i]->line);
+		while (slots[pos & (capacity - 1)])
+			++pos;
+		slots[pos & (capacity - 1)] = table->by_id[i];
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->capacity = capacity;
+	return 1;
+}
+
+/*
+ * Get the site of (filename, line), adding it if new. basename can be NULL
+ * if not known yet. Returns NULL if out of memory.
+ */
+static cm_site* cm_site_intern(cm_site_table* table, const char* filename,
+							   const char* basename, int line)
+{
+	cm_site** by_id;
+	cm_site* site;
+	size_t pos, n;
+
+	if (table->capacity) {
+		pos = cm_site_hash(filename, line);
+		while ((site = table->slots[pos & (table->capacity - 1)]) != NULL) {
+			if (cm_site_equals(site, filename, line))
+				return site;
+			++pos;
+		}
+	}
+	/* keep the load factor under 1/2 */
+	if ((table->count + 1) * 2 > table->capacity && !cm_site_table_grow(table))
+		return NULL;
+	if (table->count == table->by_id_capacity) {
+		n = table->by_id_capacity ? table->by_id_capacity * 2 : CM_SITE_MIN_CAPACITY;
+		by_id = realloc(table->by_id, n * sizeof(cm_site*));
+		if (!by_id)
+			return NULL;
+		table->by_id = by_id;
+		table->by_id_capacity = n;
+	}
+	/* a line of its own: sites of different threads are updated concurrently */
+	site = cm_aligned_malloc(CM_CACHE_LINE, sizeof(cm_site));
+	if (!site)
+		return NULL;
+	memset(site, 0, sizeof(cm_site));
+	site->filename = filename;
+	site->basename = basename ? basename : cm_basename(filename);
+	site->line = line;
+	site->id = (uint32_t)table->count + 1;
+	table->by_id[table->count++] = site;
+	pos = cm_site_hash(filename, line);
+	while (table->slots[pos & (table->capacity - 1)])
+		++pos;
+	table->slots[pos & (table->capacity - 1)] = site;
+	return site;
+}
+
+/* Bytes taken from the C allocator. */
+static size_t cm_site_table_overhead(const cm_site_table* table)
+{
+	size_t site_size;
+
+	site_size = (sizeof(cm_site) + CM_CACHE_LINE - 1) & ~(size_t)(CM_CACHE_LINE - 1);
+	return table->capacity * sizeof(cm_site*)
+		+ table->by_id_capacity * sizeof(cm_site*)
+		+ table->count * site_size;
+}
+
+static uint32_t cm_site_add(volatile uint32_t* p, uint32_t v, int shared)
+{
+	if (shared)
+		return cm_atomic_add_u32(p, v);
+	cm_counter_add_u32(p, v);
+	return cm_atomic_load_u32(p);
+}
+
+/* Byte sums, which outgrow 32 bits long before the counts do. */
+static void cm_site_add_u64(volatile uint64_t* p, uint64_t v, int shared)
+{
+	if (shared)
+		cm_atomic_add_u64(p, v);
+	else
+		cm_counter_add_u64(p, v);
+}
+
+static void cm_site_update_peak(cm_site* site, uint32_t live, int shared)
+{
+	uint32_t peak = cm_atomic_load_u32(&site->peak_bytes);
+
+	while (live > peak) {
+		if (!shared) {
+			cm_atomic_store_u32(&site->peak_bytes, live);
+			return;
+		}
+		if (cm_atomic_cas_u32(&site->peak_bytes, peak, live))
+			return;
+		peak = cm_atomic_load_u32(&site->peak_bytes);
+	}
+}
+
+/* n blocks of size bytes in total (more than one for a sampled block) */
+static void cm_site_on_alloc(cm_site* site, size_t size, uint32_t n, int shared)
+{
+	uint32_t live;
+
+	cm_site_add(&site->alloc_count, n, shared);
+	cm_site_add(&site->alloc_bytes, (uint32_t)size, shared);
+	cm_site_add(&site->live_count, n, shared);
+	live = cm_site_add(&site->live_bytes, (uint32_t)size, shared);
+	cm_site_update_peak(site, live, shared);
+}
+
+/* A block of the site without a record (CM_LEVEL_SITES). */
+static void cm_site_on_count(cm_site* site, size_t size, int shared)
+{
+	cm_site_add(&site->alloc_count, 1, shared);
+	cm_site_add(&site->alloc_bytes, (uint32_t)size, shared);
+}
+
+static void cm_site_on_free(cm_site* site, size_t size, uint32_t n, int shared)
+{
+	cm_site_add(&site->free_count, n, shared);
+	cm_site_add(&site->live_count, (uint32_t)0 - n, shared);
+	cm_site_add(&site->live_bytes, (uint32_t)0 - (uint32_t)size, shared);
+}
+
+/* The blocks just freed were freed by another thread than their own. */
+static void cm_site_on_remote_free(cm_site* site, uint32_t n, int shared)
+{
+	cm_site_add(&site->remote_frees, n, shared);
+}
+
+/* A block of the site changed size in place (realloc). */
+static void cm_site_on_resize(cm_site* site, size_t old_size, size_t size, int shared)
+{
+	uint32_t live;
+
+	live = cm_site_add(&site->live_bytes, (uint32_t)size - (uint32_t)old_size, shared);
+	cm_site_update_peak(site, live, shared);
+}
+
+/* Bucket of a lifetime, see CM_LIFETIME_BUCKETS. */
+static unsigned cm_site_lifetime_bucket(uint64_t ns)
+{
+	unsigned b = 0;
+
+	ns >>= 8;
+	while (ns && b < CM_LIFETIME_BUCKETS - 1) {
+		ns >>= 1;
+		++b;
+	}
+	return b;
+}
+
+/* n blocks of the site freed ns nanoseconds after their allocation */
+static void cm_site_on_lifetime(cm_site* site, uint64_t ns, uint32_t n, int shared)
+{
+	cm_site_add(&site->lifetimes[cm_site_lifetime_bucket(ns)], n, shared);
+	if (ns < CM_SHORT_LIVED_NS)
+		cm_site_add(&site->short_lived, n, shared);
+}
+
+/*
+ * A realloc made here resized a block from old_size to size, moving it if
+ * moved. wasted is how much the copies of the block's chain grew past its
+ * size: growing geometrically the copies never add up to more than the
+ * final size, everything above it could have been avoided.
+ */
+static void cm_site_on_realloc(cm_site* site, size_t old_size, size_t size,
+							   int moved, uint64_t wasted, int shared)
+{
+	cm_site_add(&site->realloc_count, 1, shared);
+	if (moved) {
+		cm_site_add(&site->realloc_moves, 1, shared);
+		cm_site_add_u64(&site->copied_bytes, old_size < size ? old_size : size, shared);
+	}
+	if (size > old_size) {
+		cm_site_add(&site->grow_count, 1, shared);
+		if (size * CM_GROWTH_DEN < old_size * CM_GROWTH_NUM)
+			cm_site_add(&site->slow_grow_count, 1, shared);
+		cm_site_add_u64(&site->grow_from, old_size, shared);
+		cm_site_add_u64(&site->grow_to, size, shared);
+	}
+	if (wasted > 0)
+		cm_site_add_u64(&site->wasted_bytes, wasted, shared);
+}
+
+#endif /* CMONITOR_CM_SITE_H */
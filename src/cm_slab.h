@@ -0,0 +1,249 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Fixed-size object allocator used for cmonitor's own metadata.
+ *
+ * Objects are carved out of big pages taken from the C allocator and are
+ * never given back to it until cm_slab_destroy() releases all the pages at
+ * once. Freed objects go back to a free list threaded through the objects
+ * themselves.
+ *
+ * To keep threads off the slab lock every thread owns a magazine, a small
+ * stack of free objects. Allocations pop from it and frees push to it; the
+ * lock is only taken to move half a magazine from/to the shared free list.
+ * The magazine is passed explicitly so the caller decides where it lives
+ * (usually a CM_TLS variable).
+ */
+
+#ifndef CMONITOR_CM_SLAB_H
+#define CMONITOR_CM_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cm_platform.h"
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_SLAB_PAGE_SIZE     (64 * 1024)
+#define CM_SLAB_MAGAZINE_SIZE 64
+#define CM_SLAB_ALIGN         (2 * sizeof(void*))
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_slab_obj {
+	struct cm_slab_obj* next;
+} cm_slab_obj;
+
+typedef struct cm_slab_page {
+	struct cm_slab_page* next;
+} cm_slab_page;
+
+typedef struct cm_slab {
+	cm_mutex lock;
+	size_t obj_size;
+	size_t objs_per_page;
+	uint32_t generation;  /* bumped on destroy, invalidates magazines */
+
+	cm_slab_page* pages;
+	size_t page_count;
+	cm_slab_obj* free_list;
+	size_t free_count;    /* objects in free_list */
+	char* bump;           /* unused tail of the newest page */
+	size_t bump_left;     /* objects left at bump */
+} cm_slab;
+
+typedef struct cm_slab_magazine {
+	uint32_t generation;
+	size_t count;
+	void* objs[CM_SLAB_MAGAZINE_SIZE];
+} cm_slab_magazine;
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void   cm_slab_init    (cm_slab* slab, size_t obj_size);
+static void   cm_slab_destroy (cm_slab* slab);
+static void*  cm_slab_alloc   (cm_slab* slab, cm_slab_magazine* mag);
+static void   cm_slab_free    (cm_slab* slab, cm_slab_magazine* mag, void* obj);
+static void   cm_slab_flush   (cm_slab* slab, cm_slab_magazine* mag);
+static size_t cm_slab_overhead(cm_slab* slab);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static size_t cm_slab_page_header(void)
+{
+	return (sizeof(cm_slab_page) + CM_SLAB_ALIGN - 1) & ~(CM_SLAB_ALIGN - 1);
+}
+
+static void cm_slab_init(cm_slab* slab, size_t obj_size)
+{
+	if (obj_size < sizeof(cm_slab_obj))
+		obj_size = sizeof(cm_slab_obj);
+	obj_size = (obj_size + CM_SLAB_ALIGN - 1) & ~(CM_SLAB_ALIGN - 1);
+	cm_mutex_init(&slab->lock);
+	slab->obj_size = obj_size;
+	slab->objs_per_page = (CM_SLAB_PAGE_SIZE - cm_slab_page_header()) / obj_size;
+	slab->pages = NULL;
+	slab->page_count = 0;
+	slab->free_list = NULL;
+	slab->free_count = 0;
+	slab->bump = NULL;
+	slab->bump_left = 0;
+}
+
+/* Release every page in one go, objects still in use included. */
+static void cm_slab_destroy(cm_slab* slab)
+{
+	cm_slab_page* page;
+	cm_slab_page* next;
+
+	for (page = slab->pages; page; page = next) {
+		next = page->next;
+		free(page);
+	}
+	slab->pages = NULL;
+	slab->page_count = 0;
+	slab->free_list = NULL;
+	slab->free_count = 0;
+	slab->bump = NULL;
+	slab->bump_left = 0;
+	++slab->generation;
+	cm_mutex_destroy(&slab->lock);
+}
+
+/* Take one object from the shared pool. Call with the lock held. */
+static void* cm_slab_take(cm_slab* slab)
+{
+	cm_slab_page* page;
+	void* obj;
+
+	if (slab->free_list) {
+		obj = slab->free_list;
+		slab->free_list = slab->free_list->next;
+		--slab->free_count;
+		return obj;
+	}
+	if (slab->bump_left == 0) {
+		page = malloc(CM_SLAB_PAGE_SIZE);
+		if (!page)
+			return NULL;
+		page->next = slab->pages;
+		slab->pages = page;
+		++slab->page_count;
+		slab->bump = (char*)page + cm_slab_page_header();
+		slab->bump_left = slab->objs_per_page;
+	}
+	obj = slab->bump;
+	slab->bump += slab->obj_size;
+	--slab->bump_left;
+	return obj;
+}
+
+static void cm_slab_check_magazine(cm_slab* slab, cm_slab_magazine* mag)
+{
+	/* objects of a destroyed slab are gone */
+	if (mag->generation != slab->generation) {
+		mag->generation = slab->generation;
+		mag->count = 0;
+	}
+}
+
+static void* cm_slab_alloc(cm_slab* slab, cm_slab_magazine* mag)
+{
+	void* obj;
+
+	cm_slab_check_magazine(slab, mag);
+	if (mag->count == 0) {
+		/* refill half a magazine */
+		cm_mutex_lock(&slab->lock);
+		while (mag->count < CM_SLAB_MAGAZINE_SIZE / 2) {
+			obj = cm_slab_take(slab);
+			if (!obj)
+				break;
+			mag->objs[mag->count++] = obj;
+		}
+		cm_mutex_unlock(&slab->lock);
+		if (mag->count == 0)
+			return NULL;
+	}
+	return mag->objs[--mag->count];
+}
+
+static void cm_slab_free(cm_slab* slab, cm_slab_magazine* mag, void* obj)
+{
+	cm_slab_obj* o;
+
+	cm_slab_check_magazine(slab, mag);
+	if (mag->count == CM_SLAB_MAGAZINE_SIZE) {
+		/* give half a magazine back */
+		cm_mutex_lock(&slab->lock);
+		while (mag->count > CM_SLAB_MAGAZINE_SIZE / 2) {
+			o = mag->objs[--mag->count];
+			o->next = slab->free_list;
+			slab->free_list = o;
+			++slab->free_count;
+		}
+		cm_mutex_unlock(&slab->lock);
+	}
+	mag->objs[mag->count++] = obj;
+}
+
+/* Give every object of a magazine back, e.g. when its thread exits. */
+static void cm_slab_flush(cm_slab* slab, cm_slab_magazine* mag)
+{
+	cm_slab_obj* o;
+
+	cm_slab_check_magazine(slab, mag);
+	cm_mutex_lock(&slab->lock);
+	while (mag->count > 0) {
+		o = mag->objs[--mag->count];
+		o->next = slab->free_list;
+		slab->free_list = o;
+		++slab->free_count;
+	}
+	cm_mutex_unlock(&slab->lock);
+}
+
+/* Bytes taken from the C allocator. */
+static size_t cm_slab_overhead(cm_slab* slab)
+{
+	size_t bytes;
+
+	cm_mutex_lock(&slab->lock);
+	bytes = slab->page_count * CM_SLAB_PAGE_SIZE;
+	cm_mutex_unlock(&slab->lock);
+	return bytes;
+}
+
+#endif /* CMONITOR_CM_SLAB_H */
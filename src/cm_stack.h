@@ -0,0 +1,206 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Hash-consed table of call stacks: each distinct stack is stored once and
+ * referred to by its id.
+ *
+ * Stacks never move or go away until the table is destroyed. Not thread
+ * safe: the caller serializes interning.
+ */
+
+#ifndef CMONITOR_CM_STACK_H
+#define CMONITOR_CM_STACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_stack {
+	uint64_t hash;
+	uint32_t id;             /* 1-based, in interning order */
+	uint32_t depth;
+	struct cm_stack* next;   /* same bucket */
+	void* frames[1];         /* return addresses, innermost first */
+} cm_stack;
+
+typedef struct cm_stack_table {
+	cm_stack** buckets;
+	size_t capacity;         /* a power of two (or zero) */
+	cm_stack** by_id;        /* by_id[id - 1] */
+	size_t count;
+	size_t by_id_capacity;
+	size_t bytes;            /* taken by the stacks themselves */
+} cm_stack_table;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_STACK_MIN_CAPACITY 256
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void      cm_stack_table_init    (cm_stack_table* table);
+static void      cm_stack_table_destroy (cm_stack_table* table);
+static uint64_t  cm_stack_hash          (void* const* frames, int depth);
+static int       cm_stack_equals        (const cm_stack* stack, void* const* frames, int depth);
+static cm_stack* cm_stack_intern        (cm_stack_table* table, void* const* frames,
+										 int depth, uint64_t hash);
+static cm_stack* cm_stack_get           (const cm_stack_table* table, uint32_t id);
+static size_t    cm_stack_table_overhead(const cm_stack_table* table);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static void cm_stack_table_init(cm_stack_table* table)
+{
+	table->buckets = NULL;
+	table->capacity = 0;
+	table->by_id = NULL;
+	table->count = 0;
+	table->by_id_capacity = 0;
+	table->bytes = 0;
+}
+
+static void cm_stack_table_destroy(cm_stack_table* table)
+{
+	size_t i;
+
+	for (i = 0; i < table->count; ++i)
+		free(table->by_id[i]);
+	free(table->buckets);
+	free(table->by_id);
+	cm_stack_table_init(table);
+}
+
+static uint64_t cm_stack_hash(void* const* frames, int depth)
+{
+	uint64_t h = (uint64_t)depth;
+	int i;
+
+	for (i = 0; i < depth; ++i) {
+		h ^= (uint64_t)(uintptr_t)frames[i];
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	return h;
+}
+
+static int cm_stack_equals(const cm_stack* stack, void* const* frames, int depth)
+{
+	return stack->depth == (uint32_t)depth
+		&& memcmp(stack->frames, frames, (size_t)depth * sizeof(void*)) == 0;
+}
+
+static int cm_stack_table_grow(cm_stack_table* table)
+{
+	cm_stack** buckets;
+	cm_stack* s;
+	size_t capacity, i, pos;
+
+	capacity = table->capacity ? table->capacity * 2 : CM_STACK_MIN_CAPACITY;
+	buckets = calloc(capacity, sizeof(cm_stack*));
+	if (!buckets)
+		return 0;
+	for (i = 0; i < table->count; ++i) {
+		s = table->by_id[i];
+		pos = (size_t)s->hash & (capacity - 1);
+		s->next = buckets[pos];
+		buckets[pos] = s;
+	}
+	free(table->buckets);
+	table->buckets = buckets;
+	table->capacity = capacity;
+	return 1;
+}
+
+/*
+ * Get the stack made of frames, adding it if new. hash is
+ * cm_stack_hash(frames, depth). Returns NULL if out of memory.
+ */
+static cm_stack* cm_stack_intern(cm_stack_table* table, void* const* frames,
+								 int depth, uint64_t hash)
+{
+	cm_stack** by_id;
+	cm_stack* s;
+	size_t pos, n, size;
+
+	if (table->capacity) {
+		for (s = table->buckets[(size_t)hash & (table->capacity - 1)]; s; s = s->next) {
+			if (s->hash == hash && cm_stack_equals(s, frames, depth))
+				return s;
+		}
+	}
+	if (table->count + 1 > table->capacity && !cm_stack_table_grow(table))
+		return NULL;
+	if (table->count == table->by_id_capacity) {
+		n = table->by_id_capacity ? table->by_id_capacity * 2 : CM_STACK_MIN_CAPACITY;
+		by_id = realloc(table->by_id, n * sizeof(cm_stack*));
+		if (!by_id)
+			return NULL;
+		table->by_id = by_id;
+		table->by_id_capacity = n;
+	}
+	size = offsetof(cm_stack, frames) + (size_t)(depth > 0 ? depth : 1) * sizeof(void*);
+	s = malloc(size);
+	if (!s)
+		return NULL;
+	s->hash = hash;
+	s->id = (uint32_t)table->count + 1;
+	s->depth = (uint32_t)depth;
+	memcpy(s->frames, frames, (size_t)depth * sizeof(void*));
+	pos = (size_t)hash & (table->capacity - 1);
+	s->next = table->buckets[pos];
+	table->buckets[pos] = s;
+	table->by_id[table->count++] = s;
+	table->bytes += size;
+	return s;
+}
+
+/* NULL for id 0 (no stack). */
+static cm_stack* cm_stack_get(const cm_stack_table* table, uint32_t id)
+{
+	if (id == 0 || id > table->count)
+		return NULL;
+	return table->by_id[id - 1];
+}
+
+/* Bytes taken from the C allocator. */
+static size_t cm_stack_table_overhead(const cm_stack_table* table)
+{
+	return table->capacity * sizeof(cm_stack*)
+		+ table->by_id_capacity * sizeof(cm_stack*)
+		+ table->bytes;
+}
+
+#endif /* CMONITOR_CM_STACK_H */
@@ -0,0 +1,278 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Table of the memory tags (cm_tag_push), a tree: the same name pushed
+ * under two different tags makes two different tags.
+ *
+ * Tags are interned by (parent, name) under the caller's lock. Records
+ * keep the 16-bit id of their tag, so getting a tag from its id must not
+ * need the lock: the tags are reached through fixed chunks of pointers
+ * that never move, published with a release store.
+ */
+
+#ifndef CMONITOR_CM_TAG_H
+#define CMONITOR_CM_TAG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmonitor/cm.h"
+#include "cm_platform.h"
+#include "cm_site.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_tag {
+	const char* name;               /* a copy, owned by the table */
+	uint32_t id;                    /* 1-based, in interning order */
+	uint32_t parent;                /* id of the enclosing tag, 0 if none */
+	uint32_t depth;                 /* 0 for a tag without parent */
+
+	/* blocks allocated with this tag innermost */
+	volatile uint32_t live_bytes;
+	volatile uint32_t live_count;
+	volatile uint32_t alloc_count;
+	volatile uint32_t alloc_bytes;
+	volatile uint32_t free_count;
+	volatile uint32_t peak_bytes;   /* highest live_bytes seen */
+} cm_tag;
+
+/* ids are stored in 16 bits */
+#define CM_TAG_MAX    65535
+#define CM_TAG_CHUNK  256
+#define CM_TAG_CHUNKS ((CM_TAG_MAX + CM_TAG_CHUNK - 1) / CM_TAG_CHUNK)
+
+typedef struct cm_tag_table {
+	cm_tag** slots;                 /* hashed by parent and name */
+	size_t capacity;                /* a power of two (or zero) */
+	cm_tag** volatile chunks[CM_TAG_CHUNKS]; /* id - 1 split in chunk, index */
+	size_t count;
+} cm_tag_table;
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_TAG_MIN_CAPACITY 64
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static void    cm_tag_table_init    (cm_tag_table* table);
+static void    cm_tag_table_destroy (cm_tag_table* table);
+static cm_tag* cm_tag_intern        (cm_tag_table* table, uint32_t parent, const char* name);
+static cm_tag* cm_tag_get           (const cm_tag_table* table, uint32_t id);
+static size_t  cm_tag_table_overhead(const cm_tag_table* table);
+static void    cm_tag_on_alloc      (cm_tag* tag, size_t size, uint32_t n, int shared);
+static void    cm_tag_on_free       (cm_tag* tag, size_t size, uint32_t n, int shared);
+static void    cm_tag_on_resize     (cm_tag* tag, size_t old_size, size_t size, int shared);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static size_t cm_tag_hash(uint32_t parent, const char* name)
+{
+	uint32_t h = 2166136261u; /* FNV-1a */
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	h ^= parent;
+	h *= 0x9e3779b1u;
+	return (size_t)(h ^ (h >> 15));
+}
+
+static void cm_tag_table_init(cm_tag_table* table)
+{
+	memset(table, 0, sizeof(cm_tag_table));
+}
+
+static void cm_tag_table_destroy(cm_tag_table* table)
+{
+	cm_tag* tag;
+	size_t i;
+
+	for (i = 0; i < table->count; ++i) {
+		tag = table->chunks[i / CM_TAG_CHUNK][i % CM_TAG_CHUNK];
+		free((void*)tag->name);
+		cm_aligned_free(tag);
+	}
+	for (i = 0; i < CM_TAG_CHUNKS; ++i)
+		free(table->chunks[i]);
+	free(table->slots);
+	cm_tag_table_init(table);
+}
+
+static cm_tag* cm_tag_get(const cm_tag_table* table, uint32_t id)
+{
+	cm_tag** chunk;
+
+	if (id == 0 || id > CM_TAG_MAX)
+		return NULL;
+	chunk = cm_atomic_load_acquire_ptr((void* const volatile*)&table->chunks[(id - 1) / CM_TAG_CHUNK]);
+	return chunk ? chunk[(id - 1) % CM_TAG_CHUNK] : NULL;
+}
+
+static int cm_tag_table_grow(cm_tag_table* table)
+{
+	cm_tag** slots;
+	cm_tag* tag;
+	size_t capacity, i, pos;
+
+	capacity = table->capacity ? table->capacity * 2 : CM_TAG_MIN_CAPACITY;
+	slots = calloc(capacity, sizeof(cm_tag*));
+	if (!slots)
+		return 0;
+	for (i = 0; i < table->count; ++i) {
+		tag = table->chunks[i / CM_TAG_CHUNK][i % CM_TAG_CHUNK];
+		pos = cm_tag_hash(tag->parent, tag->name);
+		while (slots[pos & (capacity - 1)])
+			++pos;
+		slots[pos & (capacity - 1)] = tag;
+	}
+	free(table->slots);
+	table->slots = slots;
+	table->capacity = capacity;
+	return 1;
+}
+
+/*
+ * Get the tag name under parent, adding it if new. Returns NULL if out of
+ * memory or out of ids.
+ */
+static cm_tag* cm_tag_intern(cm_tag_table* table, uint32_t parent, const char* name)
+{
+	cm_tag** chunk;
+	cm_tag* tag;
+	size_t pos, len, c;
+
+	if (table->capacity) {
+		pos = cm_tag_hash(parent, name);
+		while ((tag = table->slots[pos & (table->capacity - 1)]) != NULL) {
+			if (tag->parent == parent && strcmp(tag->name, name) == 0)
+				return tag;
+			++pos;
+		}
+	}
+	if (table->count == CM_TAG_MAX)
+		return NULL;
+	/* keep the load factor under 1/2 */
+	if ((table->count + 1) * 2 > table->capacity && !cm_tag_table_grow(table))
+		return NULL;
+	c = table->count / CM_TAG_CHUNK;
+	if (!table->chunks[c]) {
+		chunk = calloc(CM_TAG_CHUNK, sizeof(cm_tag*));
+		if (!chunk)
+			return NULL;
+		cm_atomic_store_release_ptr((void* volatile*)&table->chunks[c], chunk);
+	}
+	/* a line of its own: tags of different threads are updated concurrently */
+	tag = cm_aligned_malloc(CM_CACHE_LINE, sizeof(cm_tag));
+	if (!tag)
+		return NULL;
+	memset(tag, 0, sizeof(cm_tag));
+	len = strlen(name);
+	tag->name = malloc(len + 1);
+	if (!tag->name) {
+		cm_aligned_free(tag);
+		return NULL;
+	}
+	memcpy((char*)tag->name, name, len + 1);
+	tag->id = (uint32_t)table->count + 1;
+	tag->parent = parent;
+	tag->depth = parent ? cm_tag_get(table, parent)->depth + 1 : 0;
+	/* other threads get the id through a record, published after this */
+	table->chunks[c][table->count % CM_TAG_CHUNK] = tag;
+	++table->count;
+	pos = cm_tag_hash(parent, name);
+	while (table->slots[pos & (table->capacity - 1)])
+		++pos;
+	table->slots[pos & (table->capacity - 1)] = tag;
+	return tag;
+}
+
+/* Bytes taken from the C allocator. */
+static size_t cm_tag_table_overhead(const cm_tag_table* table)
+{
+	size_t tag_size, i, n = 0;
+
+	tag_size = (sizeof(cm_tag) + CM_CACHE_LINE - 1) & ~(size_t)(CM_CACHE_LINE - 1);
+	for (i = 0; i < table->count; ++i)
+		n += tag_size + strlen(table->chunks[i / CM_TAG_CHUNK][i % CM_TAG_CHUNK]->name) + 1;
+	return n + table->capacity * sizeof(cm_tag*)
+		+ (table->count + CM_TAG_CHUNK - 1) / CM_TAG_CHUNK * CM_TAG_CHUNK * sizeof(cm_tag*);
+}
+
+static void cm_tag_update_peak(cm_tag* tag, uint32_t live, int shared)
+{
+	uint32_t peak = cm_atomic_load_u32(&tag->peak_bytes);
+
+	while (live > peak) {
+		if (!shared) {
+			cm_atomic_store_u32(&tag->peak_bytes, live);
+			return;
+		}
+		if (cm_atomic_cas_u32(&tag->peak_bytes, peak, live))
+			return;
+		peak = cm_atomic_load_u32(&tag->peak_bytes);
+	}
+}
+
+/* n blocks of size bytes in total (more than one for a sampled block) */
+static void cm_tag_on_alloc(cm_tag* tag, size_t size, uint32_t n, int shared)
+{
+	uint32_t live;
+
+	cm_site_add(&tag->alloc_count, n, shared);
+	cm_site_add(&tag->alloc_bytes, (uint32_t)size, shared);
+	cm_site_add(&tag->live_count, n, shared);
+	live = cm_site_add(&tag->live_bytes, (uint32_t)size, shared);
+	cm_tag_update_peak(tag, live, shared);
+}
+
+static void cm_tag_on_free(cm_tag* tag, size_t size, uint32_t n, int shared)
+{
+	cm_site_add(&tag->free_count, n, shared);
+	cm_site_add(&tag->live_count, (uint32_t)0 - n, shared);
+	cm_site_add(&tag->live_bytes, (uint32_t)0 - (uint32_t)size, shared);
+}
+
+/* A block of the tag changed size (realloc). */
+static void cm_tag_on_resize(cm_tag* tag, size_t old_size, size_t size, int shared)
+{
+	uint32_t live;
+
+	live = cm_site_add(&tag->live_bytes, (uint32_t)size - (uint32_t)old_size, shared);
+	cm_tag_update_peak(tag, live, shared);
+}
+
+#endif /* CMONITOR_CM_TAG_H */
@@ -0,0 +1,108 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * CSV and binary exports of the memory timeline samples, which cm.c keeps
+ * in a cm_ring.
+ */
+
+#ifndef CMONITOR_CM_TIMELINE_H
+#define CMONITOR_CM_TIMELINE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "cmonitor/cm.h"
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_TIMELINE_MAGIC       "CMTL"
+#define CM_TIMELINE_VERSION     1
+#define CM_TIMELINE_RECORD_SIZE 24
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int cm_timeline_export(FILE* out, int format,
+							  const cm_timeline_sample* samples, size_t n);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static void cm_timeline_put_u32(unsigned char* p, uint32_t v)
+{
+	p[0] = (unsigned char)v;
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)(v >> 16);
+	p[3] = (unsigned char)(v >> 24);
+}
+
+static int cm_timeline_export(FILE* out, int format,
+							  const cm_timeline_sample* samples, size_t n)
+{
+	unsigned char rec[CM_TIMELINE_RECORD_SIZE];
+	size_t i;
+
+	if (format == CM_TIMELINE_CSV) {
+		if (fprintf(out, "time_ns,live_bytes,live_blocks,alloc_rate,op_rate\n") < 0)
+			return 0;
+		for (i = 0; i < n; ++i) {
+			if (fprintf(out, "%llu,%lu,%lu,%lu,%lu\n",
+						(unsigned long long)samples[i].time_ns,
+						(unsigned long)samples[i].live_bytes,
+						(unsigned long)samples[i].live_blocks,
+						(unsigned long)samples[i].alloc_rate,
+						(unsigned long)samples[i].op_rate) < 0)
+				return 0;
+		}
+		return 1;
+	}
+	if (format != CM_TIMELINE_BINARY)
+		return 0;
+	memcpy(rec, CM_TIMELINE_MAGIC, 4);
+	cm_timeline_put_u32(rec + 4, CM_TIMELINE_VERSION);
+	cm_timeline_put_u32(rec + 8, CM_TIMELINE_RECORD_SIZE);
+	cm_timeline_put_u32(rec + 12, (uint32_t)n);
+	if (fwrite(rec, 1, 16, out) != 16)
+		return 0;
+	for (i = 0; i < n; ++i) {
+		cm_timeline_put_u32(rec, (uint32_t)samples[i].time_ns);
+		cm_timeline_put_u32(rec + 4, (uint32_t)(samples[i].time_ns >> 32));
+		cm_timeline_put_u32(rec + 8, samples[i].live_bytes);
+		cm_timeline_put_u32(rec + 12, samples[i].live_blocks);
+		cm_timeline_put_u32(rec + 16, samples[i].alloc_rate);
+		cm_timeline_put_u32(rec + 20, samples[i].op_rate);
+		if (fwrite(rec, 1, sizeof(rec), out) != sizeof(rec))
+			return 0;
+	}
+	return 1;
+}
+
+#endif /* CMONITOR_CM_TIMELINE_H */
@@ -0,0 +1,204 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Binary trace writer, see include/cmonitor/trace.h for the file format.
+ *
+ * Not thread safe: the caller serializes cm_trace_write calls.
+ */
+
+#ifndef CMONITOR_CM_TRACE_H
+#define CMONITOR_CM_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmonitor/trace.h"
+
+#include "cm_platform.h"
+#include "cm_log.h"
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+#define CM_TRACE_CHUNK_SIZE (64 * 1024)
+#define CM_TRACE_SITES      4096
+#define CM_TRACE_HEADER_SIZE 4096
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_trace {
+	cm_file_map map;
+	cm_trace_header* header;
+	cm_trace_site* sites;
+	char* chunks;
+
+	cm_trace_chunk* chunk;   /* chunk being filled */
+	uint64_t last_time;
+	uintptr_t last_address;
+} cm_trace;
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int  cm_trace_create (cm_trace* trace, const char* path, size_t ring_bytes);
+static void cm_trace_destroy(cm_trace* trace);
+static void cm_trace_write  (cm_trace* trace, const cm_event* ev);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static char* cm_trace_put_varint(char* p, uint64_t v)
+{
+	while (v >= 0x80) {
+		*p++ = (char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (char)v;
+	return p;
+}
+
+static char* cm_trace_put_svarint(char* p, int64_t v)
+{
+	return cm_trace_put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+/*
+ * Create a trace file with a ring of ring_bytes (rounded down to whole
+ * chunks, at least two).
+ */
+static int cm_trace_create(cm_trace* trace, const char* path, size_t ring_bytes)
+{
+	size_t chunk_count, size;
+
+	chunk_count = ring_bytes / CM_TRACE_CHUNK_SIZE;
+	if (chunk_count < 2)
+		chunk_count = 2;
+	size = CM_TRACE_HEADER_SIZE + CM_TRACE_SITES * sizeof(cm_trace_site)
+		+ chunk_count * CM_TRACE_CHUNK_SIZE;
+	if (!cm_file_map_create(&trace->map, path, size))
+		return 0;
+	/* a fresh mapping is zero filled: every chunk starts unused */
+	trace->header = trace->map.base;
+	memcpy(trace->header->magic, CM_TRACE_MAGIC, sizeof(CM_TRACE_MAGIC));
+	trace->header->version = CM_TRACE_VERSION;
+	trace->header->chunk_size = CM_TRACE_CHUNK_SIZE;
+	trace->header->chunk_count = (uint32_t)chunk_count;
+	trace->header->site_capacity = CM_TRACE_SITES;
+	trace->header->site_count = 0;
+	trace->header->sites_offset = CM_TRACE_HEADER_SIZE;
+	trace->header->chunks_offset = CM_TRACE_HEADER_SIZE
+		+ CM_TRACE_SITES * sizeof(cm_trace_site);
+	trace->header->next_seq = 1;
+	trace->sites = (cm_trace_site*)((char*)trace->map.base + trace->header->sites_offset);
+	trace->chunks = (char*)trace->map.base + trace->header->chunks_offset;
+	trace->chunk = NULL;
+	return 1;
+}
+
+static void cm_trace_destroy(cm_trace* trace)
+{
+	if (!trace->header)
+		return;
+	cm_file_map_close(&trace->map);
+	trace->header = NULL;
+}
+
+/*
+ * Id of the event's site in the file's table, filled in the first time the
+ * site is seen. Sites use the ids of the process-wide table.
+ */
+static uint32_t cm_trace_site_id(cm_trace* trace, const cm_event* ev)
+{
+	cm_trace_site* site;
+
+	/* table full: the site stays unknown */
+	if (ev->site == 0 || ev->site > trace->header->site_capacity)
+		return 0;
+	site = &trace->sites[ev->site - 1];
+	if (site->file[0] == '\0') {
+		site->line = (uint32_t)ev->line;
+		strncpy(site->file, ev->filename, sizeof(site->file) - 1);
+	}
+	if (ev->site > trace->header->site_count)
+		trace->header->site_count = ev->site;
+	return ev->site;
+}
+
+static void cm_trace_next_chunk(cm_trace* trace, const cm_event* ev)
+{
+	uint64_t seq = trace->header->next_seq++;
+
+	trace->chunk = (cm_trace_chunk*)(trace->chunks
+		+ (size_t)((seq - 1) % trace->header->chunk_count) * CM_TRACE_CHUNK_SIZE);
+	trace->chunk->seq = seq;
+	trace->chunk->base_time = ev->time;
+	trace->chunk->base_address = (uintptr_t)ev->address;
+	trace->chunk->used = 0;
+	trace->chunk->events = 0;
+	trace->last_time = ev->time;
+	trace->last_address = (uintptr_t)ev->address;
+}
+
+static void cm_trace_write(cm_trace* trace, const cm_event* ev)
+{
+	char buf[CM_TRACE_EV_MAX_BYTES];
+	char* p = buf;
+	uint32_t site;
+	size_t len;
+
+	site = cm_trace_site_id(trace, ev);
+	if (!trace->chunk || trace->chunk->used + CM_TRACE_EV_MAX_BYTES
+		> CM_TRACE_CHUNK_SIZE - sizeof(cm_trace_chunk))
+		cm_trace_next_chunk(trace, ev);
+	*p++ = (char)(ev->type + 1); /* CM_EV_* to CM_TRACE_EV_* */
+	p = cm_trace_put_svarint(p, (int64_t)(ev->time - trace->last_time));
+	p = cm_trace_put_svarint(p, (int64_t)((uintptr_t)ev->address - trace->last_address));
+	p = cm_trace_put_varint(p, ev->size);
+	if (ev->type == CM_EV_CALLOC) {
+		p = cm_trace_put_varint(p, ev->arg1);
+		p = cm_trace_put_varint(p, ev->arg2);
+	} else if (ev->type == CM_EV_REALLOC) {
+		p = cm_trace_put_varint(p, ev->arg1);
+		p = cm_trace_put_svarint(p, (int64_t)((uintptr_t)ev->old_address
+											  - (uintptr_t)ev->address));
+	}
+	p = cm_trace_put_varint(p, site);
+	len = (size_t)(p - buf);
+	memcpy((char*)(trace->chunk + 1) + trace->chunk->used, buf, len);
+	/* publish the event only once its bytes are in place */
+	trace->chunk->used += (uint32_t)len;
+	++trace->chunk->events;
+	trace->last_time = ev->time;
+	trace->last_address = (uintptr_t)ev->address;
+}
+
+#endif /* CMONITOR_CM_TRACE_H */
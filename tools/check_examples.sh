@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Compile and link every example at every CM_TRACK_LEVEL, library included.
+# Run from the root of the repository; CC and CFLAGS are honored.
+#
+#   sh tools/check_examples.sh
+#
+
+CC=${CC:-cc}
+out=${TMPDIR:-/tmp}/cm_check_examples.$$
+status=0
+
+for level in 0 1 2 3 4; do
+	for example in examples/*.c; do
+		if ! $CC -std=c99 $CFLAGS -Iinclude -DCM_TRACK_LEVEL=$level \
+			"$example" src/cm.c -o "$out" -lpthread -lm; then
+			echo "FAILED: $example at CM_TRACK_LEVEL=$level"
+			status=1
+		fi
+	done
+done
+rm -f "$out"
+exit $status
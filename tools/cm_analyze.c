@@ -0,0 +1,866 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Rebuild the heap over time from cmonitor's text output or from a binary
+ * trace (cm_trace_open) and report the peak, the leaks, the lifetimes and
+ * the realloc chains of every call site.
+ *
+ * usage: cm_analyze [-j threads] [-n top] file
+ *
+ *   -j  threads reading the file, one per CPU by default
+ *   -n  call sites listed per table, 10 by default
+ *
+ * The file is split in as many chunks as threads. Every thread replays its
+ * chunk alone and puts aside the events on blocks allocated before the
+ * chunk; the chunks are then merged in order replaying only those. Sizes
+ * are logged with every event, so each chunk also knows how much it moved
+ * the live bytes and where its own high point is, which is all the merge
+ * needs for the peak.
+ *
+ * Lifetimes go from the first allocation of a block to its free, reallocs
+ * included, in nanoseconds when the events are timed (binary traces,
+ * cm_trace_decode -t) and in events otherwise. Events logged asynchronously
+ * by several threads can be slightly out of order: a free showing up before
+ * its malloc is counted as unmatched and the block as a leak.
+ *
+ * build: cc -O2 -Iinclude -Isrc tools/cm_analyze.c -o cm_analyze -lpthread
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <unistd.h>
+#endif /* _WIN32 */
+
+#include "cm_platform.h"
+#include "cm_reader.h"
+#include "cm_text.h"
+
+/*------------------------------------------------------------------------------
+	Blocks
+------------------------------------------------------------------------------*/
+
+typedef struct block {
+	uint64_t address;  /* 0 if the slot is empty */
+	uint64_t size;
+	uint64_t born;     /* first allocation of the realloc chain */
+	uint32_t site;     /* where the chain started */
+	uint32_t chain;    /* reallocs since then */
+	int foreign;       /* allocated before the chunk, see chunk::deferred */
+} block;
+
+/* Linear probing with backward shift deletion, keyed by address. */
+typedef struct block_map {
+	block* slots;
+	size_t capacity;   /* a power of two */
+	size_t count;
+} block_map;
+
+static void out_of_memory(void)
+{
+	fprintf(stderr, "cm_analyze: out of memory\n");
+	exit(EXIT_FAILURE);
+}
+
+static size_t hash_address(uint64_t a)
+{
+	a ^= a >> 33;
+	a *= 0xff51afd7ed558ccdULL;
+	a ^= a >> 33;
+	return (size_t)a;
+}
+
+static block* map_find(const block_map* m, uint64_t address)
+{
+	size_t pos;
+
+	if (m->capacity == 0)
+		return NULL;
+	pos = hash_address(address) & (m->capacity - 1);
+	while (m->slots[pos].address) {
+		if (m->slots[pos].address == address)
+			return &m->slots[pos];
+		pos = (pos + 1) & (m->capacity - 1);
+	}
+	return NULL;
+}
+
+static void map_put(block_map* m, const block* b);
+
+static void map_grow(block_map* m)
+{
+	block_map bigger;
+	size_t i;
+
+	bigger.capacity = m->capacity ? m->capacity * 2 : 1024;
+	bigger.count = 0;
+	bigger.slots = calloc(bigger.capacity, sizeof(block));
+	if (!bigger.slots)
+		out_of_memory();
+	for (i = 0; i < m->capacity; ++i) {
+		if (m->slots[i].address)
+			map_put(&bigger, &m->slots[i]);
+	}
+	free(m->slots);
+	*m = bigger;
+}
+
+/* Insert b, replacing the block at the same address if any. */
+static void map_put(block_map* m, const block* b)
+{
+	size_t pos;
+
+	if ((m->count + 1) * 4 > m->capacity * 3)
+		map_grow(m);
+	pos = hash_address(b->address) & (m->capacity - 1);
+	while (m->slots[pos].address && m->slots[pos].address != b->address)
+		pos = (pos + 1) & (m->capacity - 1);
+	if (!m->slots[pos].address)
+		++m->count;
+	m->slots[pos] = *b;
+}
+
+static void map_remove(block_map* m, block* b)
+{
+	size_t mask = m->capacity - 1;
+	size_t hole = (size_t)(b - m->slots);
+	size_t pos = hole;
+	size_t home;
+
+	/* pull back the blocks that probed past the hole */
+	for (;;) {
+		pos = (pos + 1) & mask;
+		if (!m->slots[pos].address)
+			break;
+		home = hash_address(m->slots[pos].address) & mask;
+		if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+			m->slots[hole] = m->slots[pos];
+			hole = pos;
+		}
+	}
+	m->slots[hole].address = 0;
+	--m->count;
+}
+
+/*------------------------------------------------------------------------------
+	Call sites
+------------------------------------------------------------------------------*/
+
+/* lifetimes are counted in power of two buckets */
+#define LIFETIME_BUCKETS 64
+
+typedef struct site {
+	const char* file;
+	int line;
+	uint64_t allocs;
+	uint64_t alloc_bytes;
+	uint64_t frees;        /* blocks of the site freed */
+	uint64_t lifetime_sum;
+	uint64_t lifetime_max;
+	uint64_t lifetimes[LIFETIME_BUCKETS];
+	uint64_t reallocs;     /* of blocks of the site */
+	uint64_t moves;        /* reallocs that changed the address */
+	uint64_t moved_bytes;
+	uint32_t longest_chain;
+	uint64_t leaks;
+	uint64_t leak_bytes;
+} site;
+
+typedef struct site_table {
+	site* sites;
+	size_t count;
+	size_t capacity;
+	uint32_t* index;       /* site + 1 by hash of file and line, 0 if empty */
+	size_t index_capacity; /* a power of two */
+} site_table;
+
+static size_t hash_site(const char* file, int line)
+{
+	size_t h = 2166136261u;
+
+	while (*file)
+		h = (h ^ (unsigned char)*file++) * 16777619u;
+	return (h ^ (size_t)line) * 16777619u;
+}
+
+static void sites_reindex(site_table* st)
+{
+	size_t i, pos, mask;
+
+	free(st->index);
+	st->index_capacity = st->index_capacity ? st->index_capacity * 2 : 256;
+	st->index = calloc(st->index_capacity, sizeof(uint32_t));
+	if (!st->index)
+		out_of_memory();
+	mask = st->index_capacity - 1;
+	for (i = 0; i < st->count; ++i) {
+		pos = hash_site(st->sites[i].file, st->sites[i].line) & mask;
+		while (st->index[pos])
+			pos = (pos + 1) & mask;
+		st->index[pos] = (uint32_t)i + 1;
+	}
+}
+
+/* Index of the site, added if new. file must outlive the table. */
+static uint32_t sites_get(site_table* st, const char* file, int line)
+{
+	size_t pos, mask;
+	site* s;
+
+	if ((st->count + 1) * 2 > st->index_capacity)
+		sites_reindex(st);
+	mask = st->index_capacity - 1;
+	pos = hash_site(file, line) & mask;
+	while (st->index[pos]) {
+		s = &st->sites[st->index[pos] - 1];
+		if (s->line == line && strcmp(s->file, file) == 0)
+			return st->index[pos] - 1;
+		pos = (pos + 1) & mask;
+	}
+	if (st->count == st->capacity) {
+		st->capacity = st->capacity ? st->capacity * 2 : 64;
+		st->sites = realloc(st->sites, st->capacity * sizeof(site));
+		if (!st->sites)
+			out_of_memory();
+	}
+	s = &st->sites[st->count];
+	memset(s, 0, sizeof(site));
+	s->file = file;
+	s->line = line;
+	st->index[pos] = (uint32_t)++st->count;
+	return (uint32_t)st->count - 1;
+}
+
+static void site_add(site* to, const site* from)
+{
+	size_t i;
+
+	to->allocs += from->allocs;
+	to->alloc_bytes += from->alloc_bytes;
+	to->frees += from->frees;
+	to->lifetime_sum += from->lifetime_sum;
+	if (from->lifetime_max > to->lifetime_max)
+		to->lifetime_max = from->lifetime_max;
+	for (i = 0; i < LIFETIME_BUCKETS; ++i)
+		to->lifetimes[i] += from->lifetimes[i];
+	to->reallocs += from->reallocs;
+	to->moves += from->moves;
+	to->moved_bytes += from->moved_bytes;
+	if (from->longest_chain > to->longest_chain)
+		to->longest_chain = from->longest_chain;
+}
+
+static void on_free(site* s, const block* b, uint64_t time)
+{
+	uint64_t life = time > b->born ? time - b->born : 0;
+	int bucket = 0;
+
+	while (bucket < LIFETIME_BUCKETS - 1 && (life >> bucket) > 1)
+		++bucket;
+	++s->frees;
+	s->lifetime_sum += life;
+	if (life > s->lifetime_max)
+		s->lifetime_max = life;
+	++s->lifetimes[bucket];
+}
+
+static void on_realloc(site* s, block* b, const cm_reader_event* ev)
+{
+	++s->reallocs;
+	if (ev->old_address != ev->address) {
+		++s->moves;
+		s->moved_bytes += ev->arg1;
+	}
+	b->address = ev->address;
+	b->size = ev->size;
+	if (++b->chain > s->longest_chain)
+		s->longest_chain = b->chain;
+}
+
+/*------------------------------------------------------------------------------
+	Chunks
+------------------------------------------------------------------------------*/
+
+typedef struct chunk {
+	char* begin;             /* text: lines of the chunk */
+	char* end;
+	cm_reader reader;        /* binary: trace chunks of the chunk */
+	int binary;
+	int timed;
+
+	block_map blocks;
+	site_table sites;
+	/*
+	 * Events on blocks allocated before the chunk, in order, with their file
+	 * pointing to the chunk's site table and their time relative to the chunk
+	 * when not timed. Replayed by the merge.
+	 */
+	cm_reader_event* deferred;
+	size_t deferred_count;
+	size_t deferred_capacity;
+
+	uint64_t events;
+	uint64_t first_time;     /* of the first event */
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t reallocs;
+	int64_t delta;           /* live bytes moved by the chunk */
+	int64_t peak_delta;      /* highest delta reached, INT64_MIN if none */
+	uint64_t peak_time;
+} chunk;
+
+static int chunk_next(chunk* c, cm_reader_event* ev)
+{
+	char* line;
+	char* nl;
+
+	if (c->binary)
+		return cm_reader_next(&c->reader, ev);
+	while (c->begin < c->end) {
+		line = c->begin;
+		nl = memchr(line, '\n', (size_t)(c->end - line));
+		if (nl) {
+			*nl = '\0';
+			c->begin = nl + 1;
+		} else {
+			c->begin = c->end;
+		}
+		if (cm_text_parse(line, ev))
+			return 1;
+	}
+	return 0;
+}
+
+static void chunk_defer(chunk* c, const cm_reader_event* ev, uint32_t site_id, uint64_t time)
+{
+	cm_reader_event* d;
+
+	if (c->deferred_count == c->deferred_capacity) {
+		c->deferred_capacity = c->deferred_capacity ? c->deferred_capacity * 2 : 256;
+		c->deferred = realloc(c->deferred, c->deferred_capacity * sizeof(cm_reader_event));
+		if (!c->deferred)
+			out_of_memory();
+	}
+	d = &c->deferred[c->deferred_count++];
+	*d = *ev;
+	d->time = time;
+	d->line = (int)site_id; /* the site, see merge_chunk */
+}
+
+static void chunk_replay(chunk* c, const cm_reader_event* ev)
+{
+	uint32_t site_id = sites_get(&c->sites, ev->file, ev->line);
+	uint64_t time = c->timed ? ev->time : c->events;
+	block* b;
+	block nb;
+
+	if (c->events++ == 0)
+		c->first_time = time;
+	if (ev->address == 0)
+		return;
+	switch (ev->type) {
+		case CM_TRACE_EV_MALLOC:
+		case CM_TRACE_EV_REALLOC_MALLOC:
+		case CM_TRACE_EV_CALLOC:
+			++c->allocs;
+			c->delta += (int64_t)ev->size;
+			c->sites.sites[site_id].allocs++;
+			c->sites.sites[site_id].alloc_bytes += ev->size;
+			nb.address = ev->address;
+			nb.size = ev->size;
+			nb.born = time;
+			nb.site = site_id;
+			nb.chain = 0;
+			nb.foreign = 0;
+			map_put(&c->blocks, &nb);
+			break;
+		case CM_TRACE_EV_FREE:
+			++c->frees;
+			c->delta -= (int64_t)ev->size;
+			b = map_find(&c->blocks, ev->address);
+			if (b && !b->foreign)
+				on_free(&c->sites.sites[b->site], b, time);
+			else
+				chunk_defer(c, ev, site_id, time);
+			if (b)
+				map_remove(&c->blocks, b);
+			break;
+		case CM_TRACE_EV_REALLOC:
+			++c->reallocs;
+			c->delta += (int64_t)(ev->size - ev->arg1);
+			b = map_find(&c->blocks, ev->old_address);
+			if (b && !b->foreign) {
+				nb = *b;
+				map_remove(&c->blocks, b);
+				on_realloc(&c->sites.sites[nb.site], &nb, ev);
+			} else {
+				chunk_defer(c, ev, site_id, time);
+				if (b)
+					map_remove(&c->blocks, b);
+				/* stands for the merged block until the end of the chunk */
+				memset(&nb, 0, sizeof(block));
+				nb.address = ev->address;
+				nb.foreign = 1;
+			}
+			map_put(&c->blocks, &nb);
+			break;
+	}
+	if (c->delta > c->peak_delta) {
+		c->peak_delta = c->delta;
+		c->peak_time = time;
+	}
+}
+
+static void chunk_main(void* arg)
+{
+	chunk* c = arg;
+	cm_reader_event ev;
+
+	while (chunk_next(c, &ev))
+		chunk_replay(c, &ev);
+}
+
+/*------------------------------------------------------------------------------
+	Merge
+------------------------------------------------------------------------------*/
+
+typedef struct heap {
+	block_map blocks;
+	site_table sites;
+	int timed;
+	uint64_t start;          /* time of the first event */
+	uint64_t events;
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t reallocs;
+	uint64_t unmatched_frees;
+	uint64_t unmatched_reallocs;
+	int64_t live;
+	int64_t peak;
+	uint64_t peak_time;
+	uint64_t leaks;
+} heap;
+
+static void merge_chunk(heap* h, chunk* c)
+{
+	uint32_t* to_global;
+	uint64_t base = h->timed ? 0 : h->events;
+	cm_reader_event* ev;
+	block* b;
+	block nb;
+	size_t i;
+
+	to_global = malloc((c->sites.count + 1) * sizeof(uint32_t));
+	if (!to_global)
+		out_of_memory();
+	for (i = 0; i < c->sites.count; ++i) {
+		to_global[i] = sites_get(&h->sites, c->sites.sites[i].file, c->sites.sites[i].line);
+		site_add(&h->sites.sites[to_global[i]], &c->sites.sites[i]);
+	}
+	for (i = 0; i < c->deferred_count; ++i) {
+		ev = &c->deferred[i];
+		ev->time += base;
+		if (ev->type == CM_TRACE_EV_FREE) {
+			b = map_find(&h->blocks, ev->address);
+			if (b) {
+				on_free(&h->sites.sites[b->site], b, ev->time);
+				map_remove(&h->blocks, b);
+			} else {
+				++h->unmatched_frees;
+			}
+			continue;
+		}
+		b = map_find(&h->blocks, ev->old_address);
+		if (b) {
+			nb = *b;
+			map_remove(&h->blocks, b);
+			on_realloc(&h->sites.sites[nb.site], &nb, ev);
+		} else {
+			/* the chain starts here as far as we know */
+			++h->unmatched_reallocs;
+			nb.address = ev->address;
+			nb.size = ev->size;
+			nb.born = ev->time;
+			nb.site = to_global[ev->line];
+			nb.chain = 0;
+		}
+		nb.foreign = 0;
+		map_put(&h->blocks, &nb);
+	}
+	for (i = 0; i < c->blocks.capacity; ++i) {
+		nb = c->blocks.slots[i];
+		if (!nb.address || nb.foreign)
+			continue;
+		nb.site = to_global[nb.site];
+		nb.born += base;
+		map_put(&h->blocks, &nb);
+	}
+	if (c->peak_delta != INT64_MIN && h->live + c->peak_delta > h->peak) {
+		h->peak = h->live + c->peak_delta;
+		h->peak_time = c->peak_time + base;
+	}
+	h->live += c->delta;
+	h->events += c->events;
+	h->allocs += c->allocs;
+	h->frees += c->frees;
+	h->reallocs += c->reallocs;
+	free(to_global);
+	free(c->deferred);
+	free(c->blocks.slots);
+	free(c->sites.sites);
+	free(c->sites.index);
+}
+
+static void count_leaks(heap* h)
+{
+	site* s;
+	size_t i;
+
+	for (i = 0; i < h->blocks.capacity; ++i) {
+		if (!h->blocks.slots[i].address)
+			continue;
+		s = &h->sites.sites[h->blocks.slots[i].site];
+		++s->leaks;
+		s->leak_bytes += h->blocks.slots[i].size;
+		++h->leaks;
+	}
+}
+
+/*------------------------------------------------------------------------------
+	Report
+------------------------------------------------------------------------------*/
+
+static int by_leak_bytes(const void* a, const void* b)
+{
+	const site* sa = *(const site* const*)a;
+	const site* sb = *(const site* const*)b;
+
+	return sa->leak_bytes < sb->leak_bytes ? 1 : sa->leak_bytes > sb->leak_bytes ? -1 : 0;
+}
+
+static int by_frees(const void* a, const void* b)
+{
+	const site* sa = *(const site* const*)a;
+	const site* sb = *(const site* const*)b;
+
+	return sa->frees < sb->frees ? 1 : sa->frees > sb->frees ? -1 : 0;
+}
+
+static int by_reallocs(const void* a, const void* b)
+{
+	const site* sa = *(const site* const*)a;
+	const site* sb = *(const site* const*)b;
+
+	return sa->reallocs < sb->reallocs ? 1 : sa->reallocs > sb->reallocs ? -1 : 0;
+}
+
+/* Upper bound of the bucket holding the given fraction of the lifetimes. */
+static uint64_t lifetime_quantile(const site* s, double q)
+{
+	uint64_t seen = 0, target = (uint64_t)((double)s->frees * q);
+	int i;
+
+	for (i = 0; i < LIFETIME_BUCKETS - 1; ++i) {
+		seen += s->lifetimes[i];
+		if (seen > target)
+			break;
+	}
+	return i == 0 ? 1 : ((uint64_t)2 << i) - 1;
+}
+
+static void print_site(const site* s)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s:%d", s->file, s->line);
+	printf(" %-32s", name);
+}
+
+static void report(heap* h, size_t top)
+{
+	const char* unit = h->timed ? "ns" : "events";
+	site** order;
+	size_t i, n;
+
+	order = malloc((h->sites.count + 1) * sizeof(site*));
+	if (!order)
+		out_of_memory();
+	for (i = 0; i < h->sites.count; ++i)
+		order[i] = &h->sites.sites[i];
+
+	printf("events:             %llu\n", (unsigned long long)h->events);
+	printf("allocations:        %llu\n", (unsigned long long)h->allocs);
+	printf("frees:              %llu (%llu unmatched)\n", (unsigned long long)h->frees,
+		   (unsigned long long)h->unmatched_frees);
+	printf("reallocs:           %llu (%llu unmatched)\n", (unsigned long long)h->reallocs,
+		   (unsigned long long)h->unmatched_reallocs);
+	printf("peak:               %lld bytes at %llu %s\n", (long long)h->peak,
+		   (unsigned long long)(h->peak_time - h->start), unit);
+	printf("live at the end:    %lld bytes in %llu blocks\n\n", (long long)h->live,
+		   (unsigned long long)h->leaks);
+
+	qsort(order, h->sites.count, sizeof(site*), by_leak_bytes);
+	printf("leaks\n %-32s %12s %12s\n", "site", "blocks", "bytes");
+	for (i = 0, n = 0; i < h->sites.count && n < top && order[i]->leaks; ++i, ++n) {
+		print_site(order[i]);
+		printf(" %12llu %12llu\n", (unsigned long long)order[i]->leaks,
+			   (unsigned long long)order[i]->leak_bytes);
+	}
+
+	qsort(order, h->sites.count, sizeof(site*), by_frees);
+	printf("\nlifetimes (%s)\n %-32s %12s %12s %12s %12s %12s\n", unit,
+		   "site", "freed", "mean", "p50 <=", "p90 <=", "max");
+	for (i = 0, n = 0; i < h->sites.count && n < top && order[i]->frees; ++i, ++n) {
+		print_site(order[i]);
+		printf(" %12llu %12llu %12llu %12llu %12llu\n",
+			   (unsigned long long)order[i]->frees,
+			   (unsigned long long)(order[i]->lifetime_sum / order[i]->frees),
+			   (unsigned long long)lifetime_quantile(order[i], 0.5),
+			   (unsigned long long)lifetime_quantile(order[i], 0.9),
+			   (unsigned long long)order[i]->lifetime_max);
+	}
+
+	qsort(order, h->sites.count, sizeof(site*), by_reallocs);
+	printf("\nrealloc chains\n %-32s %12s %12s %12s %12s\n",
+		   "site", "reallocs", "moves", "moved bytes", "longest");
+	for (i = 0, n = 0; i < h->sites.count && n < top && order[i]->reallocs; ++i, ++n) {
+		print_site(order[i]);
+		printf(" %12llu %12llu %12llu %12u\n",
+			   (unsigned long long)order[i]->reallocs,
+			   (unsigned long long)order[i]->moves,
+			   (unsigned long long)order[i]->moved_bytes,
+			   order[i]->longest_chain);
+	}
+	free(order);
+}
+
+/*------------------------------------------------------------------------------
+	Input
+------------------------------------------------------------------------------*/
+
+static int cpu_count(void)
+{
+#if defined(_WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return (int)si.dwNumberOfProcessors;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+#endif /* _WIN32 */
+}
+
+/* Whole file, NUL terminated. */
+static char* load_text(const char* path, size_t* size)
+{
+	FILE* f;
+	char* data;
+	long len;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0) {
+		fclose(f);
+		return NULL;
+	}
+	rewind(f);
+	*size = (size_t)len;
+	data = malloc(*size + 1);
+	if (!data || fread(data, 1, *size, f) != *size) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	data[*size] = '\0';
+	return data;
+}
+
+static int is_trace(const char* path)
+{
+	char magic[sizeof(CM_TRACE_MAGIC)];
+	FILE* f = fopen(path, "rb");
+	int ok;
+
+	if (!f)
+		return 0;
+	ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+		&& memcmp(magic, CM_TRACE_MAGIC, sizeof(magic)) == 0;
+	fclose(f);
+	return ok;
+}
+
+/* Split the lines of data among the chunks, at line boundaries. */
+static void split_text(chunk* chunks, int n, char* data, size_t size)
+{
+	char* begin = data;
+	char* end;
+	char* nl;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		end = data + size * (size_t)(i + 1) / (size_t)n;
+		if (end < begin)
+			end = begin;
+		if (i < n - 1 && end < data + size) {
+			nl = memchr(end, '\n', (size_t)(data + size - end));
+			end = nl ? nl + 1 : data + size;
+		}
+		chunks[i].begin = begin;
+		chunks[i].end = end;
+		begin = end;
+	}
+}
+
+/* Split the trace chunks of r among the chunks. */
+static void split_trace(chunk* chunks, int n, const cm_reader* r)
+{
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		chunks[i].reader = *r;
+		chunks[i].reader.chunk_pos = r->chunk_count * (size_t)i / (size_t)n;
+		chunks[i].reader.chunk_count = r->chunk_count * (size_t)(i + 1) / (size_t)n;
+		chunks[i].reader.p = chunks[i].reader.end = NULL;
+		chunks[i].binary = 1;
+	}
+}
+
+static int first_event_timed(char* data, size_t size)
+{
+	cm_reader_event ev;
+	char line[512];
+	char* p = data;
+	char* nl;
+	size_t len;
+	int flags;
+
+	while (p < data + size) {
+		nl = memchr(p, '\n', (size_t)(data + size - p));
+		len = (size_t)((nl ? nl : data + size) - p);
+		if (len >= sizeof(line))
+			len = sizeof(line) - 1;
+		/* parse a copy, it terminates the file name in place */
+		memcpy(line, p, len);
+		line[len] = '\0';
+		flags = cm_text_parse(line, &ev);
+		if (flags)
+			return (flags & CM_TEXT_TIMED) != 0;
+		p = nl ? nl + 1 : data + size;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	cm_reader reader;
+	chunk* chunks;
+	cm_thread* threads;
+	heap h;
+	char* data = NULL;
+	size_t size = 0, top = 10;
+	const char* path = NULL;
+	int jobs = cpu_count();
+	int binary, i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			jobs = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			top = (size_t)atoi(argv[++i]);
+		else
+			path = argv[i];
+	}
+	if (!path || jobs <= 0) {
+		fprintf(stderr, "usage: %s [-j threads] [-n top] file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&h, 0, sizeof(heap));
+	binary = is_trace(path);
+	if (binary) {
+		if (!cm_reader_open(&reader, path)) {
+			fprintf(stderr, "%s: not a valid cmonitor trace\n", path);
+			return EXIT_FAILURE;
+		}
+		if ((size_t)jobs > reader.chunk_count)
+			jobs = reader.chunk_count ? (int)reader.chunk_count : 1;
+		h.timed = 1;
+	} else {
+		data = load_text(path, &size);
+		if (!data) {
+			fprintf(stderr, "%s: cannot read the file\n", path);
+			return EXIT_FAILURE;
+		}
+		h.timed = first_event_timed(data, size);
+	}
+
+	chunks = calloc((size_t)jobs, sizeof(chunk));
+	threads = calloc((size_t)jobs, sizeof(cm_thread));
+	if (!chunks || !threads)
+		out_of_memory();
+	if (binary)
+		split_trace(chunks, jobs, &reader);
+	else
+		split_text(chunks, jobs, data, size);
+	for (i = 0; i < jobs; ++i) {
+		chunks[i].timed = h.timed;
+		chunks[i].peak_delta = INT64_MIN;
+	}
+	for (i = 1; i < jobs; ++i) {
+		if (!cm_thread_start(&threads[i], chunk_main, &chunks[i])) {
+			fprintf(stderr, "cm_analyze: cannot start a thread\n");
+			return EXIT_FAILURE;
+		}
+	}
+	chunk_main(&chunks[0]);
+	for (i = 1; i < jobs; ++i)
+		cm_thread_join(&threads[i]);
+
+	/* the file names of the sites point into the input, keep it around */
+	h.start = h.timed ? chunks[0].first_time : 0;
+	for (i = 0; i < jobs; ++i)
+		merge_chunk(&h, &chunks[i]);
+	count_leaks(&h);
+	report(&h, top);
+
+	free(h.blocks.slots);
+	free(h.sites.sites);
+	free(h.sites.index);
+	free(chunks);
+	free(threads);
+	if (binary)
+		cm_reader_close(&reader);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Reads back the allocation events of a binary trace (cm_trace_open).
+ */
+
+#ifndef CMONITOR_CM_READER_H
+#define CMONITOR_CM_READER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmonitor/trace.h"
+
+/*------------------------------------------------------------------------------
+	struct
+------------------------------------------------------------------------------*/
+
+typedef struct cm_reader_event {
+	int type;              /* CM_TRACE_EV_* */
+	uint64_t time;         /* nanoseconds, monotonic clock */
+	uint64_t address;
+	uint64_t old_address;  /* CM_TRACE_EV_REALLOC only */
+	uint64_t size;
+	uint64_t arg1;         /* calloc: num, realloc: old size */
+	uint64_t arg2;         /* calloc: size */
+	const char* file;      /* "?" if unknown */
+	int line;
+} cm_reader_event;
+
+typedef struct cm_reader {
+	char* data;
+	size_t size;
+	const cm_trace_header* header;
+	const cm_trace_site* sites;
+
+	const cm_trace_chunk** chunks; /* used chunks in seq order */
+	size_t chunk_count;
+	size_t chunk_pos;
+
+	const unsigned char* p;        /* cursor in the current chunk */
+	const unsigned char* end;
+	uint64_t last_time;
+	uint64_t last_address;
+} cm_reader;
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int  cm_reader_open (cm_reader* r, const char* path);
+static int  cm_reader_next (cm_reader* r, cm_reader_event* ev);
+static void cm_reader_close(cm_reader* r);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static int cm_reader_get_varint(cm_reader* r, uint64_t* v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while (r->p < r->end && shift < 64) {
+		*v |= (uint64_t)(*r->p & 0x7f) << shift;
+		if (!(*r->p++ & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+static int cm_reader_get_svarint(cm_reader* r, int64_t* v)
+{
+	uint64_t u;
+
+	if (!cm_reader_get_varint(r, &u))
+		return 0;
+	*v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+	return 1;
+}
+
+static int cm_reader_cmp_chunks(const void* a, const void* b)
+{
+	uint64_t sa = (*(const cm_trace_chunk* const*)a)->seq;
+	uint64_t sb = (*(const cm_trace_chunk* const*)b)->seq;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+static int cm_reader_load(cm_reader* r, const char* path)
+{
+	FILE* f;
+	long size;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return 0;
+	if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+		fclose(f);
+		return 0;
+	}
+	rewind(f);
+	r->size = (size_t)size;
+	r->data = malloc(r->size ? r->size : 1);
+	if (!r->data || fread(r->data, 1, r->size, f) != r->size) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	return 1;
+}
+
+static int cm_reader_open(cm_reader* r, const char* path)
+{
+	const cm_trace_chunk* c;
+	size_t i;
+
+	memset(r, 0, sizeof(cm_reader));
+	if (!cm_reader_load(r, path))
+		goto fail;
+	r->header = (const cm_trace_header*)r->data;
+	if (r->size < sizeof(cm_trace_header)
+		|| memcmp(r->header->magic, CM_TRACE_MAGIC, sizeof(CM_TRACE_MAGIC)) != 0
+		|| r->header->version != CM_TRACE_VERSION
+		|| r->header->chunks_offset + (uint64_t)r->header->chunk_count
+			* r->header->chunk_size > r->size
+		|| r->header->sites_offset + (uint64_t)r->header->site_capacity
+			* sizeof(cm_trace_site) > r->size)
+		goto fail;
+	r->sites = (const cm_trace_site*)(r->data + r->header->sites_offset);
+	r->chunks = malloc(sizeof(cm_trace_chunk*) * (r->header->chunk_count + 1));
+	if (!r->chunks)
+		goto fail;
+	for (i = 0; i < r->header->chunk_count; ++i) {
+		c = (const cm_trace_chunk*)(r->data + r->header->chunks_offset
+									+ i * r->header->chunk_size);
+		if (c->seq != 0 && c->used <= r->header->chunk_size - sizeof(cm_trace_chunk))
+			r->chunks[r->chunk_count++] = c;
+	}
+	qsort(r->chunks, r->chunk_count, sizeof(cm_trace_chunk*), cm_reader_cmp_chunks);
+	return 1;
+
+fail:
+	cm_reader_close(r);
+	return 0;
+}
+
+/* Get the next event. Returns 0 at the end of the trace. */
+static int cm_reader_next(cm_reader* r, cm_reader_event* ev)
+{
+	const cm_trace_chunk* c;
+	uint64_t site;
+	int64_t delta;
+
+	while (r->p == r->end) {
+		if (r->chunk_pos == r->chunk_count)
+			return 0;
+		c = r->chunks[r->chunk_pos++];
+		r->p = (const unsigned char*)(c + 1);
+		r->end = r->p + c->used;
+		r->last_time = c->base_time;
+		r->last_address = c->base_address;
+	}
+	memset(ev, 0, sizeof(cm_reader_event));
+	ev->type = *r->p++;
+	if (!cm_reader_get_svarint(r, &delta))
+		goto corrupted;
+	ev->time = r->last_time + (uint64_t)delta;
+	if (!cm_reader_get_svarint(r, &delta))
+		goto corrupted;
+	ev->address = r->last_address + (uint64_t)delta;
+	if (!cm_reader_get_varint(r, &ev->size))
+		goto corrupted;
+	if (ev->type == CM_TRACE_EV_CALLOC) {
+		if (!cm_reader_get_varint(r, &ev->arg1) || !cm_reader_get_varint(r, &ev->arg2))
+			goto corrupted;
+	} else if (ev->type == CM_TRACE_EV_REALLOC) {
+		if (!cm_reader_get_varint(r, &ev->arg1) || !cm_reader_get_svarint(r, &delta))
+			goto corrupted;
+		ev->old_address = ev->address + (uint64_t)delta;
+	}
+	if (!cm_reader_get_varint(r, &site))
+		goto corrupted;
+	if (site > 0 && site <= r->header->site_count && r->sites[site - 1].file[0]) {
+		ev->file = r->sites[site - 1].file;
+		ev->line = (int)r->sites[site - 1].line;
+	} else {
+		ev->file = "?";
+		ev->line = 0;
+	}
+	r->last_time = ev->time;
+	r->last_address = ev->address;
+	return 1;
+
+corrupted:
+	/* skip the rest of the chunk */
+	r->p = r->end;
+	return cm_reader_next(r, ev);
+}
+
+static void cm_reader_close(cm_reader* r)
+{
+	free(r->chunks);
+	free(r->data);
+	memset(r, 0, sizeof(cm_reader));
+}
+
+#endif /* CMONITOR_CM_READER_H */
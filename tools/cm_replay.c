@@ -0,0 +1,910 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Replay the allocations recorded in cmonitor's text output or in a binary
+ * trace (cm_trace_open) against several allocators and compare them.
+ *
+ * usage: cm_replay [-a allocator,...] file
+ *
+ *   malloc    the C allocator
+ *   counters  cmonitor, CM_LEVEL_COUNTERS entry points
+ *   sites     cmonitor, CM_LEVEL_SITES entry points
+ *   full      cmonitor with all its records and the event log, written to
+ *             the null device
+ *   records   the same without the event log, when the tool is built with
+ *             -DCM_TRACK_LEVEL=3 (it then replaces full)
+ *   arena     bump allocator, nothing is reused until the end
+ *   pool      power of two size classes with free lists, large blocks
+ *             go to the C allocator
+ *
+ * All of them by default. The events are turned into operations on dense
+ * block ids first, so every allocator replays exactly the same sequence,
+ * touching one byte per page of every block it returns. Prints one CSV row
+ * per allocator:
+ *
+ *   allocator,ops,ns,ns_per_op,peak_live_kb,peak_rss_kb,frag_pct
+ *
+ * peak_rss_kb is how much the resident set grew during the replay and
+ * frag_pct the share of it not taken by the peak of the live bytes. On
+ * POSIX systems every allocator runs in a process of its own; on Windows
+ * they share one and the peak is the highest reached so far.
+ *
+ * Frees of blocks the trace never allocated are dropped. So is the old
+ * address of a realloc in outputs older than the "old:" field: the block is
+ * assumed to be resized in place.
+ *
+ * build: cc -O2 -Iinclude -Isrc tools/cm_replay.c src/cm.c -o cm_replay -lpthread -lm
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#  include <psapi.h>
+#else
+#  include <unistd.h>
+#  include <sys/resource.h>
+#  include <sys/wait.h>
+#endif /* _WIN32 */
+
+#include "cmonitor/cm.h"
+#include "cm_platform.h"
+#include "cm_reader.h"
+#include "cm_text.h"
+
+/* one byte written per page of every block returned */
+#define TOUCH_STRIDE 4096
+
+static void out_of_memory(void)
+{
+	fprintf(stderr, "cm_replay: out of memory\n");
+	exit(EXIT_FAILURE);
+}
+
+/*------------------------------------------------------------------------------
+	Operations
+------------------------------------------------------------------------------*/
+
+enum { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_FREE };
+
+typedef struct op {
+	uint32_t type;     /* OP_* */
+	uint32_t id;       /* dense block id, reused once the block is freed */
+	uint64_t size;     /* calloc: size of each element */
+	uint64_t num;      /* calloc only */
+	const char* file;  /* call site, for the cmonitor allocators */
+	int line;
+} op;
+
+typedef struct trace {
+	op* ops;
+	size_t count;
+	size_t capacity;
+	uint32_t ids;          /* highest id used + 1 */
+	uint64_t peak_live;    /* bytes */
+	size_t dropped;        /* frees of unknown blocks */
+} trace;
+
+/* Live addresses of the trace to their block id, linear probing. */
+typedef struct id_slot {
+	uint64_t address;  /* 0 if the slot is empty */
+	uint32_t id;
+} id_slot;
+
+typedef struct id_map {
+	id_slot* slots;
+	size_t capacity;   /* a power of two */
+	size_t count;
+} id_map;
+
+/* State of the conversion, only needed while loading. */
+typedef struct loader {
+	id_map map;
+	uint32_t* free_ids;
+	size_t free_count;
+	uint64_t* sizes;   /* by id */
+	size_t sizes_capacity;
+	uint64_t live;
+} loader;
+
+static size_t hash_address(uint64_t a)
+{
+	a ^= a >> 33;
+	a *= 0xff51afd7ed558ccdULL;
+	a ^= a >> 33;
+	return (size_t)a;
+}
+
+static id_slot* map_find(const id_map* m, uint64_t address)
+{
+	size_t pos;
+
+	if (m->capacity == 0)
+		return NULL;
+	pos = hash_address(address) & (m->capacity - 1);
+	while (m->slots[pos].address) {
+		if (m->slots[pos].address == address)
+			return &m->slots[pos];
+		pos = (pos + 1) & (m->capacity - 1);
+	}
+	return NULL;
+}
+
+static void map_put(id_map* m, uint64_t address, uint32_t id);
+
+static void map_grow(id_map* m)
+{
+	id_map bigger;
+	size_t i;
+
+	bigger.capacity = m->capacity ? m->capacity * 2 : 1024;
+	bigger.count = 0;
+	bigger.slots = calloc(bigger.capacity, sizeof(id_slot));
+	if (!bigger.slots)
+		out_of_memory();
+	for (i = 0; i < m->capacity; ++i) {
+		if (m->slots[i].address)
+			map_put(&bigger, m->slots[i].address, m->slots[i].id);
+	}
+	free(m->slots);
+	*m = bigger;
+}
+
+/* Insert address, replacing the id at the same address if any. */
+static void map_put(id_map* m, uint64_t address, uint32_t id)
+{
+	size_t pos;
+
+	if ((m->count + 1) * 4 > m->capacity * 3)
+		map_grow(m);
+	pos = hash_address(address) & (m->capacity - 1);
+	while (m->slots[pos].address && m->slots[pos].address != address)
+		pos = (pos + 1) & (m->capacity - 1);
+	if (!m->slots[pos].address)
+		++m->count;
+	m->slots[pos].address = address;
+	m->slots[pos].id = id;
+}
+
+static void map_remove(id_map* m, id_slot* s)
+{
+	size_t mask = m->capacity - 1;
+	size_t hole = (size_t)(s - m->slots);
+	size_t pos = hole;
+	size_t home;
+
+	/* pull back the slots that probed past the hole */
+	for (;;) {
+		pos = (pos + 1) & mask;
+		if (!m->slots[pos].address)
+			break;
+		home = hash_address(m->slots[pos].address) & mask;
+		if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+			m->slots[hole] = m->slots[pos];
+			hole = pos;
+		}
+	}
+	m->slots[hole].address = 0;
+	--m->count;
+}
+
+static op* push_op(trace* tr, uint32_t type, const cm_reader_event* ev)
+{
+	op* o;
+
+	if (tr->count == tr->capacity) {
+		tr->capacity = tr->capacity ? tr->capacity * 2 : 4096;
+		tr->ops = realloc(tr->ops, tr->capacity * sizeof(op));
+		if (!tr->ops)
+			out_of_memory();
+	}
+	o = &tr->ops[tr->count++];
+	o->type = type;
+	o->size = ev->size;
+	o->num = 0;
+	o->file = ev->file;
+	o->line = ev->line;
+	return o;
+}
+
+static uint32_t new_id(trace* tr, loader* ld)
+{
+	uint32_t id;
+
+	if (ld->free_count > 0)
+		return ld->free_ids[--ld->free_count];
+	id = tr->ids++;
+	if (id >= ld->sizes_capacity) {
+		ld->sizes_capacity = ld->sizes_capacity ? ld->sizes_capacity * 2 : 1024;
+		ld->sizes = realloc(ld->sizes, ld->sizes_capacity * sizeof(uint64_t));
+		ld->free_ids = realloc(ld->free_ids, ld->sizes_capacity * sizeof(uint32_t));
+		if (!ld->sizes || !ld->free_ids)
+			out_of_memory();
+	}
+	return id;
+}
+
+static void set_live(trace* tr, loader* ld, uint32_t id, uint64_t size)
+{
+	ld->live += size;
+	ld->sizes[id] = size;
+	if (ld->live > tr->peak_live)
+		tr->peak_live = ld->live;
+}
+
+static void add_event(trace* tr, loader* ld, cm_reader_event* ev)
+{
+	id_slot* s;
+	uint32_t id;
+	op* o;
+
+	switch (ev->type) {
+		case CM_TRACE_EV_MALLOC:
+		case CM_TRACE_EV_CALLOC:
+		case CM_TRACE_EV_REALLOC_MALLOC:
+			/* a block whose free is missing stays allocated to the end */
+			id = new_id(tr, ld);
+			o = push_op(tr, ev->type == CM_TRACE_EV_CALLOC ? OP_CALLOC
+						: ev->type == CM_TRACE_EV_MALLOC ? OP_MALLOC : OP_REALLOC, ev);
+			if (ev->type == CM_TRACE_EV_CALLOC) {
+				o->num = ev->arg1;
+				o->size = ev->arg2;
+			}
+			o->id = id;
+			map_put(&ld->map, ev->address, id);
+			set_live(tr, ld, id, ev->size);
+			break;
+		case CM_TRACE_EV_REALLOC:
+			s = map_find(&ld->map, ev->old_address);
+			if (s) {
+				id = s->id;
+				map_remove(&ld->map, s);
+				ld->live -= ld->sizes[id];
+			} else {
+				/* unknown block: replayed as a realloc of NULL */
+				id = new_id(tr, ld);
+			}
+			push_op(tr, OP_REALLOC, ev)->id = id;
+			map_put(&ld->map, ev->address, id);
+			set_live(tr, ld, id, ev->size);
+			break;
+		case CM_TRACE_EV_FREE:
+			s = map_find(&ld->map, ev->address);
+			if (!s) {
+				++tr->dropped;
+				break;
+			}
+			id = s->id;
+			map_remove(&ld->map, s);
+			ld->live -= ld->sizes[id];
+			push_op(tr, OP_FREE, ev)->id = id;
+			ld->free_ids[ld->free_count++] = id;
+			break;
+		default:
+			break;
+	}
+}
+
+/* Whole file, NUL terminated. */
+static char* load_text(const char* path, size_t* size)
+{
+	FILE* f;
+	char* data;
+	long len;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0) {
+		fclose(f);
+		return NULL;
+	}
+	rewind(f);
+	*size = (size_t)len;
+	data = malloc(*size + 1);
+	if (!data || fread(data, 1, *size, f) != *size) {
+		free(data);
+		fclose(f);
+		return NULL;
+	}
+	fclose(f);
+	data[*size] = '\0';
+	return data;
+}
+
+static int is_trace(const char* path)
+{
+	char magic[sizeof(CM_TRACE_MAGIC)];
+	FILE* f = fopen(path, "rb");
+	int ok;
+
+	if (!f)
+		return 0;
+	ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+		&& memcmp(magic, CM_TRACE_MAGIC, sizeof(magic)) == 0;
+	fclose(f);
+	return ok;
+}
+
+/*
+ * Load the operations of path. The file names of the operations point into
+ * *data or into *reader, which must be kept open until the replay is over.
+ */
+static int load_trace(const char* path, trace* tr, char** data, cm_reader* reader,
+					  int* binary)
+{
+	cm_reader_event ev;
+	loader ld;
+	char* p;
+	char* nl;
+	size_t size;
+
+	memset(tr, 0, sizeof(trace));
+	memset(&ld, 0, sizeof(loader));
+	*data = NULL;
+	*binary = is_trace(path);
+	if (*binary) {
+		if (!cm_reader_open(reader, path)) {
+			fprintf(stderr, "%s: not a valid cmonitor trace\n", path);
+			return 0;
+		}
+		while (cm_reader_next(reader, &ev))
+			add_event(tr, &ld, &ev);
+	} else {
+		*data = load_text(path, &size);
+		if (!*data) {
+			fprintf(stderr, "%s: cannot read the file\n", path);
+			return 0;
+		}
+		for (p = *data; p < *data + size; p = nl + 1) {
+			nl = memchr(p, '\n', (size_t)(*data + size - p));
+			if (!nl)
+				nl = *data + size;
+			*nl = '\0';
+			if (cm_text_parse(p, &ev))
+				add_event(tr, &ld, &ev);
+		}
+	}
+	free(ld.map.slots);
+	free(ld.free_ids);
+	free(ld.sizes);
+	return 1;
+}
+
+/*------------------------------------------------------------------------------
+	Allocators
+------------------------------------------------------------------------------*/
+
+typedef struct allocator {
+	const char* name;
+	void  (*begin)(void);
+	void  (*end)(void);
+	void* (*alloc)(const op* o);                        /* OP_MALLOC, OP_CALLOC */
+	void* (*resize)(void* mem, size_t old_size, const op* o); /* mem may be NULL */
+	void  (*release)(void* mem, size_t size, const op* o);
+} allocator;
+
+static void nothing(void)
+{
+}
+
+/* malloc */
+
+static void* c_alloc(const op* o)
+{
+	if (o->type == OP_CALLOC)
+		return calloc((size_t)o->num, (size_t)o->size);
+	return malloc((size_t)o->size);
+}
+
+static void* c_resize(void* mem, size_t old_size, const op* o)
+{
+	(void)old_size;
+	return realloc(mem, (size_t)o->size);
+}
+
+static void c_release(void* mem, size_t size, const op* o)
+{
+	(void)size;
+	(void)o;
+	free(mem);
+}
+
+/* cmonitor */
+
+static FILE* cm_output;
+
+static void cm_begin(void)
+{
+#if defined(_WIN32)
+	cm_output = fopen("NUL", "w");
+#else
+	cm_output = fopen("/dev/null", "w");
+#endif /* _WIN32 */
+	if (!cm_output || !cm_init(cm_output, NULL, 0)) {
+		fprintf(stderr, "cm_replay: cannot initialize cmonitor\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+static void cm_end(void)
+{
+	cm_shutdown();
+	fclose(cm_output);
+}
+
+static void* counters_alloc(const op* o)
+{
+	if (o->type == OP_CALLOC)
+		return cm_calloc_count_((size_t)o->num, (size_t)o->size);
+	return cm_malloc_count_((size_t)o->size);
+}
+
+static void* counters_resize(void* mem, size_t old_size, const op* o)
+{
+	(void)old_size;
+	return cm_realloc_count_(mem, (size_t)o->size);
+}
+
+static void counters_release(void* mem, size_t size, const op* o)
+{
+	(void)size;
+	(void)o;
+	cm_free_count_(mem);
+}
+
+static void* sites_alloc(const op* o)
+{
+	if (o->type == OP_CALLOC)
+		return cm_calloc_site_((size_t)o->num, (size_t)o->size, NULL, o->file, o->line);
+	return cm_malloc_site_((size_t)o->size, NULL, o->file, o->line);
+}
+
+static void* sites_resize(void* mem, size_t old_size, const op* o)
+{
+	(void)old_size;
+	return cm_realloc_site_(mem, (size_t)o->size, NULL, o->file, o->line);
+}
+
+static void* cm_alloc(const op* o)
+{
+	if (o->type == OP_CALLOC)
+		return cm_calloc_((size_t)o->num, (size_t)o->size, o->file, o->line);
+	return cm_malloc_((size_t)o->size, o->file, o->line, 0);
+}
+
+static void* cm_resize(void* mem, size_t old_size, const op* o)
+{
+	(void)old_size;
+	return cm_realloc_(mem, (size_t)o->size, o->file, o->line);
+}
+
+static void cm_release(void* mem, size_t size, const op* o)
+{
+	(void)size;
+	cm_free_(mem, o->file, o->line);
+}
+
+/* arena */
+
+#define ARENA_CHUNK ((size_t)64 * 1024 * 1024)
+#define ALIGNMENT   16
+
+typedef struct arena_chunk {
+	struct arena_chunk* next;
+	size_t size;
+	size_t used;
+} arena_chunk;
+
+static arena_chunk* arena;
+static char* arena_last; /* last block returned, may grow in place */
+
+static size_t align_up(size_t size)
+{
+	return (size + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+static char* arena_data(arena_chunk* c)
+{
+	return (char*)c + align_up(sizeof(arena_chunk));
+}
+
+static void* arena_bump(size_t size)
+{
+	arena_chunk* c;
+	size_t bytes;
+
+	size = align_up(size ? size : 1);
+	if (!arena || arena->size - arena->used < size) {
+		bytes = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+		c = malloc(align_up(sizeof(arena_chunk)) + bytes);
+		if (!c)
+			return NULL;
+		c->next = arena;
+		c->size = bytes;
+		c->used = 0;
+		arena = c;
+	}
+	arena_last = arena_data(arena) + arena->used;
+	arena->used += size;
+	return arena_last;
+}
+
+static void arena_end(void)
+{
+	arena_chunk* next;
+
+	while (arena) {
+		next = arena->next;
+		free(arena);
+		arena = next;
+	}
+	arena_last = NULL;
+}
+
+static void* arena_alloc(const op* o)
+{
+	size_t size = (size_t)(o->type == OP_CALLOC ? o->num * o->size : o->size);
+	void* mem = arena_bump(size);
+
+	if (mem && o->type == OP_CALLOC)
+		memset(mem, 0, size);
+	return mem;
+}
+
+static void* arena_resize(void* mem, size_t old_size, const op* o)
+{
+	size_t size = (size_t)o->size;
+	size_t end;
+	void* new_mem;
+
+	/* the last block grows or shrinks in place while its chunk has room */
+	if (mem && mem == arena_last) {
+		end = (size_t)((char*)mem - arena_data(arena)) + align_up(size ? size : 1);
+		if (end <= arena->size) {
+			arena->used = end;
+			return mem;
+		}
+	}
+	new_mem = arena_bump(size);
+	if (new_mem && mem)
+		memcpy(new_mem, mem, old_size < size ? old_size : size);
+	return new_mem;
+}
+
+static void arena_release(void* mem, size_t size, const op* o)
+{
+	(void)mem;
+	(void)size;
+	(void)o;
+}
+
+/* pool */
+
+#define POOL_MIN_SHIFT 4                 /* 16 bytes */
+#define POOL_CLASSES   12                /* up to 32 KB */
+#define POOL_SLAB      ((size_t)256 * 1024)
+
+typedef struct pool_slab {
+	struct pool_slab* next;
+} pool_slab;
+
+static void* pool_free_lists[POOL_CLASSES];
+static char* pool_cursor[POOL_CLASSES];  /* unused part of the current slab */
+static char* pool_limit[POOL_CLASSES];
+static pool_slab* pool_slabs;
+
+/* Size class of size, POOL_CLASSES if too large for the pool. */
+static int pool_class(size_t size)
+{
+	int c = 0;
+
+	while (c < POOL_CLASSES && ((size_t)1 << (c + POOL_MIN_SHIFT)) < size)
+		++c;
+	return c;
+}
+
+static void* pool_get(size_t size)
+{
+	int c = pool_class(size);
+	size_t block = (size_t)1 << (c + POOL_MIN_SHIFT);
+	pool_slab* slab;
+	void* mem;
+
+	if (c == POOL_CLASSES)
+		return malloc(size);
+	if (pool_free_lists[c]) {
+		mem = pool_free_lists[c];
+		pool_free_lists[c] = *(void**)mem;
+		return mem;
+	}
+	if (pool_cursor[c] == pool_limit[c]) {
+		slab = malloc(align_up(sizeof(pool_slab)) + POOL_SLAB);
+		if (!slab)
+			return NULL;
+		slab->next = pool_slabs;
+		pool_slabs = slab;
+		pool_cursor[c] = (char*)slab + align_up(sizeof(pool_slab));
+		pool_limit[c] = pool_cursor[c] + POOL_SLAB / block * block;
+	}
+	mem = pool_cursor[c];
+	pool_cursor[c] += block;
+	return mem;
+}
+
+static void pool_put(void* mem, size_t size)
+{
+	int c = pool_class(size);
+
+	if (!mem)
+		return;
+	if (c == POOL_CLASSES) {
+		free(mem);
+		return;
+	}
+	*(void**)mem = pool_free_lists[c];
+	pool_free_lists[c] = mem;
+}
+
+static void pool_end(void)
+{
+	pool_slab* next;
+	int c;
+
+	while (pool_slabs) {
+		next = pool_slabs->next;
+		free(pool_slabs);
+		pool_slabs = next;
+	}
+	for (c = 0; c < POOL_CLASSES; ++c)
+		pool_free_lists[c] = pool_cursor[c] = pool_limit[c] = NULL;
+}
+
+static void* pool_alloc(const op* o)
+{
+	size_t size = (size_t)(o->type == OP_CALLOC ? o->num * o->size : o->size);
+	void* mem = pool_get(size);
+
+	if (mem && o->type == OP_CALLOC)
+		memset(mem, 0, size);
+	return mem;
+}
+
+static void* pool_resize(void* mem, size_t old_size, const op* o)
+{
+	size_t size = (size_t)o->size;
+	int c = pool_class(size);
+	void* new_mem;
+
+	if (mem && c < POOL_CLASSES && c == pool_class(old_size))
+		return mem;
+	new_mem = pool_get(size);
+	if (new_mem && mem) {
+		memcpy(new_mem, mem, old_size < size ? old_size : size);
+		pool_put(mem, old_size);
+	}
+	return new_mem;
+}
+
+static void pool_release(void* mem, size_t size, const op* o)
+{
+	(void)o;
+	pool_put(mem, size);
+}
+
+static const allocator allocators[] = {
+	{ "malloc",   nothing,  nothing,    c_alloc,        c_resize,        c_release },
+	{ "counters", cm_begin, cm_end,     counters_alloc, counters_resize, counters_release },
+	{ "sites",    cm_begin, cm_end,     sites_alloc,    sites_resize,    counters_release },
+#if CM_TRACK_LEVEL >= CM_LEVEL_FULL
+	{ "full",     cm_begin, cm_end,     cm_alloc,       cm_resize,       cm_release },
+#else
+	{ "records",  cm_begin, cm_end,     cm_alloc,       cm_resize,       cm_release },
+#endif
+	{ "arena",    nothing,  arena_end,  arena_alloc,    arena_resize,    arena_release },
+	{ "pool",     nothing,  pool_end,   pool_alloc,     pool_resize,     pool_release },
+};
+
+#define ALLOCATOR_COUNT (sizeof(allocators) / sizeof(allocators[0]))
+
+/*------------------------------------------------------------------------------
+	Replay
+------------------------------------------------------------------------------*/
+
+/* Peak resident set of the process so far, in KB. */
+static uint64_t peak_rss_kb(void)
+{
+#if defined(_WIN32)
+	PROCESS_MEMORY_COUNTERS pmc;
+
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return 0;
+	return (uint64_t)pmc.PeakWorkingSetSize / 1024;
+#else
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) != 0)
+		return 0;
+#  if defined(__APPLE__)
+	return (uint64_t)ru.ru_maxrss / 1024; /* bytes */
+#  else
+	return (uint64_t)ru.ru_maxrss;
+#  endif
+#endif /* _WIN32 */
+}
+
+static void touch(void* mem, size_t size)
+{
+	volatile char* p = mem;
+	size_t i;
+
+	for (i = 0; i < size; i += TOUCH_STRIDE)
+		p[i] = (char)i;
+}
+
+static void replay(const allocator* a, const trace* tr)
+{
+	/* frees the blocks the trace never freed */
+	static const op leftover = { OP_FREE, 0, 0, 0, "cm_replay.c", 0 };
+	void** blocks;
+	size_t* sizes;
+	uint64_t base_kb, rss_kb, t0, ns;
+	size_t i, size;
+	const op* o;
+
+	blocks = calloc(tr->ids ? tr->ids : 1, sizeof(void*));
+	sizes = calloc(tr->ids ? tr->ids : 1, sizeof(size_t));
+	if (!blocks || !sizes)
+		out_of_memory();
+	a->begin();
+	base_kb = peak_rss_kb();
+	t0 = cm_now_ns();
+	for (i = 0; i < tr->count; ++i) {
+		o = &tr->ops[i];
+		switch (o->type) {
+			case OP_MALLOC:
+			case OP_CALLOC:
+				size = (size_t)(o->type == OP_CALLOC ? o->num * o->size : o->size);
+				blocks[o->id] = a->alloc(o);
+				break;
+			case OP_REALLOC:
+				size = (size_t)o->size;
+				blocks[o->id] = a->resize(blocks[o->id], sizes[o->id], o);
+				break;
+			default:
+				a->release(blocks[o->id], sizes[o->id], o);
+				blocks[o->id] = NULL;
+				continue;
+		}
+		if (!blocks[o->id] && size) {
+			fprintf(stderr, "cm_replay: %s: out of memory\n", a->name);
+			exit(EXIT_FAILURE);
+		}
+		sizes[o->id] = size;
+		touch(blocks[o->id], size);
+	}
+	ns = cm_now_ns() - t0;
+	rss_kb = peak_rss_kb() - base_kb;
+	/* blocks never freed in the trace */
+	for (i = 0; i < tr->ids; ++i) {
+		if (blocks[i])
+			a->release(blocks[i], sizes[i], &leftover);
+	}
+	a->end();
+	printf("%s,%zu,%llu,%.2f,%llu,%llu,%.1f\n", a->name, tr->count,
+		   (unsigned long long)ns, tr->count ? (double)ns / (double)tr->count : 0.0,
+		   (unsigned long long)(tr->peak_live / 1024), (unsigned long long)rss_kb,
+		   rss_kb * 1024 > tr->peak_live
+		   ? 100.0 * (1.0 - (double)tr->peak_live / (double)(rss_kb * 1024)) : 0.0);
+	fflush(stdout);
+	free(blocks);
+	free(sizes);
+}
+
+/* Run a in a process of its own where there is fork, so the peaks are its own. */
+static int run(const allocator* a, const trace* tr)
+{
+#if defined(_WIN32)
+	replay(a, tr);
+	return 1;
+#else
+	pid_t pid;
+	int status;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		return 0;
+	if (pid == 0) {
+		replay(a, tr);
+		_exit(EXIT_SUCCESS);
+	}
+	return waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+		&& WEXITSTATUS(status) == EXIT_SUCCESS;
+#endif /* _WIN32 */
+}
+
+/* Whether name is in the comma separated list, NULL being everything. */
+static int selected(const char* list, const char* name)
+{
+	size_t len = strlen(name);
+	const char* p = list;
+
+	if (!list)
+		return 1;
+	while ((p = strstr(p, name)) != NULL) {
+		if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+			return 1;
+		p += len;
+	}
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	cm_reader reader;
+	trace tr;
+	char* data;
+	const char* path = NULL;
+	const char* list = NULL;
+	size_t i;
+	int binary, j, ok = 1;
+
+	for (j = 1; j < argc; ++j) {
+		if (strcmp(argv[j], "-a") == 0 && j + 1 < argc)
+			list = argv[++j];
+		else
+			path = argv[j];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: %s [-a allocator,...] file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!load_trace(path, &tr, &data, &reader, &binary))
+		return EXIT_FAILURE;
+	fprintf(stderr, "%zu operations, %u blocks at most, %zu unknown frees dropped\n",
+			tr.count, tr.ids, tr.dropped);
+
+	printf("allocator,ops,ns,ns_per_op,peak_live_kb,peak_rss_kb,frag_pct\n");
+	for (i = 0; i < ALLOCATOR_COUNT; ++i) {
+		if (!selected(list, allocators[i].name))
+			continue;
+		if (!run(&allocators[i], &tr)) {
+			fprintf(stderr, "cm_replay: %s failed\n", allocators[i].name);
+			ok = 0;
+		}
+	}
+
+	free(tr.ops);
+	if (binary)
+		cm_reader_close(&reader);
+	free(data);
+	return ok ? 0 : EXIT_FAILURE;
+}
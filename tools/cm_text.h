@@ -0,0 +1,171 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Reads back the allocation events of cmonitor's text output (see
+ * cm_log_format), optionally prefixed with the timestamps of
+ * cm_trace_decode -t.
+ */
+
+#ifndef CMONITOR_CM_TEXT_H
+#define CMONITOR_CM_TEXT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cm_reader.h"
+
+/*------------------------------------------------------------------------------
+	settings
+------------------------------------------------------------------------------*/
+
+/* flags returned by cm_text_parse */
+#define CM_TEXT_EVENT       0x01
+#define CM_TEXT_TIMED       0x02 /* the line had a "+<ns> " prefix */
+#define CM_TEXT_OLD_ADDRESS 0x04 /* realloc with the old block's address */
+
+/*------------------------------------------------------------------------------
+	delcarations
+------------------------------------------------------------------------------*/
+
+static int cm_text_parse(char* line, cm_reader_event* ev);
+
+/*------------------------------------------------------------------------------
+	implementations
+------------------------------------------------------------------------------*/
+
+static int cm_text_skip(char** p, const char* s)
+{
+	size_t len = strlen(s);
+
+	if (strncmp(*p, s, len) != 0)
+		return 0;
+	*p += len;
+	return 1;
+}
+
+/* Sizes are printed as int, bring the wrapped ones back. */
+static int cm_text_size(char** p, uint64_t* v)
+{
+	char* end;
+	long long n = strtoll(*p, &end, 10);
+
+	if (end == *p)
+		return 0;
+	*v = (uint64_t)(uint32_t)n;
+	*p = end;
+	return 1;
+}
+
+/* "<%p>", which is "(nil)" for NULL with glibc. */
+static int cm_text_address(char** p, uint64_t* v)
+{
+	char* end;
+
+	if (!cm_text_skip(p, "<"))
+		return 0;
+	if (cm_text_skip(p, "(nil)")) {
+		*v = 0;
+	} else {
+		*v = strtoull(*p, &end, 16);
+		if (end == *p)
+			return 0;
+		*p = end;
+	}
+	return cm_text_skip(p, ">");
+}
+
+/*
+ * Parse a NUL terminated line without its newline. The file name is
+ * terminated in place and ev->file points to it. Returns 0 if the line is
+ * not an event, CM_TEXT_* flags otherwise.
+ */
+static int cm_text_parse(char* line, cm_reader_event* ev)
+{
+	char* p = line;
+	char* close;
+	char* colon;
+	int flags = CM_TEXT_EVENT;
+
+	memset(ev, 0, sizeof(cm_reader_event));
+	if (*p == '+') {
+		ev->time = strtoull(p + 1, &p, 10);
+		if (!cm_text_skip(&p, " "))
+			return 0;
+		flags |= CM_TEXT_TIMED;
+	}
+	if (*p != '[' || !(close = strchr(p, ']')))
+		return 0;
+	for (colon = close; colon > p && *colon != ':'; --colon)
+		;
+	if (colon == p)
+		return 0;
+	*colon = '\0';
+	ev->file = p + 1;
+	ev->line = atoi(colon + 1);
+	p = close + 1;
+	if (!cm_text_skip(&p, " ") || !cm_text_address(&p, &ev->address)
+		|| !cm_text_skip(&p, " "))
+		return 0;
+	if (cm_text_skip(&p, "malloc(")) {
+		ev->type = CM_TRACE_EV_MALLOC;
+		return cm_text_size(&p, &ev->size) ? flags : 0;
+	}
+	if (cm_text_skip(&p, "<realloc> malloc(")) {
+		ev->type = CM_TRACE_EV_REALLOC_MALLOC;
+		return cm_text_size(&p, &ev->size) ? flags : 0;
+	}
+	if (cm_text_skip(&p, "free(")) {
+		ev->type = CM_TRACE_EV_FREE;
+		return cm_text_size(&p, &ev->size) ? flags : 0;
+	}
+	if (cm_text_skip(&p, "calloc(")) {
+		ev->type = CM_TRACE_EV_CALLOC;
+		if (!cm_text_size(&p, &ev->arg1) || !cm_text_skip(&p, ", ")
+			|| !cm_text_size(&p, &ev->arg2) || !cm_text_skip(&p, ") | total: ")
+			|| !cm_text_size(&p, &ev->size))
+			return 0;
+		return flags;
+	}
+	if (cm_text_skip(&p, "realloc(from: ")) {
+		ev->type = CM_TRACE_EV_REALLOC;
+		if (!cm_text_size(&p, &ev->arg1) || !cm_text_skip(&p, ", to: ")
+			|| !cm_text_size(&p, &ev->size))
+			return 0;
+		/* older outputs did not have the old address */
+		p = strstr(p, " | old: ");
+		if (p) {
+			p += strlen(" | old: ");
+			if (cm_text_address(&p, &ev->old_address))
+				flags |= CM_TEXT_OLD_ADDRESS;
+		}
+		if (!(flags & CM_TEXT_OLD_ADDRESS))
+			ev->old_address = ev->address;
+		return flags;
+	}
+	return 0;
+}
+
+#endif /* CMONITOR_CM_TEXT_H */
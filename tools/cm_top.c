@@ -0,0 +1,295 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Show the live stats a process publishes with cm_shm_publish.
+ *
+ * usage: cm_top [-i ms] [-n count] pid|name
+ *
+ *   -i ms     time between two screens, 1000 by default
+ *   -n count  stop after count screens, 0 (the default) for never
+ *
+ * The segment is found by the pid of the process when it was published
+ * under the default name, by its name otherwise. It is mapped read-only:
+ * the process is neither paused nor signaled, and reading never delays its
+ * updates. Every screen shows the counters with their rate of change since
+ * the previous one, the sites with the most live bytes and the size
+ * classes with traffic. On a terminal the screen is cleared in between.
+ *
+ * build: cc -O2 -Iinclude -Isrc tools/cm_top.c -o cm_top -lpthread
+ *        (add -lrt with glibc before 2.34)
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <unistd.h>
+#  include <signal.h>
+#  include <errno.h>
+#  include <sys/stat.h>
+#endif /* _WIN32 */
+
+#include "cmonitor/shm.h"
+#include "cm_platform.h"
+#include "cm_shm.h"
+
+/* copies torn by an update before giving up on a screen */
+#define READ_TRIES 1000
+
+static int is_number(const char* s)
+{
+	if (!*s)
+		return 0;
+	for (; *s; ++s) {
+		if (!isdigit((unsigned char)*s))
+			return 0;
+	}
+	return 1;
+}
+
+/* 0 only if the process is known to be gone. */
+static int process_alive(uint32_t pid)
+{
+#if defined(_WIN32)
+	HANDLE h = OpenProcess(SYNCHRONIZE, FALSE, pid);
+	DWORD r;
+
+	if (!h)
+		return GetLastError() != ERROR_INVALID_PARAMETER;
+	r = WaitForSingleObject(h, 0);
+	CloseHandle(h);
+	return r != WAIT_OBJECT_0;
+#else
+	return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+#endif /* _WIN32 */
+}
+
+/* Map an existing segment read-only. */
+static int shm_attach(cm_shm_map* map, const char* name)
+{
+	cm_shm_segment* seg;
+#if !defined(_WIN32)
+	struct stat st;
+	int fd;
+#endif /* _WIN32 */
+
+	if (strlen(name) >= sizeof(map->name))
+		return 0;
+#if defined(_WIN32)
+	map->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (!map->mapping)
+		return 0;
+	seg = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, sizeof(cm_shm_segment));
+	if (!seg) {
+		CloseHandle(map->mapping);
+		return 0;
+	}
+#else
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return 0;
+	/* mapping past the end of the object would fault on access */
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(cm_shm_segment)) {
+		close(fd);
+		return 0;
+	}
+	seg = mmap(NULL, sizeof(cm_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (seg == MAP_FAILED)
+		return 0;
+#endif /* _WIN32 */
+	map->seg = seg;
+	strcpy(map->name, name);
+	return 1;
+}
+
+/*
+ * Take a consistent copy of the segment. Returns 0 if max_tries copies in a
+ * row were torn by an update, or the segment is not a valid one.
+ */
+static int shm_read(const cm_shm_segment* seg, cm_shm_segment* out, int max_tries)
+{
+	uint32_t s1, s2;
+
+	if (memcmp(seg->magic, CM_SHM_MAGIC, sizeof(CM_SHM_MAGIC)) != 0)
+		return 0;
+	while (max_tries-- > 0) {
+		s1 = cm_atomic_load_acquire_u32(&seg->seq);
+		if (s1 & 1)
+			continue;
+		memcpy(out, (const void*)seg, sizeof(*out));
+		cm_atomic_fence();
+		s2 = cm_atomic_load_u32(&seg->seq);
+		if (s1 == s2)
+			return out->version == CM_SHM_VERSION && out->size == sizeof(*out);
+	}
+	return 0;
+}
+
+/* Spinning on a single CPU only delays the writer: yield now and then. */
+static int read_segment(const cm_shm_segment* seg, cm_shm_segment* out)
+{
+	int i;
+
+	for (i = 0; i < 100; ++i) {
+		if (shm_read(seg, out, READ_TRIES))
+			return 1;
+		if (memcmp(seg->magic, CM_SHM_MAGIC, sizeof(CM_SHM_MAGIC)) != 0)
+			return 0;
+		cm_sleep_ms(1);
+	}
+	return 0;
+}
+
+/* Per second change of a counter, 0 without a previous screen. */
+static double rate(uint32_t now, uint32_t before, double seconds)
+{
+	return seconds > 0.0 ? (double)(uint32_t)(now - before) / seconds : 0.0;
+}
+
+static void print_screen(const cm_shm_segment* s, const cm_shm_segment* prev)
+{
+	double seconds = 0.0;
+	uint32_t i;
+
+	if (prev && s->time_ns > prev->time_ns)
+		seconds = (double)(s->time_ns - prev->time_ns) / 1e9;
+	else
+		prev = NULL;
+	printf("pid %u   up %.1f s   update %llu every %u ms   epoch %u\n",
+		   s->pid, (double)s->time_ns / 1e9, (unsigned long long)s->updates,
+		   s->interval_ms, s->epoch);
+	printf("live     %10u KiB %10u blocks   peak %u KiB\n",
+		   s->live_bytes / 1024, s->live_blocks, s->peak_bytes / 1024);
+	printf("resident %10llu KiB   overhead %u KiB   dropped events %u\n",
+		   (unsigned long long)(s->rss_bytes / 1024), s->overhead_bytes / 1024,
+		   s->dropped_events);
+	printf("\n%-10s %12s %12s\n", "", "total", "per second");
+	printf("%-10s %12u %12.0f\n", "malloc", s->malloc_count,
+		   prev ? rate(s->malloc_count, prev->malloc_count, seconds) : 0.0);
+	printf("%-10s %12u %12.0f\n", "calloc", s->calloc_count,
+		   prev ? rate(s->calloc_count, prev->calloc_count, seconds) : 0.0);
+	printf("%-10s %12u %12.0f\n", "realloc", s->realloc_count,
+		   prev ? rate(s->realloc_count, prev->realloc_count, seconds) : 0.0);
+	printf("%-10s %12u %12.0f\n", "free", s->free_count,
+		   prev ? rate(s->free_count, prev->free_count, seconds) : 0.0);
+	printf("%-10s %12u %12.0f\n", "KiB alloc", s->total_allocated / 1024,
+		   prev ? rate(s->total_allocated, prev->total_allocated, seconds) / 1024 : 0.0);
+	printf("%-10s %12u %12.0f\n", "KiB freed", s->total_freed / 1024,
+		   prev ? rate(s->total_freed, prev->total_freed, seconds) / 1024 : 0.0);
+
+	printf("\n%-32s %10s %8s %10s %10s\n", "site", "live KiB", "blocks", "allocs", "peak KiB");
+	for (i = 0; i < s->site_count && i < CM_SHM_TOP_SITES; ++i) {
+		char where[80];
+
+		snprintf(where, sizeof(where), "%.60s:%u", s->sites[i].file, s->sites[i].line);
+		printf("%-32s %10u %8u %10u %10u\n", where, s->sites[i].live_bytes / 1024,
+			   s->sites[i].live_count, s->sites[i].alloc_count,
+			   s->sites[i].peak_bytes / 1024);
+	}
+
+	printf("\n%-21s %10s %10s %10s\n", "size", "allocs", "frees", "reallocs");
+	for (i = 0; i < s->class_count && i < CM_SHM_CLASSES; ++i) {
+		char range[48];
+
+		snprintf(range, sizeof(range), "%llu-%llu",
+				 (unsigned long long)s->classes[i].min_size,
+				 (unsigned long long)s->classes[i].max_size);
+		printf("%-21s %10u %10u %10u\n", range, s->classes[i].allocs,
+			   s->classes[i].frees, s->classes[i].reallocs);
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	cm_shm_map map;
+	cm_shm_segment* snap;
+	char name[64];
+	const char* target = NULL;
+	unsigned interval = 1000;
+	unsigned long count = 0, screen;
+	int j, clear = 0, have_prev = 0;
+
+	for (j = 1; j < argc; ++j) {
+		if (strcmp(argv[j], "-i") == 0 && j + 1 < argc)
+			interval = (unsigned)strtoul(argv[++j], NULL, 10);
+		else if (strcmp(argv[j], "-n") == 0 && j + 1 < argc)
+			count = strtoul(argv[++j], NULL, 10);
+		else
+			target = argv[j];
+	}
+	if (!target || interval == 0) {
+		fprintf(stderr, "usage: %s [-i ms] [-n count] pid|name\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (is_number(target))
+		cm_shm_default_name(name, sizeof(name), strtoul(target, NULL, 10));
+	else
+		snprintf(name, sizeof(name), "%s", target);
+	if (!shm_attach(&map, name)) {
+		fprintf(stderr, "cm_top: cannot open the segment '%s'\n", name);
+		return EXIT_FAILURE;
+	}
+	/* this one and the previous screen */
+	snap = malloc(2 * sizeof(cm_shm_segment));
+	if (!snap) {
+		cm_shm_close(&map, 0);
+		return EXIT_FAILURE;
+	}
+#if !defined(_WIN32)
+	clear = isatty(STDOUT_FILENO);
+#endif /* _WIN32 */
+
+	for (screen = 0; count == 0 || screen < count; ++screen) {
+		if (screen > 0)
+			cm_sleep_ms(interval);
+		if (!read_segment(map.seg, &snap[screen & 1])) {
+			fprintf(stderr, "cm_top: '%s' is not a valid segment\n", name);
+			break;
+		}
+		if (clear)
+			printf("\033[H\033[J");
+		else if (screen > 0)
+			printf("\n");
+		print_screen(&snap[screen & 1], have_prev ? &snap[(screen + 1) & 1] : NULL);
+		fflush(stdout);
+		have_prev = 1;
+		if (!process_alive(snap[screen & 1].pid)) {
+			fprintf(stderr, "cm_top: process %u has exited\n", snap[screen & 1].pid);
+			break;
+		}
+	}
+
+	free(snap);
+	cm_shm_close(&map, 0);
+	return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * The MIT License
+ *
+ * Copyright 2018 Andrea Vouk.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * Turn a binary trace written by cm_trace_open back into cmonitor's usual
+ * text output.
+ *
+ * usage: cm_trace_decode [-t] trace_file
+ *
+ *   -t  prefix every line with the nanoseconds elapsed since the first event
+ *
+ * build: cc -Iinclude -Isrc tools/cm_trace_decode.c -o cm_trace_decode
+ */
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cm_log.h"
+#include "cm_reader.h"
+
+int main(int argc, char* argv[])
+{
+	cm_reader reader;
+	cm_reader_event rev;
+	cm_event ev;
+	char line[CM_LOG_LINE_MAX];
+	uint64_t first = 0;
+	int timestamps = 0, n = 0, len;
+	const char* path = NULL;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-t") == 0)
+			timestamps = 1;
+		else
+			path = argv[i];
+	}
+	if (!path) {
+		fprintf(stderr, "usage: %s [-t] trace_file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (!cm_reader_open(&reader, path)) {
+		fprintf(stderr, "%s: not a valid cmonitor trace\n", path);
+		return EXIT_FAILURE;
+	}
+	while (cm_reader_next(&reader, &rev)) {
+		memset(&ev, 0, sizeof(ev));
+		ev.type = rev.type - 1; /* CM_TRACE_EV_* to CM_EV_* */
+		ev.filename = rev.file;
+		ev.line = rev.line;
+		ev.address = (void*)(uintptr_t)rev.address;
+		ev.old_address = (void*)(uintptr_t)rev.old_address;
+		ev.size = (size_t)rev.size;
+		ev.arg1 = (size_t)rev.arg1;
+		ev.arg2 = (size_t)rev.arg2;
+		if (n++ == 0)
+			first = rev.time;
+		len = cm_log_format(line, &ev);
+		if (timestamps)
+			printf("+%llu ", (unsigned long long)(rev.time - first));
+		fwrite(line, 1, (size_t)len, stdout);
+	}
+	cm_reader_close(&reader);
+	return 0;
+}